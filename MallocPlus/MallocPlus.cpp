@@ -205,6 +205,7 @@ void *MallocPlus::memory_realloc(size_t nelem, size_t elsize, void *malloc_mem_p
          } else {
             // Just move size to use more of memory buffer
             it->mem_nelem  = nelem;
+            mem_ptr        = it->mem_ptr;
          }
       }
 #ifdef HAVE_J7
@@ -252,6 +253,7 @@ void *MallocPlus::memory_realloc(size_t nelem, size_t elsize, const char *name){
          } else {
             // Just move size to use more of memory buffer
             it->mem_nelem  = nelem;
+            mem_ptr        = it->mem_ptr;
          }
       }
 #ifdef HAVE_J7
@@ -321,6 +323,9 @@ void MallocPlus::memory_realloc_all(size_t nelem){
    void *mem_ptr=NULL;
 
    for ( it=memory_list.begin(); it != memory_list.end(); it++){
+      // Scratch entries hold no data and are sized by their owner
+      if (it->mem_flags & SCRATCH_MEMORY) continue;
+
       if (it->mem_flags & HOST_MANAGED_MEMORY) {
          if (nelem > it->mem_capacity) {
             mem_ptr=realloc(it->mem_ptr, nelem*it->mem_elsize);
@@ -398,9 +403,8 @@ void *MallocPlus::memory_add(void *malloc_mem_ptr, size_t nelem, size_t elsize,
    return(malloc_mem_ptr);
 }
 
-real_t *MallocPlus::memory_reorder(real_t *malloc_mem_ptr, int *iorder){
+void *MallocPlus::memory_reorder(void *malloc_mem_ptr, int *iorder){
    list<malloc_plus_memory_entry>::iterator it;
-   real_t *ptr;
 
    for ( it=memory_list.begin(); it != memory_list.end(); it++){
       if (DEBUG) printf("Testing it ptr %p ptr in %p name %s\n",it->mem_ptr,malloc_mem_ptr,it->mem_name);
@@ -408,13 +412,17 @@ real_t *MallocPlus::memory_reorder(real_t *malloc_mem_ptr, int *iorder){
    }
    if (it != memory_list.end() ){
       if (DEBUG) printf("Found it ptr %p name %s\n",it->mem_ptr,it->mem_name);
-      real_t *tmp = (real_t *)malloc(it->mem_nelem*it->mem_elsize);
+      // Elements are moved whole, whatever their type or record size
+      size_t elsize = it->mem_elsize;
+      char *mem_ptr = (char *)malloc_mem_ptr;
+      char *tmp = (char *)malloc(it->mem_nelem*elsize);
       for (uint ic = 0; ic < it->mem_nelem; ic++){
-         tmp[ic] = malloc_mem_ptr[iorder[ic]];
+         memcpy(&tmp[ic*elsize], &mem_ptr[iorder[ic]*elsize], elsize);
       }
-      SWAP_PTR(malloc_mem_ptr, tmp, ptr);
-      free(tmp);
-      it->mem_ptr = malloc_mem_ptr;
+      free(mem_ptr);
+      malloc_mem_ptr = (void *)tmp;
+      it->mem_ptr      = malloc_mem_ptr;
+      it->mem_capacity = it->mem_nelem;
    } else {
       if (DEBUG) printf("Warning -- memory pointer %p not found\n",malloc_mem_ptr);
    }
@@ -685,6 +693,36 @@ void *MallocPlus::memory_replace(void *malloc_mem_ptr_old, void * const malloc_m
    return(NULL);
 }
 
+void MallocPlus::memory_swap(void **malloc_mem_ptr_a, void **malloc_mem_ptr_b){
+   list<malloc_plus_memory_entry>::iterator it, it_a=memory_list.end(), it_b=memory_list.end();
+
+   for ( it=memory_list.begin(); it != memory_list.end(); it++){
+      if (DEBUG) printf("Testing it ptr %p ptr a %p ptr b %p name %s\n",it->mem_ptr,*malloc_mem_ptr_a,*malloc_mem_ptr_b,it->mem_name);
+      if (*malloc_mem_ptr_a == it->mem_ptr) it_a = it;
+      if (*malloc_mem_ptr_b == it->mem_ptr) it_b = it;
+   }
+   if (it_a != memory_list.end() && it_b != memory_list.end()){
+      if (DEBUG) printf("Swapping ptr %p name %s with ptr %p name %s\n",it_a->mem_ptr,it_a->mem_name,it_b->mem_ptr,it_b->mem_name);
+      // The memory and its characteristics move between the entries. The names and
+      // the scratch flag stay with the entries.
+      malloc_plus_memory_entry memory_item = *it_a;
+      it_a->mem_ptr      = it_b->mem_ptr;
+      it_a->mem_nelem    = it_b->mem_nelem;
+      it_a->mem_capacity = it_b->mem_capacity;
+      it_a->mem_elsize   = it_b->mem_elsize;
+      it_a->mem_flags    = (it_b->mem_flags & ~SCRATCH_MEMORY) | (memory_item.mem_flags & SCRATCH_MEMORY);
+      it_b->mem_flags    = (memory_item.mem_flags & ~SCRATCH_MEMORY) | (it_b->mem_flags & SCRATCH_MEMORY);
+      it_b->mem_ptr      = memory_item.mem_ptr;
+      it_b->mem_nelem    = memory_item.mem_nelem;
+      it_b->mem_capacity = memory_item.mem_capacity;
+      it_b->mem_elsize   = memory_item.mem_elsize;
+      *malloc_mem_ptr_a = it_a->mem_ptr;
+      *malloc_mem_ptr_b = it_b->mem_ptr;
+   } else {
+      if (DEBUG) printf("Warning -- memory not found\n");
+   }
+}
+
 void *MallocPlus::get_memory_ptr(const char *name){
    list<malloc_plus_memory_entry>::iterator it;
 
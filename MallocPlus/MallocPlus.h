@@ -70,6 +70,7 @@ typedef float real_t;
 #define DEVICE_REGULAR_MEMORY 0x00002
 #define INDEX_ARRAY_MEMORY    0x00004
 #define LOAD_BALANCE_MEMORY   0x00008
+#define SCRATCH_MEMORY        0x00010
 
 #if defined(HAVE_MPI)
 #include "mpi.h"
@@ -124,10 +125,12 @@ public:
 
    void *memory_replace(void *malloc_mem_ptr_old, void * const malloc_mem_ptr_new);
 
+   void memory_swap(void **malloc_mem_ptr_a, void **malloc_mem_ptr_b);
+
    void *memory_add(void *malloc_mem_ptr, size_t nelem, size_t elsize, const char *name);
    void *memory_add(void *malloc_mem_ptr, size_t nelem, size_t elsize, int flags, const char *name);
 
-   real_t *memory_reorder(real_t *malloc_mem_ptr, int *iorder);
+   void *memory_reorder(void *malloc_mem_ptr, int *iorder);
 
    void memory_report(void);
 
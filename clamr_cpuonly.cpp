@@ -299,6 +299,9 @@ extern "C" void do_calc(void)
    }
    printf("Iteration %3d timestep %lf Sim Time %lf cells %ld Mass Sum %14.12lg Mass Change %12.6lg\n",
       ncycle, deltaT, simTime, ncells, H_sum, H_sum - H_sum_initial);
+#ifdef HAVE_MIXED_PRECISION
+   state->output_storage_drift(H_sum);
+#endif
 
    struct timeval tstart_cpu;
    cpu_timer_start(&tstart_cpu);
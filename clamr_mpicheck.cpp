@@ -183,9 +183,9 @@ int main(int argc, char **argv) {
 
    state_global = new State(mesh_global);
    state_global->allocate(ncells_global);
-   real_t  *H_global = state_global->H;
-   real_t  *U_global = state_global->U;
-   real_t  *V_global = state_global->V;
+   state_t *H_global = state_global->H;
+   state_t *U_global = state_global->U;
+   state_t *V_global = state_global->V;
 
    vector<int>   &nsizes     = mesh->nsizes;
    vector<int>   &ndispl     = mesh->ndispl;
@@ -247,9 +247,9 @@ int main(int argc, char **argv) {
 
    state->fill_circle(circ_radius, 100.0, 7.0);
 
-   MPI_Allgatherv(&state->H[0], nsizes[mype], MPI_C_REAL, &H_global[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
-   MPI_Allgatherv(&state->U[0], nsizes[mype], MPI_C_REAL, &U_global[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
-   MPI_Allgatherv(&state->V[0], nsizes[mype], MPI_C_REAL, &V_global[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
+   MPI_Allgatherv(&state->H[0], nsizes[mype], MPI_C_STATE, &H_global[0], &nsizes[0], &ndispl[0], MPI_C_STATE, MPI_COMM_WORLD);
+   MPI_Allgatherv(&state->U[0], nsizes[mype], MPI_C_STATE, &U_global[0], &nsizes[0], &ndispl[0], MPI_C_STATE, MPI_COMM_WORLD);
+   MPI_Allgatherv(&state->V[0], nsizes[mype], MPI_C_STATE, &V_global[0], &nsizes[0], &ndispl[0], MPI_C_STATE, MPI_COMM_WORLD);
 
    mesh->nlft = NULL;
    mesh->nrht = NULL;
@@ -543,7 +543,7 @@ extern "C" void do_calc(void)
       MPI_Allgatherv(&dx[0], nsizes[mype], MPI_C_REAL, &dx_global[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
       MPI_Allgatherv(&y[0],  nsizes[mype], MPI_C_REAL, &y_global[0],  &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
       MPI_Allgatherv(&dy[0], nsizes[mype], MPI_C_REAL, &dy_global[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
-      MPI_Allgatherv(&state->H[0],  nsizes[mype], MPI_C_REAL, &state_global->H[0],  &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
+      MPI_Allgatherv(&state->H[0],  nsizes[mype], MPI_C_STATE, &state_global->H[0],  &nsizes[0], &ndispl[0], MPI_C_STATE, MPI_COMM_WORLD);
 
       if (view_mode == 0) {
          mesh->proc.resize(ncells);
@@ -132,7 +132,7 @@ int main(int argc, char **argv) {
    int nt = 0;
    int tid = 0;
 
-   nt = omp_get_num_threads();
+   nt = omp_get_max_threads();
    tid = omp_get_thread_num();
 
    if (0 == tid) {
@@ -314,6 +314,9 @@ extern "C" void do_calc(void)
    }
    printf("Iteration %3d timestep %lf Sim Time %lf cells %ld Mass Sum %14.12lg Mass Change %12.6lg\n",
       ncycle, deltaT, simTime, ncells, H_sum, H_sum - H_sum_initial);
+#ifdef HAVE_MIXED_PRECISION
+   state->output_storage_drift(H_sum);
+#endif
 
    struct timeval tstart_cpu;
    cpu_timer_start(&tstart_cpu);
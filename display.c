@@ -144,7 +144,7 @@ static int display_outline;
 static int display_view_mode = 0;
 static int display_mysize    = 0;
 static real_t *x=NULL, *y=NULL, *dx=NULL, *dy=NULL;
-static real_t *data=NULL;
+static state_t *data=NULL;
 static int *display_proc=NULL;
 static int rank = 0;
 
@@ -301,7 +301,7 @@ void set_window(real_t display_xmin_in, real_t display_xmax_in, real_t display_y
    display_ymin = display_ymin_in;
    display_ymax = display_ymax_in;
 }
-void set_cell_data(real_t *data_in){
+void set_cell_data(state_t *data_in){
    data = data_in;
 }
 void set_cell_proc(int *display_proc_in){
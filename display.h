@@ -109,6 +109,11 @@ typedef double      real_t;
 #else
 typedef float       real_t;
 #endif
+#ifdef HAVE_MIXED_PRECISION
+typedef float       state_t;
+#else
+typedef real_t      state_t;
+#endif
 
 void init_display(int *argc, char **argv, const char* string, int mype_in);
 void set_idle_function(void (*function)(void));
@@ -119,7 +124,7 @@ void set_outline(int display_outline_in);
 void set_mysize(int mysize_in);
 void set_window(real_t display_xmin_in, real_t display_xmax_in, real_t display_ymin_in, real_t display_ymax_in);
 void set_cell_coordinates(real_t *x_in, real_t *dx_in, real_t *y_in, real_t *dy_in);
-void set_cell_data(real_t *data_in);
+void set_cell_data(state_t *data_in);
 void set_cell_proc(int *display_proc_in);
 void set_circle_radius(double display_circle_radius_in);
 void draw_scene(void);
@@ -1,6 +1,8 @@
+#define _XOPEN_SOURCE 600
 #include <stdio.h>
-#define __USE_XOPEN
 #include <stdlib.h>
+#include <limits.h>
+#include <sys/time.h>
 #include "hash.h"
 #include "genmalloc/genmalloc.h"
 #ifdef HAVE_OPENCL
@@ -8,24 +10,21 @@
 #include "hashlib_source_kern.inc"
 #endif
 
-static ulong AA;
-static ulong BB;
-static ulong prime=4294967291;
-static uint hashtablesize;
-static uint hash_stride;
-static uint hash_ncells;
-static uint write_hash_collisions;
-static uint read_hash_collisions;
+static ulong prime=HASH_PRIME;
 static double write_hash_collisions_runsum = 0.0;
 static double read_hash_collisions_runsum = 0.0;
 static uint write_hash_collisions_count = 0;
 static uint read_hash_collisions_count = 0;
-static uint hash_report_level = 2;
-static uint hash_queries;
-static int hash_method = METHOD_UNSET;
-static uint hash_jump_prime = 41;
+static uint final_hashtablesize = 0;
+static double write_probe_hist_runsum[HASH_PROBE_BINS];
+static double read_probe_hist_runsum[HASH_PROBE_BINS];
+static uint hash_jump_prime = HASH_JUMP_PRIME;
 static double hash_mult = 3.0;
 
+// Context behind the original single-table interface and the GPU routines
+static hash_context default_hash_context = { NULL, 0, 0, METHOD_UNSET, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0,
+   {0}, {0}, NULL, 0, 0, 0, 0, 0, 0, 0, 0.0, 0.0, 0.0, NULL, 0 };
+
 size_t hash_header_size = 16;
 
 cl_mem dev_hash_header = NULL;
@@ -34,344 +33,995 @@ float mem_opt_factor;
 
 int   choose_hash_method = METHOD_UNSET;
 
+static const char *hash_method_name[] = { "unset", "perfect", "linear", "quadratic", "prime_jump",
+   "paged", "bucket", "robin_hood", "cuckoo", "adaptive" };
+
+// Candidates for the adaptive method, in the order of hash_selector stats
+static const int hash_adapt_method[HASH_ADAPT_NMETHODS] = { PERFECT_HASH, PAGED_HASH, QUADRATIC, BUCKET_HASH };
+
+// Selector behind contexts set up without one and the single-table interface
+static hash_selector default_hash_selector = { {{0.0, 0.0, 0.0, 0, 0}}, METHOD_UNSET, 0 };
+
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
-int *compact_hash_init(int ncells, uint isize, uint jsize, uint report_level){
-   hash_ncells = 0;
-   write_hash_collisions = 0;
-   read_hash_collisions = 0;
-   hash_queries = 0;
-   hash_report_level = report_level;
-   hash_stride = isize;
-   int *hash = NULL;
+// Collision counters are shared by all threads when the probes are called
+// from an OpenMP parallel region
+#ifdef _OPENMP
+#define HASH_COUNTER_ADD(counter, val) _Pragma("omp atomic") counter += (val)
+#else
+#define HASH_COUNTER_ADD(counter, val) counter += (val)
+#endif
+
+static double hash_wall_time(void){
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return((double)tv.tv_sec + 1.0e-6*(double)tv.tv_usec);
+}
+
+static int hash_adapt_stale(const hash_adapt_stats *st, double fill){
+   if (st->builds == 0 || st->age >= HASH_ADAPT_MAX_AGE) return(1);
+   if (fill > st->fill*HASH_ADAPT_FILL_RATIO || fill*HASH_ADAPT_FILL_RATIO < st->fill) return(1);
+   return(0);
+}
+
+// Picks the method for the next build. A candidate without a current
+// measurement is timed first, otherwise the cheapest measured one is used.
+// The perfect hash stays out when its table would break the memory limit.
+static int hash_adapt_choose(hash_selector *sel, uint report_level, double fill, int perfect_allowed){
+   hash_adapt_stats *hash_adapt = sel->stats;
+   int ichoice = -1;
+   const char *reason = "measure";
+
+   for (int im = 0; im < HASH_ADAPT_NMETHODS; im++){
+      if (hash_adapt_method[im] == PERFECT_HASH && ! perfect_allowed) continue;
+      if (hash_adapt_stale(&hash_adapt[im], fill)) {
+         ichoice = im;
+         break;
+      }
+   }
+
+   if (ichoice < 0) {
+      reason = "cheapest";
+      int icheapest = -1;
+      for (int im = 0; im < HASH_ADAPT_NMETHODS; im++){
+         if (hash_adapt_method[im] == PERFECT_HASH && ! perfect_allowed) continue;
+         if (hash_adapt_method[im] == sel->current) ichoice = im;
+         if (icheapest < 0 || hash_adapt[im].cost < hash_adapt[icheapest].cost) icheapest = im;
+      }
+      if (ichoice < 0 || hash_adapt[icheapest].cost < HASH_ADAPT_MARGIN*hash_adapt[ichoice].cost) ichoice = icheapest;
+   }
 
-   if (choose_hash_method != METHOD_UNSET) hash_method = choose_hash_method;
+   for (int im = 0; im < HASH_ADAPT_NMETHODS; im++){
+      if (im != ichoice) hash_adapt[im].age++;
+   }
+
+   int method = hash_adapt_method[ichoice];
+   if (report_level >= 2) {
+      printf("Adaptive hash -- fill %lf, chose %s to %s, cost per cell (ns)",fill,hash_method_name[method],reason);
+      for (int im = 0; im < HASH_ADAPT_NMETHODS; im++){
+         printf(" %s %.2lf",hash_method_name[hash_adapt_method[im]],hash_adapt[im].cost*1.0e9);
+      }
+      printf("\n");
+   } else if (report_level >= 1 && method != sel->current && sel->current != METHOD_UNSET) {
+      printf("Adaptive hash -- fill %lf, switching from %s to %s to %s\n",fill,
+         hash_method_name[sel->current],hash_method_name[method],reason);
+   }
+   if (method != sel->current && sel->current != METHOD_UNSET) sel->switches++;
+   sel->current = method;
+
+   return(method);
+}
+
+// Folds the measured build and query time into the running cost of the
+// method. A measurement taken at a different fill replaces the old one.
+static void hash_adapt_record(hash_context *ctx){
+   int ichoice = -1;
+   for (int im = 0; im < HASH_ADAPT_NMETHODS; im++){
+      if (hash_adapt_method[im] == ctx->hash_method) ichoice = im;
+   }
+   if (ichoice < 0 || ctx->hash_build_ncells <= 0) return;
+
+   double ncells = (double)ctx->hash_build_ncells;
+   double cost = ctx->hash_time/ncells;
+   double collisions = (double)(ctx->write_hash_collisions + ctx->read_hash_collisions)/ncells;
+
+   hash_adapt_stats *st = &ctx->hash_select->stats[ichoice];
+   if (hash_adapt_stale(st, ctx->hash_fill)) {
+      st->cost = cost;
+      st->collisions = collisions;
+   } else {
+      st->cost = 0.5*(st->cost + cost);
+      st->collisions = 0.5*(st->collisions + collisions);
+   }
+   st->fill = ctx->hash_fill;
+   st->age = 0;
+   st->builds++;
+}
+
+static int compact_hash_setup(hash_context *ctx, int ncells, uint isize, uint jsize, uint report_level){
+   ctx->hash_ncells = 0;
+   ctx->write_hash_collisions = 0;
+   ctx->read_hash_collisions = 0;
+   ctx->hash_queries = 0;
+   for (int ib = 0; ib < HASH_PROBE_BINS; ib++){
+      ctx->write_probe_hist[ib] = 0;
+      ctx->read_probe_hist[ib] = 0;
+   }
+   ctx->hash_report_level = report_level;
+   ctx->hash_stride = isize;
+   ctx->hash_pages = NULL;
+   ctx->hash_page_stride = 0;
+   ctx->hash_npages = 0;
+   ctx->hash_pages_allocated = 0;
+   ctx->hash_max_probe = 0;
+   ctx->hash_rehashes = 0;
+
+   ctx->hash_method = choose_hash_method;
+   ctx->hash_adaptive = (choose_hash_method == ADAPTIVE_HASH);
+   ctx->hash_build_ncells = ncells;
+   ctx->hash_time = 0.0;
+   ctx->hash_start_time = hash_wall_time();
 
    uint compact_hash_size = (uint)((double)ncells*hash_mult);
-   uint perfect_hash_size = (uint)(isize*jsize);
+   ulong perfect_hash_size = (ulong)isize*(ulong)jsize;
+   ctx->hash_fill = (perfect_hash_size > 0) ? (double)ncells/(double)perfect_hash_size : 0.0;
 
-   if (hash_method == METHOD_UNSET){
+   if (ctx->hash_method == METHOD_UNSET || ctx->hash_adaptive){
+      // The limit was set for one int per perfect hash position; a perfect
+      // table now holds a value/epoch pair per position
       float hash_mem_factor = 20.0;
-      float hash_mem_ratio = (double)perfect_hash_size/(double)compact_hash_size;
+      float hash_mem_ratio = (double)perfect_hash_size/(double)compact_hash_size *
+                             (double)(2*sizeof(hash_slot_t))/(double)sizeof(int);
       if (mem_opt_factor != 1.0) hash_mem_factor /= (mem_opt_factor*0.2); 
-      hash_method = (hash_mem_ratio < hash_mem_factor) ? PERFECT_HASH : QUADRATIC;
+      if (ctx->hash_adaptive) {
+         int perfect_allowed = (hash_mem_ratio < hash_mem_factor);
+         // Tables for the same mesh may be set up from several threads
+#ifdef _OPENMP
+#pragma omp critical (hash_selector)
+#endif
+         ctx->hash_method = hash_adapt_choose(ctx->hash_select, report_level, ctx->hash_fill, perfect_allowed);
+      } else {
+         ctx->hash_method = (hash_mem_ratio < hash_mem_factor) ? PERFECT_HASH : QUADRATIC;
+      }
 
-      if (hash_report_level >= 2) printf("DEBUG hash_method %d hash_mem_ratio %f hash_mem_factor %f mem_opt_factor %f perfect_hash_size %u compact_hash_size %u\n",
-         hash_method,hash_mem_ratio,hash_mem_factor,mem_opt_factor,perfect_hash_size,compact_hash_size);
+      if (ctx->hash_report_level >= 2) printf("DEBUG hash_method %d hash_mem_ratio %f hash_mem_factor %f mem_opt_factor %f perfect_hash_size %lu compact_hash_size %u\n",
+         ctx->hash_method,hash_mem_ratio,hash_mem_factor,mem_opt_factor,perfect_hash_size,compact_hash_size);
    }
 
-   int do_compact_hash = (hash_method == PERFECT_HASH) ? 0 : 1;
+   if (ctx->hash_method == PAGED_HASH) {
+      ctx->hash_page_stride = (isize+HASH_PAGE_MASK) >> HASH_PAGE_BITS;
+      ctx->hash_npages = ctx->hash_page_stride*((jsize+HASH_PAGE_MASK) >> HASH_PAGE_BITS);
+      ctx->hashtablesize = 0;
+      if (ctx->hash_report_level >= 2) printf("DEBUG paged hash directory %u pages of %d perfect hash table size %lu\n",
+         ctx->hash_npages,HASH_PAGE_SIZE,perfect_hash_size);
+      return(0);
+   }
 
-   if (hash_report_level >= 2) printf("DEBUG do_compact_hash %d hash_method %d perfect_hash_size %u compact_hash_size %u\n",
-      do_compact_hash,hash_method,perfect_hash_size,compact_hash_size);
+   int do_compact_hash = (ctx->hash_method == PERFECT_HASH) ? 0 : 1;
 
-   if (do_compact_hash) {
-      hashtablesize = compact_hash_size;
-      AA = (ulong)(1.0+(double)(prime-1)*drand48());
-      BB = (ulong)(0.0+(double)(prime-1)*drand48());
-      if (AA > prime-1 || BB > prime-1) exit(0);
-      if (hash_report_level > 1) printf("Factors AA %lu BB %lu\n",AA,BB);
+   if (ctx->hash_report_level >= 2) printf("DEBUG do_compact_hash %d hash_method %d perfect_hash_size %lu compact_hash_size %u\n",
+      do_compact_hash,ctx->hash_method,perfect_hash_size,compact_hash_size);
 
-      hash = (int *)genvector(2*hashtablesize,sizeof(int));
-      for (uint ii = 0; ii<2*hashtablesize; ii+=2){
-         hash[ii] = -1;
+   if (! do_compact_hash && perfect_hash_size > (ulong)INT_MAX) {
+      printf("Error -- perfect hash table size %lu is too large, use a compact hash method\n",perfect_hash_size);
+      exit(1);
+   }
+#ifndef HAVE_HASH_KEY64
+   // the largest key would alias the empty slot marker
+   if (do_compact_hash && perfect_hash_size >= (ulong)UINT_MAX) {
+      printf("Error -- %lu hash keys do not fit in 32 bits, configure with -DHASH_KEY64=on\n",perfect_hash_size);
+      exit(1);
+   }
+#endif
+
+   if (do_compact_hash) {
+      if (ctx->hash_method == ROBIN_HOOD || ctx->hash_method == CUCKOO_HASH) {
+         compact_hash_size = (uint)((double)ncells*HASH_MULT_DENSE)+1;
+      }
+      ctx->hashtablesize = compact_hash_size;
+      // same number of slots, grouped into buckets
+      if (HASH_BUCKET_LAYOUT(ctx->hash_method)) ctx->hashtablesize = (compact_hash_size+HASH_BUCKET_SLOTS-1)/HASH_BUCKET_SLOTS;
+      ctx->AA = (ulong)(1.0+(double)(prime-1)*drand48());
+      ctx->BB = (ulong)(0.0+(double)(prime-1)*drand48());
+      if (ctx->AA > prime-1 || ctx->BB > prime-1) exit(0);
+      if (ctx->hash_report_level > 1) printf("Factors AA %lu BB %lu\n",ctx->AA,ctx->BB);
+      if (ctx->hash_method == CUCKOO_HASH) {
+         ctx->AA2 = (ulong)(1.0+(double)(prime-1)*drand48());
+         ctx->BB2 = (ulong)(0.0+(double)(prime-1)*drand48());
+         if (ctx->hash_report_level > 1) printf("Factors AA2 %lu BB2 %lu\n",ctx->AA2,ctx->BB2);
       }
    } else {
-      hashtablesize = perfect_hash_size;
+      ctx->hashtablesize = perfect_hash_size;
+   }
 
-      hash = (int *)genvector(hashtablesize,sizeof(int));
-      for (uint ii = 0; ii<hashtablesize; ii++){
-         hash[ii] = -1;
+   if (ctx->hash_report_level >= 2) {
+      printf("Hash table size %u perfect hash table size %lu memory savings %lu by percentage %lf\n",
+        ctx->hashtablesize,perfect_hash_size,perfect_hash_size-ctx->hashtablesize,
+        (double)ctx->hashtablesize/(double)perfect_hash_size);
+   }
+
+   return(do_compact_hash);
+}
+
+// Tables are kept in a small pool across neighbor calculations so that each
+// rezone does not pay for a fresh allocation, and are only reallocated when
+// the mesh outgrows them. Perfect hash slots carry the epoch of the build
+// that wrote them, so a reused perfect table needs no reset at all. The
+// compact tables are still cleared, but that is proportional to ncells.
+#define HASH_POOL_SIZE 4
+
+typedef struct {
+   hash_slot_t *table;
+   size_t       nslots;
+   int          epoch_clean;      //  every epoch field in the table is <= epoch
+   hash_slot_t  epoch;            //  last epoch handed out on this table
+} hash_pool_entry;
+
+static hash_pool_entry hash_pool[HASH_POOL_SIZE];
+
+// Tables are aligned so that each bucket of the bucket layouts starts on a cache line
+static hash_slot_t *compact_hash_table_alloc(size_t nslots){
+   void *table = NULL;
+   if (posix_memalign(&table, HASH_BUCKET_ALIGN, nslots*sizeof(hash_slot_t)) != 0) {
+      printf("Error -- could not allocate hash table of %lu slots\n",(ulong)nslots);
+      exit(1);
+   }
+   return((hash_slot_t *)table);
+}
+
+// Takes the smallest pooled table that holds nslots, or allocates a new one.
+// With grow set the new table has some room for the mesh to grow. Compact
+// tables follow the cell count, and the perfect tables of the local neighbor
+// calculation follow a bounding box that moves at every rezone; only the
+// serial neighbor calculation has a perfect table of fixed size.
+static hash_pool_entry compact_hash_pool_acquire(size_t nslots, int grow){
+   hash_pool_entry entry = { NULL, 0, 0, 0 };
+#ifdef _OPENMP
+#pragma omp critical (compact_hash_pool)
+#endif
+   {
+      int ibest = -1;
+      for (int ip = 0; ip < HASH_POOL_SIZE; ip++){
+         if (hash_pool[ip].table == NULL || hash_pool[ip].nslots < nslots) continue;
+         if (ibest < 0 || hash_pool[ip].nslots < hash_pool[ibest].nslots) ibest = ip;
+      }
+      if (ibest >= 0) {
+         entry = hash_pool[ibest];
+         hash_pool[ibest].table = NULL;
       }
    }
 
-   if (hash_report_level >= 2) {
-      printf("Hash table size %u perfect hash table size %u memory savings %u by percentage %lf\n",
-        hashtablesize,isize*jsize,isize*jsize-hashtablesize,
-        (double)hashtablesize/(double)(isize*jsize));
+   if (entry.table == NULL) {
+      entry.nslots = grow ? nslots+nslots/4 : nslots;
+      entry.table = compact_hash_table_alloc(entry.nslots);
+      entry.epoch_clean = 0;
+      entry.epoch = 0;
    }
+   return(entry);
+}
 
-   return(hash);
+// Hands a table back to the pool, freeing the smallest table if it is full
+static void compact_hash_pool_release(hash_pool_entry entry){
+#ifdef _OPENMP
+#pragma omp critical (compact_hash_pool)
+#endif
+   {
+      int ismall = 0;
+      for (int ip = 0; ip < HASH_POOL_SIZE; ip++){
+         if (hash_pool[ip].table == NULL) {
+            ismall = ip;
+            break;
+         }
+         if (hash_pool[ip].nslots < hash_pool[ismall].nslots) ismall = ip;
+      }
+      if (hash_pool[ismall].table != NULL && hash_pool[ismall].nslots < entry.nslots) {
+         free(hash_pool[ismall].table);
+         hash_pool[ismall] = entry;
+      } else if (hash_pool[ismall].table == NULL) {
+         hash_pool[ismall] = entry;
+      } else {
+         free(entry.table);
+      }
+   }
+}
+
+void compact_hash_pool_free(void){
+   for (int ip = 0; ip < HASH_POOL_SIZE; ip++){
+      free(hash_pool[ip].table);
+      hash_pool[ip].table = NULL;
+   }
+}
+
+// Gets a table for the method chosen in compact_hash_setup and readies it
+// for writes. With threaded set, the clearing is spread over the OpenMP
+// threads so that first touch places the pages near the threads that will
+// later probe them.
+static void compact_hash_table_setup(hash_context *ctx, int do_compact_hash, int threaded){
+#ifndef _OPENMP
+   (void)threaded;
+#endif
+   if (ctx->hash_method == PAGED_HASH) {
+      // pages are filled in by the threads that first write into them
+      ctx->hash = NULL;
+      ctx->hash_pages = (int **)calloc(ctx->hash_npages, sizeof(int *));
+      return;
+   }
+
+   size_t nslots = HASH_BUCKET_LAYOUT(ctx->hash_method) ? (size_t)ctx->hashtablesize*HASH_BUCKET_SIZE :
+                                                          (size_t)ctx->hashtablesize*2;
+   hash_pool_entry entry = compact_hash_pool_acquire(nslots, do_compact_hash || ctx->hash_grow);
+   ctx->hash = entry.table;
+   ctx->hash_capacity = entry.nslots;
+   hash_slot_t *hash = ctx->hash;
+   size_t hashsize = ctx->hashtablesize;
+
+   if (! do_compact_hash) {
+      ctx->hash_epoch = entry.epoch+1;
+      if (! entry.epoch_clean || ctx->hash_epoch == HASH_EPOCH_MAX) {
+         size_t npairs = entry.nslots/2;
+#ifdef _OPENMP
+#pragma omp parallel for if (threaded)
+#endif
+         for (size_t ii = 0; ii<npairs; ii++){
+            hash[2*ii+1] = 0;
+         }
+         ctx->hash_epoch = 1;
+      }
+   } else if (HASH_BUCKET_LAYOUT(ctx->hash_method)) {
+#ifdef _OPENMP
+#pragma omp parallel for if (threaded)
+#endif
+      for (size_t ii = 0; ii<hashsize; ii++){
+         for (int is = 0; is<HASH_BUCKET_SLOTS; is++){
+            hash[ii*HASH_BUCKET_SIZE+is] = -1;
+         }
+      }
+   } else {
+#ifdef _OPENMP
+#pragma omp parallel for if (threaded)
+#endif
+      for (size_t ii = 0; ii<hashsize; ii++){
+         hash[2*ii] = -1;
+      }
+   }
+}
+
+static void compact_hash_table_release(hash_context *ctx){
+   if (ctx->hash_method == PAGED_HASH) {
+      for (uint ipage = 0; ipage < ctx->hash_npages; ipage++){
+         free(ctx->hash_pages[ipage]);
+      }
+      free(ctx->hash_pages);
+      ctx->hash_pages = NULL;
+      return;
+   }
+
+   hash_pool_entry entry;
+   entry.table = ctx->hash;
+   entry.nslots = ctx->hash_capacity;
+   entry.epoch_clean = (ctx->hash_method == PERFECT_HASH);
+   entry.epoch = (ctx->hash_method == PERFECT_HASH) ? ctx->hash_epoch : 0;
+   compact_hash_pool_release(entry);
+   ctx->hash = NULL;
+}
+
+static void compact_hash_init_core(hash_context *ctx, int ncells, uint isize, uint jsize, uint report_level, hash_selector *selector, int grow){
+   ctx->hash_select = (selector != NULL) ? selector : &default_hash_selector;
+   ctx->hash_grow = grow;
+   int do_compact_hash = compact_hash_setup(ctx, ncells, isize, jsize, report_level);
+   compact_hash_table_setup(ctx, do_compact_hash, 0);
+}
+
+// Same as compact_hash_init, but the table is cleared by all threads
+static void compact_hash_init_openmp_core(hash_context *ctx, int ncells, uint isize, uint jsize, uint report_level, hash_selector *selector, int grow){
+   ctx->hash_select = (selector != NULL) ? selector : &default_hash_selector;
+   ctx->hash_grow = grow;
+   int do_compact_hash = compact_hash_setup(ctx, ncells, isize, jsize, report_level);
+   compact_hash_table_setup(ctx, do_compact_hash, 1);
 }
 
-void write_hash(uint ic, ulong hashkey, int *hash){
+static void write_hash_core(hash_context *ctx, uint ic, ulong hashkey, hash_slot_t *hash){
    int icount = 0;
    uint hashloc;
-   if (hash_method == PERFECT_HASH) {
-      hash[hashkey] = ic;
+   if (ctx->hash_method == PERFECT_HASH) {
+      hash[2*hashkey] = ic;
+      hash[2*hashkey+1] = ctx->hash_epoch;
       return;
    }
-   if (hash_method == LINEAR){
-      if (hash_report_level == 0) {
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc++,hashloc = hashloc%hashtablesize);
-      } else if (hash_report_level == 1) {
-         hash_ncells++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc++,hashloc = hashloc%hashtablesize){
-            write_hash_collisions++;
-         }
-      } else if (hash_report_level == 2) {
-         hash_ncells++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc++,hashloc = hashloc%hashtablesize){
-            write_hash_collisions++;
-         }
-      } else if (hash_report_level == 3) {
-         hash_ncells++;
-         hashloc = (hashkey*AA+BB)%prime%hashtablesize;
-         printf("%d: cell %d hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,ic,hashloc,hash[2*hashloc],hashkey,hashkey%hash_stride,hashkey/hash_stride);
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc++,hashloc = hashloc%hashtablesize){
+   if (ctx->hash_method == PAGED_HASH) {
+      uint collisions = 0;
+      write_hash_probe(PAGED_HASH, ic, hashkey, ctx, &collisions);
+      return;
+   }
+   if (HASH_BUCKET_LAYOUT(ctx->hash_method) || ctx->hash_method == ROBIN_HOOD) {
+      uint collisions = 0;
+      write_hash_probe(ctx->hash_method, ic, hashkey, ctx, &collisions);
+      if (ctx->hash_report_level >= 1) {
+         ctx->hash_ncells++;
+         ctx->write_hash_collisions += collisions;
+         ctx->write_probe_hist[hash_probe_bin(collisions)]++;
+      }
+      return;
+   }
+   if (ctx->hash_method == LINEAR){
+      if (ctx->hash_report_level == 0) {
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc++,hashloc = hashloc%ctx->hashtablesize);
+      } else if (ctx->hash_report_level == 1) {
+         ctx->hash_ncells++;
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc++,hashloc = hashloc%ctx->hashtablesize){
+            icount++;
+         }
+         ctx->write_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 2) {
+         ctx->hash_ncells++;
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc++,hashloc = hashloc%ctx->hashtablesize){
+            icount++;
+         }
+         ctx->write_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 3) {
+         ctx->hash_ncells++;
+         hashloc = compact_hash_start(hashkey, ctx);
+         printf("%d: cell %d hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,ic,hashloc,(long)hash[2*hashloc],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc++,hashloc = hashloc%ctx->hashtablesize){
             int hashloctmp = hashloc+1;
-            hashloctmp = hashloctmp%hashtablesize;
-            printf("%d: cell %d hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,ic,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+            hashloctmp = hashloctmp%ctx->hashtablesize;
+            printf("%d: cell %d hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,ic,hashloctmp,(long)hash[2*hashloctmp],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
             icount++;
          }
-         write_hash_collisions += icount;
+         ctx->write_hash_collisions += icount;
       } else {
-         printf("Error -- Illegal value of hash_report_level %d\n",hash_report_level);
+         printf("Error -- Illegal value of hash_report_level %d\n",ctx->hash_report_level);
          exit(1);
       }
-   } else if (hash_method == QUADRATIC){
-      if (hash_report_level == 0) {
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize) {
+   } else if (ctx->hash_method == QUADRATIC){
+      if (ctx->hash_report_level == 0) {
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc+=(icount*icount),hashloc = hashloc%ctx->hashtablesize) {
             icount++;
          }
-      } else if (hash_report_level == 1) {
-         hash_ncells++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
+      } else if (ctx->hash_report_level == 1) {
+         ctx->hash_ncells++;
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc+=(icount*icount),hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-         write_hash_collisions += icount;
-      } else if (hash_report_level == 2) {
-         hash_ncells++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
+         ctx->write_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 2) {
+         ctx->hash_ncells++;
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc+=(icount*icount),hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-         write_hash_collisions += icount;
-      } else if (hash_report_level == 3) {
-         hash_ncells++;
-         hashloc = (hashkey*AA+BB)%prime%hashtablesize;
-         printf("%d: cell %d hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,ic,hashloc,hash[2*hashloc],hashkey,hashkey%hash_stride,hashkey/hash_stride);
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
+         ctx->write_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 3) {
+         ctx->hash_ncells++;
+         hashloc = compact_hash_start(hashkey, ctx);
+         printf("%d: cell %d hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,ic,hashloc,(long)hash[2*hashloc],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc+=(icount*icount),hashloc = hashloc%ctx->hashtablesize){
             icount++;
             int hashloctmp = hashloc+icount*icount;
-            hashloctmp = hashloctmp%hashtablesize;
-            printf("%d: cell %d hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,ic,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+            hashloctmp = hashloctmp%ctx->hashtablesize;
+            printf("%d: cell %d hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,ic,hashloctmp,(long)hash[2*hashloctmp],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
          }
-         write_hash_collisions += icount;
+         ctx->write_hash_collisions += icount;
       } else {
-         printf("Error -- Illegal value of hash_report_level %d\n",hash_report_level);
+         printf("Error -- Illegal value of hash_report_level %d\n",ctx->hash_report_level);
          exit(1);
       }
-   } else if (hash_method == PRIME_JUMP){
+   } else if (ctx->hash_method == PRIME_JUMP){
       uint jump = 1+hashkey%hash_jump_prime;
-      if (hash_report_level == 0) {
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize) {
+      if (ctx->hash_report_level == 0) {
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc+=(icount*jump),hashloc = hashloc%ctx->hashtablesize) {
             icount++;
          }
-      } else if (hash_report_level == 1) {
-         hash_ncells++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
+      } else if (ctx->hash_report_level == 1) {
+         ctx->hash_ncells++;
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc+=(icount*jump),hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-         write_hash_collisions += icount;
-      } else if (hash_report_level == 2) {
-         hash_ncells++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
+         ctx->write_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 2) {
+         ctx->hash_ncells++;
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc+=(icount*jump),hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-         write_hash_collisions += icount;
-      } else if (hash_report_level == 3) {
-         hash_ncells++;
-         hashloc = (hashkey*AA+BB)%prime%hashtablesize;
-         printf("%d: cell %d hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,ic,hashloc,hash[2*hashloc],hashkey,hashkey%hash_stride,hashkey/hash_stride);
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != -1 && hash[2*hashloc]!= (int)hashkey; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
+         ctx->write_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 3) {
+         ctx->hash_ncells++;
+         hashloc = compact_hash_start(hashkey, ctx);
+         printf("%d: cell %d hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,ic,hashloc,(long)hash[2*hashloc],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != -1 && hash[2*hashloc]!= (hash_slot_t)hashkey; hashloc+=(icount*jump),hashloc = hashloc%ctx->hashtablesize){
             icount++;
             int hashloctmp = hashloc+1;
-            hashloctmp = hashloctmp%hashtablesize;
-            printf("%d: cell %d hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,ic,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+            hashloctmp = hashloctmp%ctx->hashtablesize;
+            printf("%d: cell %d hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,ic,hashloctmp,(long)hash[2*hashloctmp],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
          }
-         write_hash_collisions += icount;
+         ctx->write_hash_collisions += icount;
       } else {
-         printf("Error -- Illegal value of hash_report_level %d\n",hash_report_level);
+         printf("Error -- Illegal value of hash_report_level %d\n",ctx->hash_report_level);
          exit(1);
       }
    } else {
-      printf("Error -- Illegal value of hash_method %d\n",hash_method);
+      printf("Error -- Illegal value of hash_method %d\n",ctx->hash_method);
       exit(1);
    }
 
+   if (ctx->hash_report_level >= 1) ctx->write_probe_hist[hash_probe_bin(icount)]++;
+
    hash[2*hashloc] = hashkey;
    hash[2*hashloc+1] = ic;
 }
 
-int read_hash(ulong hashkey, int *hash){
+// Thread-safe insert for use inside an OpenMP parallel region. Slots in the
+// compact hashes are claimed with an atomic compare-and-swap on the key, so
+// the table layout may differ from the serial build but every key maps to the
+// same value. The perfect hash needs no synchronization since keys are unique.
+static void write_hash_openmp_core(hash_context *ctx, uint ic, ulong hashkey, hash_slot_t *hash){
+   int max_collisions_allowed = 1000;
+   int icount = 0;
+   uint hashloc;
+
+   if (ctx->hash_method == PERFECT_HASH) {
+      hash[2*hashkey] = ic;
+      hash[2*hashkey+1] = ctx->hash_epoch;
+      return;
+   }
+   if (ctx->hash_method == PAGED_HASH) {
+      uint collisions = 0;
+      write_hash_probe_openmp(PAGED_HASH, ic, hashkey, ctx, &collisions);
+      return;
+   }
+   if (HASH_BUCKET_LAYOUT(ctx->hash_method) || ctx->hash_method == ROBIN_HOOD) {
+      uint collisions = 0;
+      write_hash_probe_openmp(ctx->hash_method, ic, hashkey, ctx, &collisions);
+      if (ctx->hash_report_level >= 1) {
+         HASH_COUNTER_ADD(ctx->hash_ncells, 1);
+         HASH_COUNTER_ADD(ctx->write_hash_collisions, collisions);
+         HASH_COUNTER_ADD(ctx->write_probe_hist[hash_probe_bin(collisions)], 1);
+      }
+      return;
+   }
+
+   if (ctx->hash_method != LINEAR && ctx->hash_method != QUADRATIC && ctx->hash_method != PRIME_JUMP) {
+      printf("Error -- Illegal value of hash_method %d\n",ctx->hash_method);
+      exit(1);
+   }
+
+   uint jump = 1+hashkey%hash_jump_prime;
+   hashloc = compact_hash_start(hashkey, ctx);
+   hash_slot_t old_key = __sync_val_compare_and_swap(&hash[2*hashloc], -1, (hash_slot_t)hashkey);
+
+   while (old_key != -1 && old_key != (hash_slot_t)hashkey) {
+      icount++;
+      if (icount > max_collisions_allowed) {
+         printf("Error -- too many write hash collisions\n");
+         exit(0);
+      }
+      if (ctx->hash_method == LINEAR) {
+         hashloc++;
+      } else if (ctx->hash_method == QUADRATIC) {
+         hashloc+=(icount*icount);
+      } else {
+         hashloc+=(icount*jump);
+      }
+      hashloc = hashloc%ctx->hashtablesize;
+      old_key = __sync_val_compare_and_swap(&hash[2*hashloc], -1, (hash_slot_t)hashkey);
+   }
+
+   hash[2*hashloc+1] = ic;
+
+   if (ctx->hash_report_level >= 1) {
+      HASH_COUNTER_ADD(ctx->hash_ncells, 1);
+      HASH_COUNTER_ADD(ctx->write_hash_collisions, icount);
+      HASH_COUNTER_ADD(ctx->write_probe_hist[hash_probe_bin(icount)], 1);
+   }
+}
+
+static int read_hash_core(hash_context *ctx, ulong hashkey, hash_slot_t *hash){
    int max_collisions_allowed = 1000;
    int hashval = -1;
    uint hashloc;
    int icount=0;
-   if (hash_method == PERFECT_HASH) {
-      return(hash[hashkey]);
+   if (ctx->hash_method == PERFECT_HASH) {
+      return((hash[2*hashkey+1] == ctx->hash_epoch) ? (int)hash[2*hashkey] : -1);
    }
-   if (hash_method == LINEAR) {
-      if (hash_report_level == 0) {
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%hashtablesize){
+   if (ctx->hash_method == PAGED_HASH) {
+      uint collisions = 0;
+      return(read_hash_probe(PAGED_HASH, hashkey, ctx, &collisions));
+   }
+   if (HASH_BUCKET_LAYOUT(ctx->hash_method) || ctx->hash_method == ROBIN_HOOD) {
+      uint collisions = 0;
+      hashval = read_hash_probe(ctx->hash_method, hashkey, ctx, &collisions);
+      if (ctx->hash_report_level >= 1) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, collisions);
+         HASH_COUNTER_ADD(ctx->read_probe_hist[hash_probe_bin(collisions)], 1);
+      }
+      return(hashval);
+   }
+   if (ctx->hash_method == LINEAR) {
+      if (ctx->hash_report_level == 0) {
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-      } else if (hash_report_level == 1) {
-         hash_queries++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%hashtablesize){
+      } else if (ctx->hash_report_level == 1) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 2) {
-         hash_queries++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%hashtablesize){
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, icount);
+      } else if (ctx->hash_report_level == 2) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%ctx->hashtablesize){
             icount++;
             if (icount > max_collisions_allowed) {
                printf("Error -- too many read hash collisions\n");
                exit(0);
             }
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 3) {
-         hash_queries++;
-         hashloc = (hashkey*AA+BB)%prime%hashtablesize;
-         printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloc,hash[2*hashloc],hashkey,hashkey%hash_stride,hashkey/hash_stride);
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%hashtablesize){
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, icount);
+      } else if (ctx->hash_report_level == 3) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         hashloc = compact_hash_start(hashkey, ctx);
+         printf("%d: hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,hashloc,(long)hash[2*hashloc],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%ctx->hashtablesize){
             icount++;
             uint hashloctmp = hashloc+1;
-            hashloctmp = hashloctmp%hashtablesize;
-            printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+            hashloctmp = hashloctmp%ctx->hashtablesize;
+            printf("%d: hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,(long)hash[2*hashloctmp],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
             if (icount > max_collisions_allowed) {
                printf("Error -- too many read hash collisions\n");
                exit(0);
             }
          }
-         read_hash_collisions += icount;
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, icount);
       } else {
-         printf("Error -- Illegal value of hash_report_level %d\n",hash_report_level);
+         printf("Error -- Illegal value of hash_report_level %d\n",ctx->hash_report_level);
          exit(1);
       }
-   } else if (hash_method == QUADRATIC) {
-      if (hash_report_level == 0) {
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
+   } else if (ctx->hash_method == QUADRATIC) {
+      if (ctx->hash_report_level == 0) {
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-      } else if (hash_report_level == 1) {
-         hash_queries++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
+      } else if (ctx->hash_report_level == 1) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 2) {
-         hash_queries++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, icount);
+      } else if (ctx->hash_report_level == 2) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%ctx->hashtablesize){
             icount++;
             if (icount > max_collisions_allowed) {
                printf("Error -- too many read hash collisions\n");
                exit(0);
             }
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 3) {
-         hash_queries++;
-         hashloc = (hashkey*AA+BB)%prime%hashtablesize;
-         printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloc,hash[2*hashloc],hashkey,hashkey%hash_stride,hashkey/hash_stride);
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, icount);
+      } else if (ctx->hash_report_level == 3) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         hashloc = compact_hash_start(hashkey, ctx);
+         printf("%d: hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,hashloc,(long)hash[2*hashloc],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%ctx->hashtablesize){
             icount++;
             uint hashloctmp = hashloc+1;
-            hashloctmp = hashloctmp%hashtablesize;
-            printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+            hashloctmp = hashloctmp%ctx->hashtablesize;
+            printf("%d: hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,(long)hash[2*hashloctmp],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
             if (icount > max_collisions_allowed) {
                printf("Error -- too many read hash collisions\n");
                exit(0);
             }
          }
-         read_hash_collisions += icount;
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, icount);
       } else {
-         printf("Error -- Illegal value of hash_report_level %d\n",hash_report_level);
+         printf("Error -- Illegal value of hash_report_level %d\n",ctx->hash_report_level);
          exit(1);
       }
-   } else if (hash_method == PRIME_JUMP) {
+   } else if (ctx->hash_method == PRIME_JUMP) {
       uint jump = 1+hashkey%hash_jump_prime;
-      if (hash_report_level == 0) {
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
+      if (ctx->hash_report_level == 0) {
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-      } else if (hash_report_level == 1) {
-         hash_queries++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
+      } else if (ctx->hash_report_level == 1) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%ctx->hashtablesize){
             icount++;
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 2) {
-         hash_queries++;
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, icount);
+      } else if (ctx->hash_report_level == 2) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%ctx->hashtablesize){
             icount++;
             if (icount > max_collisions_allowed) {
                printf("Error -- too many read hash collisions\n");
                exit(0);
             }
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 3) {
-         hash_queries++;
-         hashloc = (hashkey*AA+BB)%prime%hashtablesize;
-         printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloc,hash[2*hashloc],hashkey,hashkey%hash_stride,hashkey/hash_stride);
-         for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, icount);
+      } else if (ctx->hash_report_level == 3) {
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         hashloc = compact_hash_start(hashkey, ctx);
+         printf("%d: hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,hashloc,(long)hash[2*hashloc],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
+         for (hashloc = compact_hash_start(hashkey, ctx); hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%ctx->hashtablesize){
             icount++;
             uint hashloctmp = hashloc+1;
-            hashloctmp = hashloctmp%hashtablesize;
-            printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+            hashloctmp = hashloctmp%ctx->hashtablesize;
+            printf("%d: hashloc is %d hash[2*hashloc] = %ld hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,(long)hash[2*hashloctmp],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
             if (icount > max_collisions_allowed) {
                printf("Error -- too many read hash collisions\n");
                exit(0);
             }
          }
-         read_hash_collisions += icount;
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, icount);
       } else {
-         printf("Error -- Illegal value of hash_report_level %d\n",hash_report_level);
+         printf("Error -- Illegal value of hash_report_level %d\n",ctx->hash_report_level);
          exit(1);
       }
    } else {
-      printf("Error -- Illegal value of hash_method %d\n",hash_method);
+      printf("Error -- Illegal value of hash_method %d\n",ctx->hash_method);
       exit(1);
    }
 
+   if (ctx->hash_report_level >= 1) HASH_COUNTER_ADD(ctx->read_probe_hist[hash_probe_bin(icount)], 1);
+
    if (hash[2*hashloc] != -1) hashval = hash[2*hashloc+1];
    return(hashval);
 }
 
-void compact_hash_delete(int *hash){
-      genvectorfree((void *)hash);
+
+hash_selector *hash_selector_init(void){
+   hash_selector *sel = (hash_selector *)calloc(1, sizeof(hash_selector));
+   sel->current = METHOD_UNSET;
+   return(sel);
+}
+
+void hash_selector_delete(hash_selector *sel){
+   free(sel);
+}
+
+hash_context *compact_hash_context_init(int ncells, uint isize, uint jsize, uint report_level, hash_selector *selector, int grow){
+   hash_context *ctx = (hash_context *)malloc(sizeof(hash_context));
+   compact_hash_init_core(ctx, ncells, isize, jsize, report_level, selector, grow);
+   return(ctx);
+}
+
+hash_context *compact_hash_context_init_openmp(int ncells, uint isize, uint jsize, uint report_level, hash_selector *selector, int grow){
+   hash_context *ctx = (hash_context *)malloc(sizeof(hash_context));
+   compact_hash_init_openmp_core(ctx, ncells, isize, jsize, report_level, selector, grow);
+   return(ctx);
+}
+
+void write_hash_context(uint ic, ulong hashkey, hash_context *ctx){
+   write_hash_core(ctx, ic, hashkey, ctx->hash);
+}
+
+void write_hash_context_openmp(uint ic, ulong hashkey, hash_context *ctx){
+   write_hash_openmp_core(ctx, ic, hashkey, ctx->hash);
+}
+
+int read_hash_context(ulong hashkey, hash_context *ctx){
+   return(read_hash_core(ctx, hashkey, ctx->hash));
+}
+
+// Looks up nkeys keys in batches, leaving alone any value that is already set
+void read_hash_context_batch(int nkeys, const ulong *hashkeys, int *hashvals, hash_context *ctx){
+   for (int kstart = 0; kstart < nkeys; kstart += HASH_BATCH_MAX){
+      int nbatch = MIN(HASH_BATCH_MAX, nkeys-kstart);
+      uint collisions[HASH_BATCH_MAX];
+      uint queried = read_hash_probe_batch(ctx->hash_method, nbatch, &hashkeys[kstart], &hashvals[kstart], ctx, collisions);
+      if (ctx->hash_report_level == 0 || ctx->hash_method == PERFECT_HASH || ctx->hash_method == PAGED_HASH) continue;
+      for (int k = 0; k < nbatch; k++){
+         if (! (queried & (1u << k))) continue;
+         HASH_COUNTER_ADD(ctx->hash_queries, 1);
+         HASH_COUNTER_ADD(ctx->read_hash_collisions, collisions[k]);
+         HASH_COUNTER_ADD(ctx->read_probe_hist[hash_probe_bin(collisions[k])], 1);
+      }
+   }
+}
+
+// The clock runs from setup so that clearing the table is counted. Callers
+// stop it around work that is not the build or the queries, such as
+// communication, and restart it before they touch the table again.
+void compact_hash_context_timer_start(hash_context *ctx){
+   if (! ctx->hash_adaptive || ctx->hash_start_time != 0.0) return;
+   ctx->hash_start_time = hash_wall_time();
+}
+
+void compact_hash_context_timer_stop(hash_context *ctx){
+   if (! ctx->hash_adaptive || ctx->hash_start_time == 0.0) return;
+   ctx->hash_time += hash_wall_time() - ctx->hash_start_time;
+   ctx->hash_start_time = 0.0;
+}
+
+void compact_hash_context_delete(hash_context *ctx){
+   compact_hash_context_timer_stop(ctx);
+   if (ctx->hash_adaptive) {
+#ifdef _OPENMP
+#pragma omp critical (hash_selector)
+#endif
+      hash_adapt_record(ctx);
+   }
+   compact_hash_table_release(ctx);
+   free(ctx);
+}
+
+// Rebuilds a cuckoo table with new hash functions after an insert ran out of
+// moves. The key left over from the failed insert goes back in with the rest.
+void compact_hash_cuckoo_rehash(hash_context *ctx, hash_slot_t hashkey, int hashval){
+   uint nslots = ctx->hashtablesize*HASH_BUCKET_SLOTS;
+   hash_slot_t *keys = (hash_slot_t *)malloc((nslots+1)*sizeof(hash_slot_t));
+   int *values = (int *)malloc((nslots+1)*sizeof(int));
+
+   uint nkeys = 0;
+   for (uint ib = 0; ib < ctx->hashtablesize; ib++){
+      hash_slot_t *bucket = &ctx->hash[(ulong)ib*HASH_BUCKET_SIZE];
+      for (int is = 0; is < HASH_BUCKET_SLOTS; is++){
+         if (bucket[is] == -1) continue;
+         keys[nkeys] = bucket[is];
+         values[nkeys] = (int)bucket[HASH_BUCKET_SLOTS+is];
+         nkeys++;
+         bucket[is] = -1;
+      }
+   }
+   keys[nkeys] = hashkey;
+   values[nkeys] = hashval;
+   nkeys++;
+
+   ctx->hash_rehashes++;
+   ctx->AA  = (ulong)(1.0+(double)(prime-1)*drand48());
+   ctx->BB  = (ulong)(0.0+(double)(prime-1)*drand48());
+   ctx->AA2 = (ulong)(1.0+(double)(prime-1)*drand48());
+   ctx->BB2 = (ulong)(0.0+(double)(prime-1)*drand48());
+
+   uint collisions = 0;
+   for (uint ik = 0; ik < nkeys; ik++){
+      hash_cuckoo_insert(ctx, keys[ik], values[ik], &collisions);
+   }
+
+   free(keys);
+   free(values);
+}
+
+// Allocates a page of the paged perfect hash on its first write. Threads
+// racing to create the same page publish it with a compare-and-swap on the
+// directory entry and the losers free their copy.
+int *compact_hash_page_alloc(hash_context *ctx, ulong ipage){
+   int *page = (int *)malloc(HASH_PAGE_SIZE*sizeof(int));
+   for (int ii = 0; ii < HASH_PAGE_SIZE; ii++){
+      page[ii] = -1;
+   }
+
+   int *old_page = __sync_val_compare_and_swap(&ctx->hash_pages[ipage], NULL, page);
+   if (old_page != NULL) {
+      free(page);
+      return(old_page);
+   }
+
+   __sync_fetch_and_add(&ctx->hash_pages_allocated, 1);
+   return(page);
+}
+
+// Original single-table interface -- these operate on a file-level context
+// and so only one table built through them can be live at a time
+
+hash_slot_t *compact_hash_init(int ncells, uint isize, uint jsize, uint report_level){
+   compact_hash_init_core(&default_hash_context, ncells, isize, jsize, report_level, NULL, 0);
+   return(default_hash_context.hash);
+}
+
+hash_slot_t *compact_hash_init_openmp(int ncells, uint isize, uint jsize, uint report_level){
+   compact_hash_init_openmp_core(&default_hash_context, ncells, isize, jsize, report_level, NULL, 0);
+   return(default_hash_context.hash);
+}
+
+void write_hash(uint ic, ulong hashkey, hash_slot_t *hash){
+   write_hash_core(&default_hash_context, ic, hashkey, hash);
+}
+
+void write_hash_openmp(uint ic, ulong hashkey, hash_slot_t *hash){
+   write_hash_openmp_core(&default_hash_context, ic, hashkey, hash);
+}
+
+int read_hash(ulong hashkey, hash_slot_t *hash){
+   return(read_hash_core(&default_hash_context, hashkey, hash));
+}
+
+void compact_hash_delete(hash_slot_t *hash){
+   (void)hash;
+   compact_hash_context_timer_stop(&default_hash_context);
+   if (default_hash_context.hash_adaptive) {
+#ifdef _OPENMP
+#pragma omp critical (hash_selector)
+#endif
+      hash_adapt_record(&default_hash_context);
+   }
+   compact_hash_table_release(&default_hash_context);
 }
 
 void write_hash_collision_report(void){
-   if (hash_method == PERFECT_HASH) return;
-   if (hash_report_level == 1) {
-      write_hash_collisions_runsum += (double)write_hash_collisions/(double)hash_ncells;
+   write_hash_context_collision_report(&default_hash_context);
+}
+
+void read_hash_collision_report(void){
+   read_hash_context_collision_report(&default_hash_context);
+}
+
+static void print_probe_hist(const char *label, const uint *probe_hist){
+   printf("%s probe lengths --",label);
+   for (int ib = 0; ib < HASH_PROBE_BINS-1; ib++){
+      printf(" %d: %u",ib,probe_hist[ib]);
+   }
+   printf(" %d+: %u\n",HASH_PROBE_BINS-1,probe_hist[HASH_PROBE_BINS-1]);
+}
+
+// The run summaries are process-wide, so the reports should be called from
+// serial code once the table is finished
+void write_hash_context_collision_report(hash_context *ctx){
+   if (ctx->hash_method == PAGED_HASH) {
+      ctx->hashtablesize = ctx->hash_pages_allocated*HASH_PAGE_SIZE;
+      if (ctx->hash_report_level >= 2) {
+         printf("Paged hash report -- pages allocated %u of %u, page size %d\n",ctx->hash_pages_allocated,ctx->hash_npages,HASH_PAGE_SIZE);
+      }
+   }
+   final_hashtablesize = ctx->hashtablesize;
+   if (HASH_BUCKET_LAYOUT(ctx->hash_method)) final_hashtablesize = ctx->hashtablesize*HASH_BUCKET_SLOTS;
+   if (ctx->hash_method == PERFECT_HASH || ctx->hash_method == PAGED_HASH) return;
+   if (ctx->hash_report_level == 1) {
+      write_hash_collisions_runsum += (double)ctx->write_hash_collisions/(double)ctx->hash_ncells;
       write_hash_collisions_count++;
-   } else if (hash_report_level >= 2) {
-      printf("Write hash collision report -- collisions per cell %lf, collisions %d cells %d\n",(double)write_hash_collisions/(double)hash_ncells,write_hash_collisions,hash_ncells);
+      for (int ib = 0; ib < HASH_PROBE_BINS; ib++){
+         write_probe_hist_runsum[ib] += (double)ctx->write_probe_hist[ib]/(double)ctx->hash_ncells;
+      }
+   } else if (ctx->hash_report_level >= 2) {
+      printf("Write hash collision report -- collisions per cell %lf, collisions %d cells %d\n",(double)ctx->write_hash_collisions/(double)ctx->hash_ncells,ctx->write_hash_collisions,ctx->hash_ncells);
+      print_probe_hist("Write hash", ctx->write_probe_hist);
+      if (ctx->hash_method == ROBIN_HOOD) printf("Robin Hood hash report -- longest probe %u\n",ctx->hash_max_probe);
+      if (ctx->hash_method == CUCKOO_HASH) printf("Cuckoo hash report -- rehashes %u\n",ctx->hash_rehashes);
    }
 }
 
-void read_hash_collision_report(void){
-   //printf("hash table size  bytes %ld\n",hashtablesize*sizeof(int));
-   if (hash_method == PERFECT_HASH) return;
-   if (hash_report_level == 1) {
-      read_hash_collisions_runsum += (double)read_hash_collisions/(double)hash_queries;
+void read_hash_context_collision_report(hash_context *ctx){
+   //printf("hash table size  bytes %ld\n",ctx->hashtablesize*sizeof(int));
+   final_hashtablesize = ctx->hashtablesize;
+   if (HASH_BUCKET_LAYOUT(ctx->hash_method)) final_hashtablesize = ctx->hashtablesize*HASH_BUCKET_SLOTS;
+   if (ctx->hash_method == PERFECT_HASH || ctx->hash_method == PAGED_HASH) return;
+   if (ctx->hash_report_level == 1) {
+      read_hash_collisions_runsum += (double)ctx->read_hash_collisions/(double)ctx->hash_queries;
       read_hash_collisions_count++;
-   } else if (hash_report_level >= 2) {
-      printf("Read hash collision report -- collisions per cell %lf, collisions %d cells %d\n",(double)read_hash_collisions/(double)hash_queries,read_hash_collisions,hash_queries);
-      hash_queries = 0;
-      read_hash_collisions = 0;
+      for (int ib = 0; ib < HASH_PROBE_BINS; ib++){
+         read_probe_hist_runsum[ib] += (double)ctx->read_probe_hist[ib]/(double)ctx->hash_queries;
+      }
+   } else if (ctx->hash_report_level >= 2) {
+      printf("Read hash collision report -- collisions per cell %lf, collisions %d cells %d\n",(double)ctx->read_hash_collisions/(double)ctx->hash_queries,ctx->read_hash_collisions,ctx->hash_queries);
+      print_probe_hist("Read hash", ctx->read_probe_hist);
+      ctx->hash_queries = 0;
+      ctx->read_hash_collisions = 0;
+      for (int ib = 0; ib < HASH_PROBE_BINS; ib++){
+         ctx->read_probe_hist[ib] = 0;
+      }
    }
 }
 
 void final_hash_collision_report(void){
-   printf("hash table size  bytes %ld\n",hashtablesize*sizeof(int));
-   if (hash_report_level >= 1 && read_hash_collisions_count > 0) { 
+   printf("hash table size  bytes %ld\n",final_hashtablesize*sizeof(hash_slot_t));
+   if (read_hash_collisions_count > 0) { 
       printf("Final hash collision report -- write/read collisions per cell %lf/%lf\n",write_hash_collisions_runsum/(double)write_hash_collisions_count,read_hash_collisions_runsum/(double)read_hash_collisions_count);
+      printf("Final hash probe lengths -- fraction of write/read probes\n");
+      for (int ib = 0; ib < HASH_PROBE_BINS; ib++){
+         printf("   %d%s %lf/%lf\n",ib,(ib == HASH_PROBE_BINS-1) ? "+:" : ": ",
+            write_probe_hist_runsum[ib]/(double)write_hash_collisions_count,read_probe_hist_runsum[ib]/(double)read_hash_collisions_count);
+      }
+   }
+   // Callers that own a selector report it themselves
+   if (default_hash_selector.current != METHOD_UNSET) hash_selector_report(&default_hash_selector);
+}
+
+void hash_selector_report(const hash_selector *sel){
+   if (choose_hash_method != ADAPTIVE_HASH) return;
+   printf("Final adaptive hash report -- method switches %u, builds and cost per cell (ns)\n",sel->switches);
+   for (int im = 0; im < HASH_ADAPT_NMETHODS; im++){
+      printf("   %-10s %6u %10.2lf collisions per cell %lf\n",hash_method_name[hash_adapt_method[im]],
+         sel->stats[im].builds,sel->stats[im].cost*1.0e9,sel->stats[im].collisions);
    }
 }
 
@@ -402,7 +1052,10 @@ void hash_lib_terminate(void){
 cl_mem gpu_compact_hash_init(ulong ncells, int imaxsize, int jmaxsize, int gpu_hash_method, uint hash_report_level_in,
    ulong *gpu_hash_table_size, ulong *hashsize, cl_mem *dev_hash_header_in)
 {
-   hash_report_level = hash_report_level_in;
+   default_hash_context.hash_report_level = hash_report_level_in;
+
+   // the GPU kernels only have the original methods, so let the memory heuristic choose
+   if (gpu_hash_method > PRIME_JUMP) gpu_hash_method = METHOD_UNSET;
 
    uint gpu_compact_hash_size = (uint)((double)ncells*hash_mult);
    uint gpu_perfect_hash_size = (uint)(imaxsize*jmaxsize);
@@ -429,7 +1082,8 @@ cl_mem gpu_compact_hash_init(ulong ncells, int imaxsize, int jmaxsize, int gpu_h
       (*hashsize) = gpu_perfect_hash_size;
    }
 
-   hashtablesize = (*hashsize);
+   default_hash_context.hashtablesize = (*hashsize);
+   final_hashtablesize = (*hashsize);
 
    const uint TILE_SIZE = 128;
 
@@ -469,6 +1123,7 @@ cl_mem gpu_get_hash_header(void){
 #endif
 
 int read_dev_hash(int hash_method, ulong hashtablesize, ulong AA, ulong BB, ulong hashkey, int *hash){
+   hash_context *ctx = &default_hash_context;
    //int hash_report_level = 3;
    int max_collisions_allowed = 1000;
    int hashval = -1;
@@ -478,18 +1133,18 @@ int read_dev_hash(int hash_method, ulong hashtablesize, ulong AA, ulong BB, ulon
       return(hash[hashkey]);
    }
    if (hash_method == LINEAR) {
-      if (hash_report_level == 0) {
+      if (ctx->hash_report_level == 0) {
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%hashtablesize){
             icount++;
          }
-      } else if (hash_report_level == 1) {
-         hash_queries++;
+      } else if (ctx->hash_report_level == 1) {
+         ctx->hash_queries++;
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%hashtablesize){
             icount++;
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 2) {
-         hash_queries++;
+         ctx->read_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 2) {
+         ctx->hash_queries++;
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%hashtablesize){
             icount++;
             if (icount > max_collisions_allowed) {
@@ -497,39 +1152,39 @@ int read_dev_hash(int hash_method, ulong hashtablesize, ulong AA, ulong BB, ulon
                exit(0);
             }
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 3) {
-         hash_queries++;
+         ctx->read_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 3) {
+         ctx->hash_queries++;
          hashloc = (hashkey*AA+BB)%prime%hashtablesize;
-         printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloc,hash[2*hashloc],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+         printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloc,hash[2*hashloc],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc++,hashloc = hashloc%hashtablesize){
             icount++;
             uint hashloctmp = hashloc+1;
             hashloctmp = hashloctmp%hashtablesize;
-            printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+            printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
             if (icount > max_collisions_allowed) {
                printf("Error -- too many read hash collisions\n");
                exit(0);
             }
          }
-         read_hash_collisions += icount;
+         ctx->read_hash_collisions += icount;
       } else {
-         printf("Error -- Illegal value of hash_report_level %d\n",hash_report_level);
+         printf("Error -- Illegal value of hash_report_level %d\n",ctx->hash_report_level);
          exit(1);
       }
    } else if (hash_method == QUADRATIC) {
-      if (hash_report_level == 0) {
+      if (ctx->hash_report_level == 0) {
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
             icount++;
          }
-      } else if (hash_report_level == 1) {
-         hash_queries++;
+      } else if (ctx->hash_report_level == 1) {
+         ctx->hash_queries++;
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
             icount++;
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 2) {
-         hash_queries++;
+         ctx->read_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 2) {
+         ctx->hash_queries++;
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
             icount++;
             if (icount > max_collisions_allowed) {
@@ -537,40 +1192,40 @@ int read_dev_hash(int hash_method, ulong hashtablesize, ulong AA, ulong BB, ulon
                exit(0);
             }
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 3) {
-         hash_queries++;
+         ctx->read_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 3) {
+         ctx->hash_queries++;
          hashloc = (hashkey*AA+BB)%prime%hashtablesize;
-         printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloc,hash[2*hashloc],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+         printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloc,hash[2*hashloc],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*icount),hashloc = hashloc%hashtablesize){
             icount++;
             uint hashloctmp = hashloc+1;
             hashloctmp = hashloctmp%hashtablesize;
-            printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+            printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
             if (icount > max_collisions_allowed) {
                printf("Error -- too many read hash collisions\n");
                exit(0);
             }
          }
-         read_hash_collisions += icount;
+         ctx->read_hash_collisions += icount;
       } else {
-         printf("Error -- Illegal value of hash_report_level %d\n",hash_report_level);
+         printf("Error -- Illegal value of hash_report_level %d\n",ctx->hash_report_level);
          exit(1);
       }
    } else if (hash_method == PRIME_JUMP) {
       uint jump = 1+hashkey%hash_jump_prime;
-      if (hash_report_level == 0) {
+      if (ctx->hash_report_level == 0) {
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
             icount++;
          }
-      } else if (hash_report_level == 1) {
-         hash_queries++;
+      } else if (ctx->hash_report_level == 1) {
+         ctx->hash_queries++;
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
             icount++;
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 2) {
-         hash_queries++;
+         ctx->read_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 2) {
+         ctx->hash_queries++;
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
             icount++;
             if (icount > max_collisions_allowed) {
@@ -578,24 +1233,24 @@ int read_dev_hash(int hash_method, ulong hashtablesize, ulong AA, ulong BB, ulon
                exit(0);
             }
          }
-         read_hash_collisions += icount;
-      } else if (hash_report_level == 3) {
-         hash_queries++;
+         ctx->read_hash_collisions += icount;
+      } else if (ctx->hash_report_level == 3) {
+         ctx->hash_queries++;
          hashloc = (hashkey*AA+BB)%prime%hashtablesize;
-         printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloc,hash[2*hashloc],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+         printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloc,hash[2*hashloc],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
          for (hashloc = (hashkey*AA+BB)%prime%hashtablesize; hash[2*hashloc] != (int)hashkey && hash[2*hashloc] != -1; hashloc+=(icount*jump),hashloc = hashloc%hashtablesize){
             icount++;
             uint hashloctmp = hashloc+1;
             hashloctmp = hashloctmp%hashtablesize;
-            printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%hash_stride,hashkey/hash_stride);
+            printf("%d: hashloc is %d hash[2*hashloc] = %d hashkey %lu ii %lu jj %lu\n",icount,hashloctmp,hash[2*hashloctmp],hashkey,hashkey%ctx->hash_stride,hashkey/ctx->hash_stride);
             if (icount > max_collisions_allowed) {
                printf("Error -- too many read hash collisions\n");
                exit(0);
             }
          }
-         read_hash_collisions += icount;
+         ctx->read_hash_collisions += icount;
       } else {
-         printf("Error -- Illegal value of hash_report_level %d\n",hash_report_level);
+         printf("Error -- Illegal value of hash_report_level %d\n",ctx->hash_report_level);
          exit(1);
       }
    } else {
@@ -1,6 +1,11 @@
 #ifndef _HASH_H
 #define _HASH_H
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
 #include "ezcl/ezcl.h"
 
 enum choose_hash_method
@@ -8,20 +13,159 @@ enum choose_hash_method
    PERFECT_HASH,                //  perfect hash 1
    LINEAR,                      //  linear hash 2
    QUADRATIC,                   //  quadratic hash 3
-   PRIME_JUMP  };               //  prime_jump hash 4
+   PRIME_JUMP,                  //  prime_jump hash 4
+   PAGED_HASH,                  //  paged perfect hash 5
+   BUCKET_HASH,                 //  cache-line bucket hash 6
+   ROBIN_HOOD,                  //  robin hood hash 7
+   CUCKOO_HASH,                 //  bucketized cuckoo hash 8
+   ADAPTIVE_HASH  };            //  pick a method from measured build costs 9
 
 typedef unsigned int uint;
 typedef unsigned long ulong;
 
+#define HASH_PRIME      4294967291UL  //  prime for the compact hash function
+#define HASH_JUMP_PRIME 41            //  prime for the prime jump probe stride
+
+// The paged perfect hash splits the key space into square tiles of
+// HASH_PAGE_DIM x HASH_PAGE_DIM finest-level positions. A page directory
+// covers the whole domain and a tile is only allocated when a cell is written
+// into it, so memory follows the refined area rather than the bounding box.
+#define HASH_PAGE_BITS  4
+#define HASH_PAGE_DIM   (1 << HASH_PAGE_BITS)
+#define HASH_PAGE_MASK  (HASH_PAGE_DIM-1)
+#define HASH_PAGE_SIZE  (HASH_PAGE_DIM*HASH_PAGE_DIM)
+
+// Compact hash slots hold the key next to the cell index. Keys are the
+// finest-level i,j position flattened into a single index, so meshes with
+// 2^32 or more finest-level positions need the 64-bit layout -- configure
+// with -DHASH_KEY64=on.
+//
+// The bucket hash stores HASH_BUCKET_SLOTS keys followed by their values in
+// each bucket. The slot count follows the slot width so that a bucket is one
+// 64-byte cache line in either layout and a lookup usually touches only that
+// line. Full buckets overflow into the next one.
+#ifdef HAVE_HASH_KEY64
+typedef int64_t hash_slot_t;
+#define HASH_EPOCH_MAX     INT64_MAX
+#define HASH_BUCKET_SLOTS  4
+#else
+typedef int     hash_slot_t;
+#define HASH_EPOCH_MAX     0x7fffffff
+#define HASH_BUCKET_SLOTS  8
+#endif
+#define HASH_BUCKET_SIZE   (2*HASH_BUCKET_SLOTS)
+#define HASH_BUCKET_ALIGN  64
+#define HASH_BUCKET_LAYOUT(method) ((method) == BUCKET_HASH || (method) == CUCKOO_HASH)
+
+// Robin Hood and cuckoo tables keep their probe lengths bounded, so they
+// run at a much higher load than the other compact methods. Cuckoo tables
+// use the bucket layout with two candidate buckets per key.
+#define HASH_MULT_DENSE         1.25
+#define HASH_CUCKOO_MAX_KICKS   500
+
+// Probe lengths are binned 0, 1, ... HASH_PROBE_BINS-2, and the last bin
+// holds everything longer
+#define HASH_PROBE_BINS    8
+
+// Most keys looked up together by read_hash_probe_batch, enough for the four
+// faces of a cell
+#define HASH_BATCH_MAX     4
+
+// The adaptive method times the build and the queries of each table and keeps
+// a running cost per cell for every candidate. A candidate is timed again when
+// its last measurement is HASH_ADAPT_MAX_AGE builds old or the mesh fill has
+// moved by more than HASH_ADAPT_FILL_RATIO since it was taken. The method in
+// use is kept unless another is cheaper by HASH_ADAPT_MARGIN, so timing noise
+// does not flip it back and forth.
+#define HASH_ADAPT_MAX_AGE      50
+#define HASH_ADAPT_FILL_RATIO   2.0
+#define HASH_ADAPT_MARGIN       0.9
+#define HASH_ADAPT_NMETHODS     4
+
+typedef struct {
+   double cost;         //  running wall time per cell for build and queries
+   double collisions;   //  running collisions per cell
+   double fill;         //  mesh fill when last timed
+   uint   age;          //  builds since last timed
+   uint   builds;       //  builds with this method
+} hash_adapt_stats;
+
+// Adaptive method measurements for one mesh. The caller owns it and passes
+// it to every context it sets up for that mesh, so meshes of different sizes
+// do not mix their timings. Contexts set up with a NULL selector share one
+// kept by the library.
+typedef struct hash_selector {
+   hash_adapt_stats stats[HASH_ADAPT_NMETHODS];  //  one entry per candidate method
+   int    current;                 //  method picked for the last build
+   uint   switches;                //  times the pick changed
+} hash_selector;
+
+// State for one compact hash table. Each neighbor calculation owns its own
+// context so that several tables can be built and queried concurrently.
+typedef struct hash_context {
+   hash_slot_t *hash;              //  table storage, key/value pairs for compact methods
+                                   //  and value/epoch pairs for the perfect hash
+   size_t       hash_capacity;     //  slots allocated, may exceed what this build uses
+   hash_slot_t  hash_epoch;        //  perfect hash build stamp, older slots read as empty
+   int    hash_method;             //  method chosen for this table
+   ulong  AA;                      //  multiplier for the compact hash function
+   ulong  BB;                      //  offset for the compact hash function
+   ulong  AA2;                     //  multiplier for the second cuckoo hash function
+   ulong  BB2;                     //  offset for the second cuckoo hash function
+   uint   hashtablesize;           //  number of slots in the table
+   uint   hash_stride;             //  row length of the key space, for reporting
+   uint   hash_report_level;       //  0 none, 1 run summary, 2 per build, 3 every probe
+   uint   hash_ncells;             //  cells written
+   uint   write_hash_collisions;   //  collisions during writes
+   uint   read_hash_collisions;    //  collisions during reads
+   uint   hash_queries;            //  reads
+   uint   write_probe_hist[HASH_PROBE_BINS]; //  writes by probe length
+   uint   read_probe_hist[HASH_PROBE_BINS];  //  reads by probe length
+   int  **hash_pages;              //  page directory for the paged perfect hash
+   uint   hash_page_stride;        //  pages per row of the key space
+   uint   hash_npages;             //  pages in the directory
+   uint   hash_pages_allocated;    //  pages written to
+   uint   hash_max_probe;          //  longest Robin Hood probe distance
+   uint   hash_rehashes;           //  cuckoo tables rebuilt after an insert failed
+   int    hash_adaptive;           //  method was picked by the adaptive selection
+   int    hash_build_ncells;       //  cells the table was sized for
+   double hash_fill;               //  cells per slot of a perfect hash for this build
+   double hash_start_time;         //  wall clock when the build timer was started, 0 when stopped
+   double hash_time;               //  build and query time measured so far
+   hash_selector *hash_select;     //  adaptive measurements this table reports to
+   int    hash_grow;               //  key space may grow between builds, so new perfect
+                                   //  tables get the same headroom as compact ones
+} hash_context;
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-int *compact_hash_init(int ncells, uint isize, uint jsize, uint report_level);
-void write_hash(uint ic, ulong hashkey, int *hash);
-int read_hash(ulong hashkey, int *hash);
-void compact_hash_delete(int *hash);
+hash_selector *hash_selector_init(void);
+void hash_selector_delete(hash_selector *sel);
+void hash_selector_report(const hash_selector *sel);
+hash_context *compact_hash_context_init(int ncells, uint isize, uint jsize, uint report_level, hash_selector *selector, int grow);
+hash_context *compact_hash_context_init_openmp(int ncells, uint isize, uint jsize, uint report_level, hash_selector *selector, int grow);
+void write_hash_context(uint ic, ulong hashkey, hash_context *ctx);
+void write_hash_context_openmp(uint ic, ulong hashkey, hash_context *ctx);
+int read_hash_context(ulong hashkey, hash_context *ctx);
+void read_hash_context_batch(int nkeys, const ulong *hashkeys, int *hashvals, hash_context *ctx);
+void compact_hash_context_timer_start(hash_context *ctx);
+void compact_hash_context_timer_stop(hash_context *ctx);
+void compact_hash_context_delete(hash_context *ctx);
+void compact_hash_pool_free(void);
+int *compact_hash_page_alloc(hash_context *ctx, ulong page);
+void compact_hash_cuckoo_rehash(hash_context *ctx, hash_slot_t hashkey, int hashval);
+void write_hash_context_collision_report(hash_context *ctx);
+void read_hash_context_collision_report(hash_context *ctx);
+
+hash_slot_t *compact_hash_init(int ncells, uint isize, uint jsize, uint report_level);
+hash_slot_t *compact_hash_init_openmp(int ncells, uint isize, uint jsize, uint report_level);
+void write_hash(uint ic, ulong hashkey, hash_slot_t *hash);
+void write_hash_openmp(uint ic, ulong hashkey, hash_slot_t *hash);
+int read_hash(ulong hashkey, hash_slot_t *hash);
+void compact_hash_delete(hash_slot_t *hash);
 
 void write_hash_collision_report(void);
 void read_hash_collision_report(void);
@@ -41,6 +185,363 @@ int read_dev_hash(int hash_method, ulong hashtablesize, ulong AA, ulong BB, ulon
 }
 #endif
 
+/****************************************************************************
+ * Probe routines specialized on the hash method
+ *   Calling these with a constant method lets the compiler fold away the
+ *   method branches, so callers select the method once outside their loops.
+ *   There is no report-level branching or tracing here -- the number of
+ *   collisions is added to a caller-owned counter so that it can be
+ *   reduced across threads and then added into the context.
+ ****************************************************************************/
+
+// Starting slot for a key. With 64-bit keys the key is folded below the
+// prime first so that the product cannot wrap
+static inline uint compact_hash_start(ulong hashkey, const hash_context *ctx){
+#ifdef HAVE_HASH_KEY64
+   hashkey %= HASH_PRIME;
+#endif
+   return((hashkey*ctx->AA+ctx->BB)%HASH_PRIME%ctx->hashtablesize);
+}
+
+// Second candidate bucket for the cuckoo hash
+static inline uint compact_hash_start2(ulong hashkey, const hash_context *ctx){
+#ifdef HAVE_HASH_KEY64
+   hashkey %= HASH_PRIME;
+#endif
+   return((hashkey*ctx->AA2+ctx->BB2)%HASH_PRIME%ctx->hashtablesize);
+}
+
+// Directory entry for a key, with the slot within the page in offset
+static inline ulong hash_page_index(ulong hashkey, const hash_context *ctx, uint *offset){
+   ulong jj = hashkey/ctx->hash_stride;
+   ulong ii = hashkey-jj*ctx->hash_stride;
+   *offset = (uint)(((jj&HASH_PAGE_MASK)<<HASH_PAGE_BITS) | (ii&HASH_PAGE_MASK));
+   return((jj>>HASH_PAGE_BITS)*ctx->hash_page_stride+(ii>>HASH_PAGE_BITS));
+}
+
+static inline uint hash_probe_bin(uint collisions){
+   return((collisions < HASH_PROBE_BINS-1) ? collisions : HASH_PROBE_BINS-1);
+}
+
+// Compares the key against every slot in a bucket at once. There is no early
+// exit so that the compiler can turn the loop into a vector compare.
+static inline uint hash_bucket_match(const hash_slot_t *bucket, hash_slot_t key){
+   uint mask = 0;
+   for (int is = 0; is < HASH_BUCKET_SLOTS; is++){
+      mask |= (uint)(bucket[is] == key) << is;
+   }
+   return(mask);
+}
+
+static inline uint hash_probe_next(const int method, uint hashloc, uint icount, uint jump, uint hashtablesize){
+   if (method == LINEAR) {
+      hashloc++;
+   } else if (method == QUADRATIC) {
+      hashloc+=(icount*icount);
+   } else {
+      hashloc+=(icount*jump);
+   }
+   return(hashloc%hashtablesize);
+}
+
+// Lookup starting from a home slot or bucket already hashed by the caller.
+// The perfect and paged hashes index by key and ignore it.
+static inline int read_hash_probe_from(const int method, ulong hashkey, uint hashloc, const hash_context *ctx, uint *collisions){
+   hash_slot_t *hash = ctx->hash;
+   if (method == PERFECT_HASH) return((hash[2*hashkey+1] == ctx->hash_epoch) ? (int)hash[2*hashkey] : -1);
+   if (method == PAGED_HASH) {
+      uint offset;
+      int *page = ctx->hash_pages[hash_page_index(hashkey, ctx, &offset)];
+      return((page != NULL) ? page[offset] : -1);
+   }
+   if (method == BUCKET_HASH) {
+      uint icount = 0;
+      uint ibucket = hashloc;
+      const hash_slot_t *bucket = &hash[(ulong)ibucket*HASH_BUCKET_SIZE];
+      uint found = hash_bucket_match(bucket, (hash_slot_t)hashkey);
+      // slots fill in order, so a free last slot means the key is absent
+      while (! found && bucket[HASH_BUCKET_SLOTS-1] != -1){
+         icount++;
+         ibucket++;
+         if (ibucket == ctx->hashtablesize) ibucket = 0;
+         bucket = &hash[(ulong)ibucket*HASH_BUCKET_SIZE];
+         found = hash_bucket_match(bucket, (hash_slot_t)hashkey);
+      }
+      *collisions += icount;
+      return(found ? (int)bucket[HASH_BUCKET_SLOTS+__builtin_ctz(found)] : -1);
+   }
+   if (method == CUCKOO_HASH) {
+      // at most two buckets, whether or not the key is present
+      const hash_slot_t *bucket = &hash[(ulong)hashloc*HASH_BUCKET_SIZE];
+      uint found = hash_bucket_match(bucket, (hash_slot_t)hashkey);
+      if (! found) {
+         (*collisions)++;
+         bucket = &hash[(ulong)compact_hash_start2(hashkey, ctx)*HASH_BUCKET_SIZE];
+         found = hash_bucket_match(bucket, (hash_slot_t)hashkey);
+      }
+      return(found ? (int)bucket[HASH_BUCKET_SLOTS+__builtin_ctz(found)] : -1);
+   }
+   if (method == ROBIN_HOOD) {
+      // no key is further than hash_max_probe from its home slot
+      for (uint icount = 0; icount <= ctx->hash_max_probe; icount++){
+         if (hash[2*hashloc] == (hash_slot_t)hashkey) {
+            *collisions += icount;
+            return(hash[2*hashloc+1]);
+         }
+         if (hash[2*hashloc] == -1) {
+            *collisions += icount;
+            return(-1);
+         }
+         hashloc++;
+         if (hashloc == ctx->hashtablesize) hashloc = 0;
+      }
+      *collisions += ctx->hash_max_probe;
+      return(-1);
+   }
+
+   uint icount = 0;
+   uint jump = 1+hashkey%HASH_JUMP_PRIME;
+   while (hash[2*hashloc] != (hash_slot_t)hashkey && hash[2*hashloc] != -1){
+      icount++;
+      hashloc = hash_probe_next(method, hashloc, icount, jump, ctx->hashtablesize);
+   }
+   *collisions += icount;
+
+   return((hash[2*hashloc] != -1) ? hash[2*hashloc+1] : -1);
+}
+
+static inline int read_hash_probe(const int method, ulong hashkey, const hash_context *ctx, uint *collisions){
+   uint hashloc = (method == PERFECT_HASH || method == PAGED_HASH) ? 0 : compact_hash_start(hashkey, ctx);
+   return(read_hash_probe_from(method, hashkey, hashloc, ctx, collisions));
+}
+
+// Looks up a batch of keys, filling only the values that are still negative,
+// and returns a mask of the keys looked up. All the home slots are hashed and
+// prefetched before any probe sequence is followed, so the cache misses of the
+// batch are outstanding together instead of one after another.
+static inline uint read_hash_probe_batch(const int method, int nkeys, const ulong *hashkeys, int *hashvals, const hash_context *ctx, uint *collisions){
+   const hash_slot_t *hash = ctx->hash;
+   uint hashloc[HASH_BATCH_MAX];
+   uint pending = 0;
+
+   for (int k = 0; k < nkeys; k++){
+      hashloc[k] = (method == PERFECT_HASH || method == PAGED_HASH) ? 0 : compact_hash_start(hashkeys[k], ctx);
+      if (hashvals[k] < 0) pending |= 1u << k;
+   }
+
+   for (int k = 0; k < nkeys; k++){
+      if (! (pending & (1u << k))) continue;
+      if (method == PERFECT_HASH) {
+         __builtin_prefetch(&hash[2*hashkeys[k]]);
+      } else if (HASH_BUCKET_LAYOUT(method)) {
+         __builtin_prefetch(&hash[(ulong)hashloc[k]*HASH_BUCKET_SIZE]);
+      } else if (method != PAGED_HASH) {
+         __builtin_prefetch(&hash[2*(ulong)hashloc[k]]);
+      }
+   }
+
+   for (int k = 0; k < nkeys; k++){
+      if (! (pending & (1u << k))) continue;
+      collisions[k] = 0;
+      hashvals[k] = read_hash_probe_from(method, hashkeys[k], hashloc[k], ctx, &collisions[k]);
+   }
+
+   return(pending);
+}
+
+// Places a key in either of its two buckets, moving residents to their
+// other bucket to make room. The table is rebuilt with new hash functions
+// if no free slot turns up within HASH_CUCKOO_MAX_KICKS moves.
+static inline void hash_cuckoo_insert(hash_context *ctx, hash_slot_t key, int value, uint *collisions){
+   hash_slot_t *hash = ctx->hash;
+   uint ibucket1 = compact_hash_start((ulong)key, ctx);
+   uint ibucket2 = compact_hash_start2((ulong)key, ctx);
+   hash_slot_t *bucket1 = &hash[(ulong)ibucket1*HASH_BUCKET_SIZE];
+   hash_slot_t *bucket2 = &hash[(ulong)ibucket2*HASH_BUCKET_SIZE];
+
+   uint found = hash_bucket_match(bucket1, key);
+   if (found) {
+      bucket1[HASH_BUCKET_SLOTS+__builtin_ctz(found)] = value;
+      return;
+   }
+   found = hash_bucket_match(bucket2, key);
+   if (found) {
+      bucket2[HASH_BUCKET_SLOTS+__builtin_ctz(found)] = value;
+      return;
+   }
+
+   uint ibucket = ibucket1;
+   for (uint icount = 0; icount < HASH_CUCKOO_MAX_KICKS; icount++){
+      hash_slot_t *bucket = &hash[(ulong)ibucket*HASH_BUCKET_SIZE];
+      uint empty = hash_bucket_match(bucket, -1);
+      if (! empty && icount == 0) {
+         // try the second bucket before moving anything
+         ibucket = ibucket2;
+         bucket = bucket2;
+         empty = hash_bucket_match(bucket, -1);
+      }
+      if (empty) {
+         int is = __builtin_ctz(empty);
+         bucket[is] = key;
+         bucket[HASH_BUCKET_SLOTS+is] = value;
+         *collisions += icount;
+         return;
+      }
+
+      int is = (int)(((ulong)key+icount)%HASH_BUCKET_SLOTS);
+      hash_slot_t tmpkey = bucket[is];
+      int tmpvalue = (int)bucket[HASH_BUCKET_SLOTS+is];
+      bucket[is] = key;
+      bucket[HASH_BUCKET_SLOTS+is] = value;
+      key = tmpkey;
+      value = tmpvalue;
+
+      uint ialt = compact_hash_start((ulong)key, ctx);
+      ibucket = (ialt == ibucket) ? compact_hash_start2((ulong)key, ctx) : ialt;
+   }
+
+   *collisions += HASH_CUCKOO_MAX_KICKS;
+   compact_hash_cuckoo_rehash(ctx, key, value);
+}
+
+static inline void write_hash_probe(const int method, uint ic, ulong hashkey, hash_context *ctx, uint *collisions){
+   hash_slot_t *hash = ctx->hash;
+   if (method == PERFECT_HASH) {
+      hash[2*hashkey] = ic;
+      hash[2*hashkey+1] = ctx->hash_epoch;
+      return;
+   }
+   if (method == PAGED_HASH) {
+      uint offset;
+      ulong ipage = hash_page_index(hashkey, ctx, &offset);
+      int *page = ctx->hash_pages[ipage];
+      if (page == NULL) page = compact_hash_page_alloc(ctx, ipage);
+      page[offset] = ic;
+      return;
+   }
+   if (method == BUCKET_HASH) {
+      uint icount = 0;
+      uint ibucket = compact_hash_start(hashkey, ctx);
+      for ( ; ; icount++){
+         hash_slot_t *bucket = &hash[(ulong)ibucket*HASH_BUCKET_SIZE];
+         for (int is = 0; is < HASH_BUCKET_SLOTS; is++){
+            if (bucket[is] == -1 || bucket[is] == (hash_slot_t)hashkey) {
+               bucket[is] = (hash_slot_t)hashkey;
+               bucket[HASH_BUCKET_SLOTS+is] = ic;
+               *collisions += icount;
+               return;
+            }
+         }
+         ibucket++;
+         if (ibucket == ctx->hashtablesize) ibucket = 0;
+      }
+   }
+   if (method == CUCKOO_HASH) {
+      hash_cuckoo_insert(ctx, (hash_slot_t)hashkey, ic, collisions);
+      return;
+   }
+   if (method == ROBIN_HOOD) {
+      // Walk forward from the home slot. A resident closer to its own home
+      // than we are to ours gives up its slot and continues the walk.
+      hash_slot_t key = (hash_slot_t)hashkey;
+      int value = ic;
+      uint dist = 0;
+      uint hashloc = compact_hash_start(hashkey, ctx);
+      for ( ; ; dist++){
+         if (hash[2*hashloc] == -1 || hash[2*hashloc] == key) {
+            hash[2*hashloc] = key;
+            hash[2*hashloc+1] = value;
+            if (dist > ctx->hash_max_probe) ctx->hash_max_probe = dist;
+            *collisions += dist;
+            return;
+         }
+         uint resident_home = compact_hash_start((ulong)hash[2*hashloc], ctx);
+         uint resident_dist = (hashloc+ctx->hashtablesize-resident_home)%ctx->hashtablesize;
+         if (resident_dist < dist) {
+            hash_slot_t tmpkey = hash[2*hashloc];
+            int tmpvalue = (int)hash[2*hashloc+1];
+            hash[2*hashloc] = key;
+            hash[2*hashloc+1] = value;
+            if (dist > ctx->hash_max_probe) ctx->hash_max_probe = dist;
+            *collisions += dist;
+            key = tmpkey;
+            value = tmpvalue;
+            dist = resident_dist;
+         }
+         hashloc++;
+         if (hashloc == ctx->hashtablesize) hashloc = 0;
+      }
+   }
+
+   uint icount = 0;
+   uint jump = 1+hashkey%HASH_JUMP_PRIME;
+   uint hashloc = compact_hash_start(hashkey, ctx);
+   while (hash[2*hashloc] != -1 && hash[2*hashloc] != (hash_slot_t)hashkey){
+      icount++;
+      hashloc = hash_probe_next(method, hashloc, icount, jump, ctx->hashtablesize);
+   }
+   *collisions += icount;
+
+   hash[2*hashloc] = (hash_slot_t)hashkey;
+   hash[2*hashloc+1] = ic;
+}
+
+// Insert that is safe inside an OpenMP parallel region -- see write_hash_openmp
+static inline void write_hash_probe_openmp(const int method, uint ic, ulong hashkey, hash_context *ctx, uint *collisions){
+   hash_slot_t *hash = ctx->hash;
+   if (method == PERFECT_HASH) {
+      hash[2*hashkey] = ic;
+      hash[2*hashkey+1] = ctx->hash_epoch;
+      return;
+   }
+   // Robin Hood and cuckoo inserts move other keys around, so they are
+   // serialized. Callers should build these tables from a serial loop.
+   if (method == ROBIN_HOOD || method == CUCKOO_HASH) {
+#ifdef _OPENMP
+#pragma omp critical (compact_hash_insert)
+#endif
+      write_hash_probe(method, ic, hashkey, ctx, collisions);
+      return;
+   }
+   if (method == PAGED_HASH) {
+      uint offset;
+      ulong ipage = hash_page_index(hashkey, ctx, &offset);
+      int *page = ctx->hash_pages[ipage];
+      if (page == NULL) page = compact_hash_page_alloc(ctx, ipage);
+      page[offset] = ic;
+      return;
+   }
+   if (method == BUCKET_HASH) {
+      uint icount = 0;
+      uint ibucket = compact_hash_start(hashkey, ctx);
+      for ( ; ; icount++){
+         hash_slot_t *bucket = &hash[(ulong)ibucket*HASH_BUCKET_SIZE];
+         for (int is = 0; is < HASH_BUCKET_SLOTS; is++){
+            hash_slot_t old_key = __sync_val_compare_and_swap(&bucket[is], -1, (hash_slot_t)hashkey);
+            if (old_key == -1 || old_key == (hash_slot_t)hashkey) {
+               bucket[HASH_BUCKET_SLOTS+is] = ic;
+               *collisions += icount;
+               return;
+            }
+         }
+         ibucket++;
+         if (ibucket == ctx->hashtablesize) ibucket = 0;
+      }
+   }
+
+   uint icount = 0;
+   uint jump = 1+hashkey%HASH_JUMP_PRIME;
+   uint hashloc = compact_hash_start(hashkey, ctx);
+   hash_slot_t old_key = __sync_val_compare_and_swap(&hash[2*hashloc], -1, (hash_slot_t)hashkey);
+   while (old_key != -1 && old_key != (hash_slot_t)hashkey){
+      icount++;
+      hashloc = hash_probe_next(method, hashloc, icount, jump, ctx->hashtablesize);
+      old_key = __sync_val_compare_and_swap(&hash[2*hashloc], -1, (hash_slot_t)hashkey);
+   }
+   *collisions += icount;
+
+   hash[2*hashloc+1] = ic;
+}
 
 #endif // _HASH_H
 
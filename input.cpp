@@ -98,6 +98,17 @@ extern int  outputInterval,
             lttrace_on,
             do_quo_setup,
             calc_neighbor_type,
+            incremental_neighbors,
+            packed_neighbors,
+            face_fluxes,
+            fused_timestep,
+            interleaved_state,
+            float_kernels,
+            subcycling,
+            activity_tracking,
+            tiled_execution,
+            level_buckets,
+            simd_kernels,
 	    choose_hash_method,
             initial_order,
             cycle_reorder;
@@ -111,6 +122,8 @@ void outputHelp()
 {   cout << "CLAMR is an experimental adaptive mesh refinement code for the GPU." << endl
          << "Version is " << PACKAGE_VERSION << endl << endl
          << "Usage:  " << progName << " [options]..." << endl
+         << "  -A                skip the cells at rest (activity tracking);" << endl
+         << "  -b                run the finite difference and refinement potential tile by tile;" << endl
          << "  -c                turn on CPU profiling;" << endl
          << "  -d                turn on LTTRACE;" << endl
          << "  -D                turn on dynamic load balancing using LTTRACE;" << endl
@@ -118,12 +131,22 @@ void outputHelp()
          << "      \"linear\"" << endl
          << "      \"quadratic\"" << endl
          << "      \"prime_jump\"" << endl
+         << "      \"paged\"" << endl
+         << "      \"bucket\"" << endl
+         << "      \"robin_hood\"" << endl
+         << "      \"cuckoo\"" << endl
+         << "      \"adaptive\"" << endl
+         << "  -F                compute the finite difference fluxes once per face;" << endl
          << "  -f <F>            force perfect or compact hash" <<endl          
          << "      \"perfect\"" << endl
          << "      \"compact\"" << endl
          << "  -g                turn on GPU profiling;" << endl
          << "  -h                display this help message;" << endl
+         << "  -I                interleave H, U and V of each cell for the finite difference;" << endl
          << "  -i <I>            specify I steps between output files;" << endl
+         << "  -j                bucket the cells by level, for a path without refinement jumps;" << endl
+         << "  -k                pack the neighbor indices of each cell together for the finite difference;" << endl
+         << "  -L                subcycle, advancing each level with its own timestep;" << endl
          << "  -l <l>            max number of levels;" << endl
          << "  -M <M>            memory optimization factor 1.0 <= M <=100.0 (default 1.0 -- represents 1/20 perfect hash);" << endl
          << "  -m <m>            specify partition measure type;" << endl
@@ -131,6 +154,7 @@ void outputHelp()
          << "      \"without_duplicates\"" << endl
          << "  -N <n>            specify calc neighbor type;" << endl
          << "      \"hash_table\"" << endl
+         << "      \"hash_incremental\" (hash table, updated only around changes after a rezone)" << endl
          << "      \"kdtree\"" << endl
          << "  -n <N>            specify coarse grid resolution of NxN;" << endl
          << "  -o                turn off outlines;" << endl
@@ -147,12 +171,17 @@ void outputHelp()
          << "      \"local_fixed\"" << endl
          << "      \"z_order\"" << endl
          << "  -q                turn on quo;" << endl
+         << "  -R <R>            arithmetic precision R of the finite difference;" << endl
+         << "      \"double\" (default)" << endl
+         << "      \"float\"" << endl
          << "  -r                regular sum instead of enhanced precision sum (Kahan sum);" << endl
+         << "  -S                find the next timestep in the finite difference sweep;" << endl
          << "  -s <s>            specify space-filling curve method S;" << endl
          << "  -T                execute with TVD;" << endl
          << "  -t <t>            specify T time steps to run;" << endl
          << "  -V                use verbose output;" << endl
-         << "  -v                display version information." << endl; }
+         << "  -v                display version information;" << endl
+         << "  -X                run the regular cells of -j through SIMD kernels for this processor." << endl; }
 
 void outputVersion()
 {   cout << progName << " " << progVers << endl; }
@@ -202,7 +231,15 @@ void parseInput(const int argc, char** argv)
         val = strtok(argv[i++], " ,.-");
         while (val != NULL)
         {   switch (val[0])
-            {   case 'c':   //  Turn on CPU profiling.
+            {   case 'A':   //  Activity tracking.
+                    activity_tracking = 1;
+                    break;
+                    
+                case 'b':   //  Tiled execution.
+                    tiled_execution = 1;
+                    break;
+                    
+                case 'c':   //  Turn on CPU profiling.
                     //do_cpu_calc = 1;
                     break;
 
@@ -232,9 +269,23 @@ void parseInput(const int argc, char** argv)
                        choose_hash_method = QUADRATIC;
                     } else if (! strcmp(val,"prime_jump") ) {
                        choose_hash_method = PRIME_JUMP;
+                    } else if (! strcmp(val,"paged") ) {
+                       choose_hash_method = PAGED_HASH;
+                    } else if (! strcmp(val,"bucket") ) {
+                       choose_hash_method = BUCKET_HASH;
+                    } else if (! strcmp(val,"robin_hood") ) {
+                       choose_hash_method = ROBIN_HOOD;
+                    } else if (! strcmp(val,"cuckoo") ) {
+                       choose_hash_method = CUCKOO_HASH;
+                    } else if (! strcmp(val,"adaptive") ) {
+                       choose_hash_method = ADAPTIVE_HASH;
                     }
                     break;
 
+                case 'F':   //  Face-based finite difference.
+                    face_fluxes = 1;
+                    break;
+                    
                 case 'g':   //  Turn on GPU profiling.
                     //do_gpu_calc = 1;
                     break;
@@ -245,11 +296,27 @@ void parseInput(const int argc, char** argv)
                     exit(EXIT_SUCCESS);
                     break;
                     
+                case 'I':   //  Interleaved state for the finite difference.
+                    interleaved_state = 1;
+                    break;
+                    
                 case 'i':   //  Output interval specified.
                     val = strtok(argv[i++], " ,.-");
                     outputInterval = atoi(val);
                     break;
                     
+                case 'j':   //  Bucket the cells by level.
+                    level_buckets = 1;
+                    break;
+                    
+                case 'k':   //  Pack neighbor indices for the finite difference.
+                    packed_neighbors = 1;
+                    break;
+                    
+                case 'L':   //  Subcycle the levels.
+                    subcycling = 1;
+                    break;
+                    
                 case 'l':   //  max level specified.
                     val = strtok(argv[i++], " ,");
                     levmx = atoi(val);
@@ -275,6 +342,9 @@ void parseInput(const int argc, char** argv)
                     val = strtok(argv[i++], " ,");
                     if (! strcmp(val,"hash_table") ) {
                        calc_neighbor_type = HASH_TABLE;
+                    } else if (! strcmp(val,"hash_incremental") ) {
+                       calc_neighbor_type = HASH_TABLE;
+                       incremental_neighbors = 1;
                     } else if (! strcmp(val,"kdtree") ) {
                        calc_neighbor_type = KDTREE;
                     }
@@ -332,6 +402,18 @@ void parseInput(const int argc, char** argv)
 #endif
                     break;
                     
+                case 'R':   //  Arithmetic precision of the finite difference.
+                    val = strtok(argv[i++], " ,");
+                    if (! strcmp(val,"float") ) {
+                       float_kernels = 1;
+                    } else if (! strcmp(val,"double") ) {
+                       float_kernels = 0;
+                    } else {
+                       printf("Error with precision argument %s\n",val);
+                       exit(EXIT_FAILURE);
+                    }
+                    break;
+
                 case 'r':   //  Regular sum instead of enhanced precision sum.
                     val = strtok(argv[i++], " ,");
                     if (! strcmp(val,"regular_sum") ) {
@@ -348,6 +430,10 @@ void parseInput(const int argc, char** argv)
                     }
                     break;
                     
+                case 'S':   //  Fused timestep calculation.
+                    fused_timestep = 1;
+                    break;
+                    
                 case 's':   //  Space-filling curve method specified (default HILBERT_SORT).
                 //  Add different problem setups such as sloped wave in x, y and diagonal directions to help check algorithm
                     //  HILBERT_SORT
@@ -371,6 +457,11 @@ void parseInput(const int argc, char** argv)
                     exit(EXIT_SUCCESS);
                     break;
                     
+                case 'X':   //  SIMD kernels for the regular cells.
+                    simd_kernels = 1;
+                    level_buckets = 1;
+                    break;
+                    
                 default:    //  Unknown parameter encountered.
                     cout << "⚠ Unknown input parameter " << val << endl;
                     outputHelp();
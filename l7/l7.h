@@ -357,6 +357,17 @@ int L7_Update(
       const int               l7_id
       );
 
+int L7_Update_Post(
+      void                    **data_buffers,
+      const int               num_buffers,
+      const enum L7_Datatype  *l7_datatypes,
+      const int               l7_id
+      );
+
+int L7_Update_Wait(
+      const int               l7_id
+      );
+
 #ifdef HAVE_OPENCL
 int L7_Dev_Update(
       cl_mem                  dev_data_buffer,
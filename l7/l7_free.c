@@ -159,6 +159,12 @@ int L7_Free(
    if (l7_db->mpi_status)
       free(l7_db->mpi_status);
    
+   if (l7_db->async_send_buffer)
+      free(l7_db->async_send_buffer);
+   
+   if (l7_db->async_request)
+      free(l7_db->async_request);
+   
 #ifdef HAVE_OPENCL
    if (l7_db->indices_have)
       free(l7_db->indices_have);
@@ -304,6 +304,10 @@ int L7_Setup(
 		
 		l7_id_db->mpi_request_len = 0;
 		l7_id_db->mpi_status_len  = 0;
+		
+		l7_id_db->async_send_buffer_len = 0;
+		l7_id_db->async_request_len     = 0;
+		l7_id_db->num_reqs_outstanding  = 0;
 	}
 	
 	/*
@@ -0,0 +1,352 @@
+/*
+ *  Copyright (c) 2011-2012, Los Alamos National Security, LLC.
+ *  All rights Reserved.
+ *
+ *  Copyright 2011-2012. Los Alamos National Security, LLC. This software was produced 
+ *  under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National 
+ *  Laboratory (LANL), which is operated by Los Alamos National Security, LLC 
+ *  for the U.S. Department of Energy. The U.S. Government has rights to use, 
+ *  reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS 
+ *  ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR 
+ *  ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is modified
+ *  to produce derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Los Alamos National Security, LLC, Los Alamos 
+ *       National Laboratory, LANL, the U.S. Government, nor the names of its 
+ *       contributors may be used to endorse or promote products derived from 
+ *       this software without specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE LOS ALAMOS NATIONAL SECURITY, LLC AND 
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT 
+ *  NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL
+ *  SECURITY, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */  
+#include <stdlib.h>
+#include <string.h>
+#include "l7.h"
+#include "l7p.h"
+
+#define L7_LOCATION "L7_UPDATE_POST"
+
+int L7_Update_Post(
+      void                    **data_buffers,
+      const int               num_buffers,
+      const enum L7_Datatype  *l7_datatypes,
+      const int               l7_id
+      )
+{
+   /*
+    * Purpose
+    * =======
+    * L7_Update_Post starts the update of the off-process data of each of
+    * the arrays in data_buffers and returns without waiting for it. The
+    * messages are completed by L7_Update_Wait, before which the off-process
+    * part of the arrays must not be read and the arrays must not be changed.
+    * 
+    * Arguments
+    * =========
+    * data_buffers       (input/output) void**
+    *                    num_buffers arrays laid out as the data_buffer
+    *                    of L7_Update. After L7_Update_Wait,
+    *                    data_buffers[ib][num_indices_owned, num_indices_needed-1]
+    *                    contains the data collected from off-process.
+    * 
+    * num_buffers        (input) const int
+    *                    Number of arrays in data_buffers.
+    * 
+    * l7_datatypes       (input) const int*
+    *                    The type of data contained in each of the arrays,
+    *                    so arrays of different types can be posted together.
+    * 
+    * l7_id              (input) const int
+    *                    Handle to database containing conmmunication
+    *                    requirements.
+    * 
+    * Notes:
+    * =====
+    * 1) Serial compilation creates a no-op
+    * 2) Only one post may be outstanding on a database. The send data is
+    *    packed into a buffer of the database so it stays valid until the
+    *    wait, and each array is sent with a tag of its own.
+    * 
+    */
+#if defined HAVE_MPI
+   
+   /*
+    * Local variables
+    */
+   
+   char
+     *pc,                  /* (char *)data_buffers[ib]           */
+     *psend;               /* Send data of the current array     */
+   
+   int
+     i, ib, j,             /* Counters                           */
+     ierr,                 /* Error code for return              */
+     msg_bytes,            /* Message length in bytes.           */
+     num_msgs,             /* Messages posted for all arrays     */
+     num_outstanding_reqs, /* Outstanding MPI_Requests           */
+     num_send_indices,     /* Values sent for each array         */
+     offset,               /* Offset into buffer space           */
+     send_buffer_bytes_needed,
+     send_buffer_offset,   /* Start of the current array's data  */
+     sizeof_type,          /* Number of bytes for input datatype */
+     start_index,
+     tag;
+   
+   l7_id_database
+     *l7_id_db;            /* database associated with l7_id.    */
+   
+   /*
+    * Executable Statements
+    */
+   
+   if (! l7.mpi_initialized){
+      return(0);
+   }
+    
+   if (l7.initialized !=1){
+      ierr = 1;
+      L7_ASSERT(l7.initialized == 1, "L7 not initialized", ierr);
+   }
+   
+   /*
+    * Check input.
+    */
+   
+   if (data_buffers == NULL){
+      ierr = -1;
+      L7_ASSERT( data_buffers != NULL, "data_buffers != NULL", ierr);
+   }
+   
+   if (l7_datatypes == NULL){
+      ierr = -1;
+      L7_ASSERT( l7_datatypes != NULL, "l7_datatypes != NULL", ierr);
+   }
+   
+   if (l7_id <= 0){
+      ierr = -1;
+      L7_ASSERT( l7_id > 0, "l7_id <= 0", ierr);
+   }
+   
+   if (l7.numpes == 1){
+      ierr = L7_OK;
+      return(ierr);
+   }
+   
+   /*
+    * Alias database associated with input l7_id
+    */
+   
+   l7_id_db = l7p_set_database(l7_id);
+   if (l7_id_db == NULL){
+      ierr = -1;
+      L7_ASSERT(l7_id_db != NULL, "Failed to find database.", ierr);
+   }
+   
+   l7.penum = l7_id_db->penum;
+   
+   if (l7_id_db->numpes == 1){ /* No-op */
+      ierr = L7_OK;
+      return(ierr);
+   }
+   
+   if (l7_id_db->num_reqs_outstanding != 0){
+      ierr = -1;
+      L7_ASSERT(l7_id_db->num_reqs_outstanding == 0, "Update already posted", ierr);
+   }
+   
+   /*
+    * Size the send buffer and the requests for all the arrays before
+    * anything is posted.
+    */
+   
+   num_send_indices = 0;
+   for (i=0; i<l7_id_db->num_sends; i++)
+      num_send_indices += l7_id_db->send_counts[i];
+   
+   send_buffer_bytes_needed = 0;
+   for (ib=0; ib<num_buffers; ib++)
+      send_buffer_bytes_needed += num_send_indices * l7p_sizeof(l7_datatypes[ib]);
+   if (send_buffer_bytes_needed > l7_id_db->async_send_buffer_len){
+      if (l7_id_db->async_send_buffer)
+         free(l7_id_db->async_send_buffer);
+      
+      l7_id_db->async_send_buffer = (char *)malloc((unsigned long long)send_buffer_bytes_needed);
+      if (l7_id_db->async_send_buffer == NULL){
+         ierr = -1;
+         L7_ASSERT(l7_id_db->async_send_buffer != NULL, "No memory for send buffer", ierr);
+      }
+      l7_id_db->async_send_buffer_len = send_buffer_bytes_needed;
+   }
+   
+   num_msgs = num_buffers * (l7_id_db->num_recvs + l7_id_db->num_sends);
+   if (num_msgs > l7_id_db->async_request_len){
+      if (l7_id_db->async_request)
+         free(l7_id_db->async_request);
+      
+      l7_id_db->async_request = (MPI_Request *) calloc ((unsigned long long)num_msgs, sizeof(MPI_Request));
+      if (l7_id_db->async_request == NULL){
+         ierr = -1;
+         L7_ASSERT(l7_id_db->async_request != NULL,
+               "Allocation of l7_id_db->async_request failed", ierr);
+      }
+      l7_id_db->async_request_len = num_msgs;
+   }
+   
+   num_outstanding_reqs = 0;
+   send_buffer_offset = 0;
+   
+   for (ib=0; ib<num_buffers; ib++){
+      sizeof_type = l7p_sizeof(l7_datatypes[ib]);
+      pc = (char *)data_buffers[ib];
+      psend = l7_id_db->async_send_buffer + send_buffer_offset;
+      send_buffer_offset += num_send_indices * sizeof_type;
+      
+      tag = l7_id_db->this_tag_update;
+      
+      /*
+       * Receive data into user provided array.
+       */
+      
+      offset = l7_id_db->num_indices_owned * sizeof_type;
+      
+      for (i=0; i<l7_id_db->num_recvs; i++){
+         msg_bytes = l7_id_db->recv_counts[i] * sizeof_type;
+         
+         ierr = MPI_Irecv (&pc[offset], msg_bytes, MPI_BYTE,
+               l7_id_db->recv_from[i], tag,
+               MPI_COMM_WORLD, &l7_id_db->async_request[num_outstanding_reqs++] );
+         L7_ASSERT(ierr == MPI_SUCCESS, "MPI_Irecv failure", ierr);
+         
+         offset += msg_bytes;
+      }
+      
+      /*
+       * Load and send data to processes.
+       */
+      
+      offset = 0;
+      start_index = 0;
+      
+      for (i=0; i<l7_id_db->num_sends; i++){
+         switch (sizeof_type){
+            case 4:
+               for (j=0; j<l7_id_db->send_counts[i]; j++, offset++)
+                  memcpy(&psend[offset*4], &pc[l7_id_db->indices_local_to_send[offset]*4], 4);
+               break;
+            case 8:
+               for (j=0; j<l7_id_db->send_counts[i]; j++, offset++)
+                  memcpy(&psend[offset*8], &pc[l7_id_db->indices_local_to_send[offset]*8], 8);
+               break;
+            default:
+               for (j=0; j<l7_id_db->send_counts[i]; j++, offset++)
+                  memcpy(&psend[offset*sizeof_type],
+                         &pc[l7_id_db->indices_local_to_send[offset]*sizeof_type], sizeof_type);
+               break;
+         }
+         msg_bytes = l7_id_db->send_counts[i] * sizeof_type;
+         
+         ierr = MPI_Isend(&psend[start_index], msg_bytes, MPI_BYTE,
+               l7_id_db->send_to[i], tag,
+               MPI_COMM_WORLD, &l7_id_db->async_request[num_outstanding_reqs++] );
+         L7_ASSERT(ierr == MPI_SUCCESS, "MPI_Isend failure", ierr);
+         
+         start_index += msg_bytes;
+      }
+      
+      /*
+       * Message tag management
+       */
+      
+      l7_id_db->this_tag_update++;
+      
+      if (l7_id_db->this_tag_update > L7_UPDATE_TAGS_MAX)
+         l7_id_db->this_tag_update = L7_UPDATE_TAGS_MIN;
+   }
+   
+   l7_id_db->num_reqs_outstanding = num_outstanding_reqs;
+   
+#endif /* HAVE_MPI */
+   
+   return(L7_OK);
+    
+} /* End L7_Update_Post */
+
+int L7_Update_Wait(
+      const int               l7_id
+      )
+{
+   /*
+    * Purpose
+    * =======
+    * L7_Update_Wait completes the update started by L7_Update_Post on
+    * database l7_id. It returns at once when nothing is outstanding.
+    * 
+    * Arguments
+    * =========
+    * l7_id              (input) const int
+    *                    Handle to database containing conmmunication
+    *                    requirements.
+    * 
+    * Notes:
+    * =====
+    * 1) Serial compilation creates a no-op
+    * 
+    */
+#if defined HAVE_MPI
+   
+   int
+     ierr;                 /* Error code for return              */
+   
+   l7_id_database
+     *l7_id_db;            /* database associated with l7_id.    */
+   
+   if (! l7.mpi_initialized){
+      return(0);
+   }
+   
+   if (l7.numpes == 1){
+      ierr = L7_OK;
+      return(ierr);
+   }
+   
+   if (l7_id <= 0){
+      ierr = -1;
+      L7_ASSERT( l7_id > 0, "l7_id <= 0", ierr);
+   }
+   
+   l7_id_db = l7p_set_database(l7_id);
+   if (l7_id_db == NULL){
+      ierr = -1;
+      L7_ASSERT(l7_id_db != NULL, "Failed to find database.", ierr);
+   }
+   
+   if (l7_id_db->num_reqs_outstanding > 0){
+      ierr = MPI_Waitall(l7_id_db->num_reqs_outstanding,
+            l7_id_db->async_request, MPI_STATUSES_IGNORE );
+      L7_ASSERT(ierr == MPI_SUCCESS, "MPI_Waitall failure", ierr);
+   }
+   
+   l7_id_db->num_reqs_outstanding = 0;
+   
+#endif /* HAVE_MPI */
+   
+   return(L7_OK);
+    
+} /* End L7_Update_Wait */
@@ -158,6 +158,18 @@ typedef struct l7_id_database
    MPI_Status
      *mpi_status;
    
+   /* L7_Update_Post parameters */
+   
+   char
+     *async_send_buffer;       /* Packed send data of all posted arrays.    */
+   
+   int
+     async_send_buffer_len,    /* Allocated bytes of async_send_buffer.     */
+     async_request_len;        /* Allocated number of async_requests.       */
+   
+   MPI_Request
+     *async_request;
+   
 #ifdef HAVE_OPENCL
    int
      num_indices_have,         /* Count of indices needed for send in update */
@@ -30,6 +30,12 @@ void update_test()
    int *idata;
    double *rdata;
    
+   int *idata_ghost;
+   double *rdata_ghost;
+   void *post_buffers[2];
+   enum L7_Datatype post_types[2] = {L7_INT, L7_DOUBLE};
+   int ierr, iout_post, iout_post_global;
+   
    int num_indices_per_pe = 10;
    int num_iterations = 10;
    int num_updates_per_cycle = 2;
@@ -76,8 +82,9 @@ void update_test()
    num_partners = num_partners_lo + num_partners_hi;
    partner_pe = (int *)malloc(num_partners * sizeof(int));
    
+   /* Partners in ascending order, so the needed indices are sorted */
    offset = 0;
-   for (i=1; i<=num_partners_lo; i++){
+   for (i=num_partners_lo; i>=1; i--){
       partner_pe[offset] = penum - i;
       offset++;
    }
@@ -267,6 +274,49 @@ void update_test()
 #endif
    }
    
+   /*
+    * Post the int and double arrays together and check that the ghost
+    * values match what L7_Update gathered and are the needed indices.
+    */
+   
+   idata_ghost = (int *)malloc(num_indices_offpe * sizeof(int));
+   rdata_ghost = (double *)malloc(num_indices_offpe * sizeof(double));
+   for (i=0; i<num_indices_offpe; i++){
+      idata_ghost[i] = idata[num_indices_owned+i];
+      rdata_ghost[i] = rdata[num_indices_owned+i];
+      idata[num_indices_owned+i] = -1;
+      rdata[num_indices_owned+i] = -1.0;
+   }
+   
+   post_buffers[0] = idata;
+   post_buffers[1] = rdata;
+   ierr = L7_Update_Post(post_buffers, 2, post_types, l7_id);
+   if (ierr == L7_OK) ierr = L7_Update_Wait(l7_id);
+   
+   iout_post = (ierr != L7_OK);
+   for (i=0; i<num_indices_offpe; i++){
+      if (idata[num_indices_owned+i] != idata_ghost[i]) iout_post++;
+      if (rdata[num_indices_owned+i] != rdata_ghost[i]) iout_post++;
+      if (rdata[num_indices_owned+i] != (double)idata[num_indices_owned+i]) iout_post++;
+      for (j=0; j<num_indices_offpe; j++){
+         if (needed_indices[j] == idata[num_indices_owned+i]) break;
+      }
+      if (j == num_indices_offpe) iout_post++;
+   }
+   
+   L7_Sum(&iout_post, 1, L7_INT, &iout_post_global);
+   if (penum == 0) {
+       if (iout_post_global > 0){
+         printf("  Error with L7_Update_Post with int and double arrays\n");
+       }
+       else{
+         printf("  PASSED L7_Update_Post with int and double arrays\n");
+       }
+   }
+   
+   free(idata_ghost);
+   free(rdata_ghost);
+   
    L7_Free(&l7_id);
 
    /*
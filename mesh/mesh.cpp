@@ -107,6 +107,45 @@ typedef unsigned int uint;
 typedef unsigned long ulong;
 #endif
 
+// Single neighbor lookup through the specialized hash probe. When REPORT is
+// off the counts are dead and the compiler drops them.
+template <int METHOD, int REPORT>
+static inline int hash_probe(ulong hashkey, const hash_context *hash, uint &read_collisions, uint &queries, uint *probe_hist)
+{
+   uint collisions = 0;
+   int hashval = read_hash_probe(METHOD, hashkey, hash, &collisions);
+   if (REPORT) {
+      queries++;
+      read_collisions += collisions;
+      probe_hist[hash_probe_bin(collisions)]++;
+   }
+   return(hashval);
+}
+
+// Batched lookup of the faces among the first nfaces that are still unset.
+// Returns a mask of the faces that were looked up.
+template <int METHOD, int REPORT>
+static inline uint hash_probe_faces(int nfaces, const ulong *hashkeys, int *nval, const hash_context *hash, uint &read_collisions, uint &queries, uint *probe_hist)
+{
+   uint collisions[HASH_BATCH_MAX];
+   uint queried = read_hash_probe_batch(METHOD, nfaces, hashkeys, nval, hash, collisions);
+   if (REPORT) {
+      for (int k = 0; k < nfaces; k++){
+         if (! (queried & (1u << k))) continue;
+         queries++;
+         read_collisions += collisions[k];
+         probe_hist[hash_probe_bin(collisions[k])]++;
+      }
+   }
+   return(queried);
+}
+
+// A looked up neighbor is kept only if it is a local cell at the expected level
+static inline bool neighbor_at_level(int nval, int lev, const int *level, uint ncells)
+{
+   return(nval >= 0 && nval < (int)ncells && level[nval] == lev);
+}
+
 #define TWO 2
 #define HALF 0.5
 
@@ -126,6 +165,8 @@ int do_stencil_warning=0;
 
 extern bool localStencil;
 int calc_neighbor_type;
+int incremental_neighbors = 0;
+int packed_neighbors = 0;
 bool dynamic_load_balance_on;
 
 cl_kernel      kernel_hash_adjust_sizes;
@@ -270,6 +311,7 @@ Mesh::Mesh(FILE *fin, int *numpe)
 {
    char string[80];
    ibase = 1;
+   hash_select = hash_selector_init();
 
    time_t trand;
    time(&trand);
@@ -899,7 +941,7 @@ void Mesh::compare_indices_all_to_gpu_local(Mesh *mesh_global, uint ncells_globa
 #endif
 }
 
-void Mesh::compare_coordinates_gpu_global_to_cpu_global(cl_mem dev_x, cl_mem dev_dx, cl_mem dev_y, cl_mem dev_dy, cl_mem dev_H, real_t *H)
+void Mesh::compare_coordinates_gpu_global_to_cpu_global(cl_mem dev_x, cl_mem dev_dx, cl_mem dev_y, cl_mem dev_dy, cl_mem dev_H, state_t *H)
 {
    cl_command_queue command_queue = ezcl_get_command_queue();
 
@@ -928,20 +970,20 @@ void Mesh::compare_coordinates_gpu_global_to_cpu_global(cl_mem dev_x, cl_mem dev
 }
 #endif
 
-void Mesh::compare_coordinates_cpu_local_to_cpu_global(uint ncells_global, int *nsizes, int *ndispl, real_t *x, real_t *dx, real_t *y, real_t *dy, real_t *H, real_t *x_global, real_t *dx_global, real_t *y_global, real_t *dy_global, real_t *H_global, int cycle)
+void Mesh::compare_coordinates_cpu_local_to_cpu_global(uint ncells_global, int *nsizes, int *ndispl, real_t *x, real_t *dx, real_t *y, real_t *dy, state_t *H, real_t *x_global, real_t *dx_global, real_t *y_global, real_t *dy_global, state_t *H_global, int cycle)
 {
    vector<real_t> x_check_global(ncells_global);
    vector<real_t> dx_check_global(ncells_global);
    vector<real_t> y_check_global(ncells_global);
    vector<real_t> dy_check_global(ncells_global);
-   vector<real_t> H_check_global(ncells_global);
+   vector<state_t> H_check_global(ncells_global);
 
 #ifdef HAVE_MPI
    MPI_Allgatherv(&x[0],  nsizes[mype], MPI_C_REAL, &x_check_global[0],  &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
    MPI_Allgatherv(&dx[0], nsizes[mype], MPI_C_REAL, &dx_check_global[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
    MPI_Allgatherv(&y[0],  nsizes[mype], MPI_C_REAL, &y_check_global[0],  &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
    MPI_Allgatherv(&dy[0], nsizes[mype], MPI_C_REAL, &dy_check_global[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
-   MPI_Allgatherv(&H[0],  nsizes[mype], MPI_C_REAL, &H_check_global[0],  &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
+   MPI_Allgatherv(&H[0],  nsizes[mype], MPI_C_STATE, &H_check_global[0],  &nsizes[0], &ndispl[0], MPI_C_STATE, MPI_COMM_WORLD);
 #else
    // Just to get rid of compiler warnings
    if (1 == 2) printf("DEBUG -- nsizes[0] %d ndispl[0] %d x %p dx %p y %p dy %p H %p\n",
@@ -1210,6 +1252,14 @@ Mesh::Mesh(int nx, int ny, int levmx_in, int ndim_in, int boundary, int parallel
    gpu_calc_neigh_counter   = 0;
    gpu_load_balance_counter = 0;
 
+   cpu_neigh_update_cells   = 0;
+   cpu_neigh_update_total   = 0;
+
+   hash_select = hash_selector_init();
+
+   nxface = 0;
+   nyface = 0;
+
    ndim   = ndim_in;
    levmx  = levmx_in;
 
@@ -1598,6 +1648,10 @@ size_t Mesh::refine_smooth(vector<int> &mpot, int &icount, int &jcount)
          }
 #endif
 
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:newcount) \
+      private(lev, nl, nr, nt, nb, nlt, nrt, ntr, nbr, ll, lr, lt, lb, llt, lrt, ltr, lbr)
+#endif
          for(uint ic = 0; ic < ncells; ic++) {
             lev = level[ic];
             mpot[ic] = mpot_old[ic];
@@ -1736,6 +1790,9 @@ size_t Mesh::refine_smooth(vector<int> &mpot, int &icount, int &jcount)
 
    mpot_old.swap(mpot);
 
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
    for(uint ic=0; ic<ncells; ic++) {
       mpot[ic] = mpot_old[ic];
       if (mpot_old[ic] >= 0) continue;
@@ -1783,6 +1840,9 @@ size_t Mesh::refine_smooth(vector<int> &mpot, int &icount, int &jcount)
    mpot_old.swap(mpot);
 
    int n1, n2, n3;
+#ifdef _OPENMP
+#pragma omp parallel for private(n1, n2, n3)
+#endif
    for(uint ic=0; ic<ncells; ic++) {
       mpot[ic] = mpot_old[ic];
       if (mpot_old[ic] >= 0) continue;
@@ -1827,6 +1887,9 @@ size_t Mesh::refine_smooth(vector<int> &mpot, int &icount, int &jcount)
   }
 #endif
 
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
    for (uint ic=0; ic<ncells; ic++) {
       if (celltype[ic] < 0) {
          switch (celltype[ic]) {
@@ -2126,6 +2189,10 @@ void Mesh::terminate(void)
       mesh_memory.memory_delete(nbot);
       mesh_memory.memory_delete(ntop);
 
+      compact_hash_pool_free();
+      hash_selector_delete(hash_select);
+      hash_select = NULL;
+
 #ifdef HAVE_OPENCL
       hash_lib_terminate();
 
@@ -2194,30 +2261,35 @@ void Mesh::terminate(void)
 
 int Mesh::rezone_count(vector<int> mpot, int &icount, int &jcount)
 {
-   icount=0;
-   jcount=0;
+   int my_icount=0;
+   int my_jcount=0;
 
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:my_icount, my_jcount)
+#endif
    for (uint ic=0; ic<ncells; ++ic){
       if (mpot[ic] < 0) {
          if (celltype[ic] == REAL_CELL) {
             // remove all but cell that will remain to get count right when split
             // across processors
-            if (! is_lower_left(i[ic],j[ic]) ) jcount--;
+            if (! is_lower_left(i[ic],j[ic]) ) my_jcount--;
          } else {
             // either upper right or lower left will remain for boundary cells
-            if (! (is_upper_right(i[ic],j[ic]) || is_lower_left(i[ic],j[ic]) ) ) jcount--;
+            if (! (is_upper_right(i[ic],j[ic]) || is_lower_left(i[ic],j[ic]) ) ) my_jcount--;
          }
       }
 
       if (mpot[ic] > 0) {
          //printf("mpot[%d] = %d\n",ic,mpot[ic]);
          if (celltype[ic] == REAL_CELL){
-            icount += 3;
+            my_icount += 3;
          } else {
-            icount ++;
+            my_icount ++;
          }
       }
    }
+   icount = my_icount;
+   jcount = my_jcount;
    //printf("icount is %d\n",icount);
 
    return(icount+jcount);
@@ -2308,6 +2380,9 @@ void Mesh::calc_spatial_coordinates(int ibase)
    dy.resize(ncells);
 
    if (have_boundary) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
       for (uint ic = 0; ic < ncells; ic++) {
          int lev = level[ic];
          x[ic]  = xmin + (real_t)(lev_deltax[lev] * (i[ic] - ibase));
@@ -2316,6 +2391,9 @@ void Mesh::calc_spatial_coordinates(int ibase)
          dy[ic] =        (real_t)lev_deltay[lev];
       }
    } else {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
       for (uint ic = 0; ic < ncells; ic++) {
          int lev = level[ic];
          x[ic]  = xmin + (real_t)(lev_deltax[lev] * (i[ic] - lev_ibegin[lev]));
@@ -2499,8 +2577,18 @@ void Mesh::rezone_all(int icount, int jcount, vector<int> mpot, int have_state,
 
    cpu_rezone_counter++;
 
+   // Incremental neighbors carry each unchanged cell's neighbors over through
+   // its new index and leave only the cells at the changes to look up again
+   int do_neighbor_update = (incremental_neighbors && ! parallel && calc_neighbor_type == HASH_TABLE &&
+                             nlft != NULL && mesh_memory.get_memory_size(nlft) >= ncells);
+   vector<int> new_index;
+   if (do_neighbor_update) new_index.resize(ncells, -1);
+
    vector<int> celltype_save(ncells);
    if (have_state) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
       for (int ic = 0; ic < (int)ncells; ic++){
          celltype_save[ic] = celltype[ic];
       }
@@ -2566,13 +2654,34 @@ void Mesh::rezone_all(int icount, int jcount, vector<int> mpot, int have_state,
 #endif
    }
 
-   for (int ic = 0, nc = 0; ic < (int)ncells; ic++)
+   // Position in the new mesh of the first cell made from each old cell so
+   // that the old cells can be worked on independently
+   vector<int> ioffset(ncells);
+   for (int ic = 0, nc = 0; ic < (int)ncells; ic++){
+      ioffset[ic] = nc;
+      if (mpot[ic] == 0) {
+         nc++;
+      } else if (mpot[ic] < 0) {
+         if (is_lower_left(i[ic],j[ic]) ) nc++;
+         else if (celltype[ic] != REAL_CELL && is_upper_right(i[ic],j[ic]) ) nc++;
+      } else {
+         nc += (celltype[ic] == REAL_CELL) ? 4 : 2;
+      }
+   }
+
+#ifdef _OPENMP
+#pragma omp parallel for firstprivate(order, invorder)
+#endif
+   for (int ic = 0; ic < (int)ncells; ic++)
    {
+      int nc = ioffset[ic];
+
       if (mpot[ic] == 0)
       {  //  No change is needed; copy the old cell straight to the new mesh at this location.
          i_new[nc]     = i[ic];
          j_new[nc]     = j[ic];
          level_new[nc] = level[ic];
+         if (do_neighbor_update) new_index[ic] = nc;
          nc++;
       } //  Complete no change needed.
       
@@ -2996,15 +3105,22 @@ void Mesh::rezone_all(int icount, int jcount, vector<int> mpot, int have_state,
    if (have_state){
       MallocPlus state_memory_old = state_memory;
 
-      for (real_t *mem_ptr=(real_t *)state_memory_old.memory_begin();
-           mem_ptr != NULL; mem_ptr = (real_t *)state_memory_old.memory_next() ){
+      for (state_t *mem_ptr=(state_t *)state_memory_old.memory_begin();
+           mem_ptr != NULL; mem_ptr = (state_t *)state_memory_old.memory_next() ){
 
-         real_t *state_temp = (real_t *)state_memory.memory_malloc(new_ncells,
-                                                                   sizeof(real_t),
-                                                                   flags,
-                                                                   "state_temp");
+         // Spare buffers have nothing to remap; their owner regrows them if needed
+         if (state_memory_old.get_memory_flags(mem_ptr) & SCRATCH_MEMORY) continue;
 
-         for (int ic=0, nc=0; ic<(int)ncells; ic++) {
+         state_t *state_temp = (state_t *)state_memory.memory_malloc(new_ncells,
+                                                                     sizeof(state_t),
+                                                                     flags,
+                                                                     "state_temp");
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+         for (int ic=0; ic<(int)ncells; ic++) {
+            int nc = ioffset[ic];
 
             if (mpot[ic] == 0) {
                state_temp[nc] = mem_ptr[ic];
@@ -3014,14 +3130,14 @@ void Mesh::rezone_all(int icount, int jcount, vector<int> mpot, int have_state,
                   int nr = nrht[ic];
                   int nt = ntop[ic];
                   int nrt = nrht[nt];
-                  state_temp[nc] = (mem_ptr[ic] + mem_ptr[nr] + mem_ptr[nt] + mem_ptr[nrt])*0.25;
+                  state_temp[nc] = ((real_t)mem_ptr[ic] + mem_ptr[nr] + mem_ptr[nt] + mem_ptr[nrt])*0.25;
                   nc++;
                }
                if (celltype[ic] != REAL_CELL && is_upper_right(i[ic],j[ic]) ) {
                   int nl = nlft[ic];
                   int nb = nbot[ic];
                   int nlb = nlft[nb];
-                  state_temp[nc] = (mem_ptr[ic] + mem_ptr[nl] + mem_ptr[nb] + mem_ptr[nlb])*0.25;
+                  state_temp[nc] = ((real_t)mem_ptr[ic] + mem_ptr[nl] + mem_ptr[nb] + mem_ptr[nlb])*0.25;
                   nc++;
                }
             } else if (mpot[ic] > 0){
@@ -3055,10 +3171,52 @@ void Mesh::rezone_all(int icount, int jcount, vector<int> mpot, int have_state,
 
    calc_celltype(new_ncells);
 
-   nlft = (int *)mesh_memory.memory_delete(nlft);
-   nrht = (int *)mesh_memory.memory_delete(nrht);
-   nbot = (int *)mesh_memory.memory_delete(nbot);
-   ntop = (int *)mesh_memory.memory_delete(ntop);
+   vector<int> update_list;
+   if (do_neighbor_update) {
+      int *nlft_new = (int *)mesh_memory.memory_malloc(new_ncells, sizeof(int), INDEX_ARRAY_MEMORY, "nlft_new");
+      int *nrht_new = (int *)mesh_memory.memory_malloc(new_ncells, sizeof(int), INDEX_ARRAY_MEMORY, "nrht_new");
+      int *nbot_new = (int *)mesh_memory.memory_malloc(new_ncells, sizeof(int), INDEX_ARRAY_MEMORY, "nbot_new");
+      int *ntop_new = (int *)mesh_memory.memory_malloc(new_ncells, sizeof(int), INDEX_ARRAY_MEMORY, "ntop_new");
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int nc = 0; nc < new_ncells; nc++){
+         nlft_new[nc] = -1;
+         nrht_new[nc] = -1;
+         nbot_new[nc] = -1;
+         ntop_new[nc] = -1;
+      }
+
+      // A neighbor lookup lands on the cell covering a point next to the face,
+      // so it gives the same answer as long as that cell is unchanged. Faces
+      // whose old neighbor was refined or coarsened are left at -1.
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int ic = 0; ic < (int)ncells; ic++){
+         int nc = new_index[ic];
+         if (nc < 0) continue;
+         nlft_new[nc] = new_index[nlft[ic]];
+         nrht_new[nc] = new_index[nrht[ic]];
+         nbot_new[nc] = new_index[nbot[ic]];
+         ntop_new[nc] = new_index[ntop[ic]];
+      }
+
+      for (int nc = 0; nc < new_ncells; nc++){
+         if (nlft_new[nc] < 0 || nrht_new[nc] < 0 || nbot_new[nc] < 0 || ntop_new[nc] < 0) update_list.push_back(nc);
+      }
+
+      nlft = (int *)mesh_memory.memory_replace(nlft, nlft_new);
+      nrht = (int *)mesh_memory.memory_replace(nrht, nrht_new);
+      nbot = (int *)mesh_memory.memory_replace(nbot, nbot_new);
+      ntop = (int *)mesh_memory.memory_replace(ntop, ntop_new);
+   } else {
+      nlft = (int *)mesh_memory.memory_delete(nlft);
+      nrht = (int *)mesh_memory.memory_delete(nrht);
+      nbot = (int *)mesh_memory.memory_delete(nbot);
+      ntop = (int *)mesh_memory.memory_delete(ntop);
+   }
 
    //ncells = nc;
 
@@ -3076,6 +3234,8 @@ void Mesh::rezone_all(int icount, int jcount, vector<int> mpot, int have_state,
 #endif
 
    cpu_time_rezone_all += cpu_timer_stop(tstart_cpu);
+
+   if (do_neighbor_update) calc_neighbors_update(new_ncells, update_list);
 }
 
 #ifdef HAVE_OPENCL
@@ -3302,267 +3462,562 @@ void Mesh::gpu_rezone_all(int icount, int jcount, cl_mem &dev_mpot, MallocPlus &
 }
 #endif
 
-void Mesh::calc_neighbors(void)
+// Hash build and neighbor query for calc_neighbors with the probe method and
+// collision reporting fixed at compile time. Every cell goes into the table,
+// but only the cells in query_list are looked up, or all of them if it is NULL.
+template <int METHOD, int REPORT>
+void Mesh::calc_neighbors_hash(hash_context *hash, int imaxsize, int jmaxsize, struct timeval &tstart_lev2, const int *query_list, uint nquery)
 {
-   struct timeval tstart_cpu;
-   cpu_timer_start(&tstart_cpu);
+   uint write_collisions = 0;
+   uint write_probe_hist[HASH_PROBE_BINS] = {0};
 
-   cpu_calc_neigh_counter++;
-   int flags = INDEX_ARRAY_MEMORY;
+#ifdef _OPENMP
+   // Robin Hood and cuckoo inserts move other keys, so those tables are built serially
+   const int parallel_build = (METHOD != ROBIN_HOOD && METHOD != CUCKOO_HASH);
 
-#if defined (HAVE_J7)
-   if (parallel) flags |= LOAD_BALANCE_MEMORY;
+#pragma omp parallel for reduction(+:write_collisions, write_probe_hist) if (parallel_build)
 #endif
-   nlft = (int *)mesh_memory.memory_malloc(ncells, sizeof(int), flags, "nlft");
-   nrht = (int *)mesh_memory.memory_malloc(ncells, sizeof(int), flags, "nrht");
-   nbot = (int *)mesh_memory.memory_malloc(ncells, sizeof(int), flags, "nbot");
-   ntop = (int *)mesh_memory.memory_malloc(ncells, sizeof(int), flags, "ntop");
-
-   if (calc_neighbor_type == HASH_TABLE) {
-
-      struct timeval tstart_lev2;
-      if (TIMING_LEVEL >= 2) cpu_timer_start(&tstart_lev2);
-
-      int jmaxsize = (jmax+1)*levtable[levmx];
-      int imaxsize = (imax+1)*levtable[levmx];
-
-      int *hash = compact_hash_init(ncells, imaxsize, jmaxsize, 1);
-
-      for(uint ic=0; ic<ncells; ic++){
-         int lev = level[ic];
-         int levmult = levtable[levmx-lev];
-         int ii = i[ic]*levmult;
-         int jj = j[ic]*levmult;
+   for(uint ic=0; ic<ncells; ic++){
+      int lev = level[ic];
+      int levmult = levtable[levmx-lev];
+      int ii = i[ic]*levmult;
+      int jj = j[ic]*levmult;
+
+      uint collisions = 0;
+#ifdef _OPENMP
+      if (parallel_build) write_hash_probe_openmp(METHOD, ic, (ulong)jj*imaxsize+ii, hash, &collisions);
+      else                write_hash_probe(METHOD, ic, (ulong)jj*imaxsize+ii, hash, &collisions);
+#else
+      write_hash_probe(METHOD, ic, (ulong)jj*imaxsize+ii, hash, &collisions);
+#endif
+      if (REPORT) {
+         write_collisions += collisions;
+         write_probe_hist[hash_probe_bin(collisions)]++;
+      }
+   }
 
-         write_hash(ic,jj*imaxsize+ii,hash);
+   if (REPORT) {
+      hash->hash_ncells += ncells;
+      hash->write_hash_collisions += write_collisions;
+      for (int ib = 0; ib < HASH_PROBE_BINS; ib++){
+         hash->write_probe_hist[ib] += write_probe_hist[ib];
       }
+   }
 
-      write_hash_collision_report();
-      if (DEBUG) {
-         printf("\n                                    HASH numbering\n");
-         for (int jj = jmaxsize-1; jj>=0; jj--){
-            printf("%4d:",jj);
-            for (int ii = 0; ii<imaxsize; ii++){
-               printf("%5d",read_hash(jj*imaxsize+ii,hash));
-            }
-            printf("\n");
-         }
-         printf("     ");
+   write_hash_context_collision_report(hash);
+   if (DEBUG) {
+      printf("\n                                    HASH numbering\n");
+      for (int jj = jmaxsize-1; jj>=0; jj--){
+         printf("%4d:",jj);
          for (int ii = 0; ii<imaxsize; ii++){
-            printf("%4d:",ii);
+            printf("%5d",read_hash_context((ulong)jj*imaxsize+ii,hash));
          }
          printf("\n");
-
-         read_hash_collision_report();
       }
-
-      if (TIMING_LEVEL >= 2) {
-         cpu_time_hash_setup += cpu_timer_stop(tstart_lev2);
-         cpu_timer_start(&tstart_lev2);
+      printf("     ");
+      for (int ii = 0; ii<imaxsize; ii++){
+         printf("%4d:",ii);
       }
+      printf("\n");
 
-      int ii, jj, lev, levmult;
+      read_hash_context_collision_report(hash);
+   }
 
-      //fprintf(fp,"DEBUG ncells is %lu\n",ncells);
-      for (uint ic=0; ic<ncells; ic++){
-         ii = i[ic];
-         jj = j[ic];
-         lev = level[ic];
-         levmult = levtable[levmx-lev];
-         int iicur = ii*levmult;
-         int iilft = max( (ii-1)*levmult, 0         );
-         int iirht = min( (ii+1)*levmult, imaxsize-1);
-         int jjcur = jj*levmult;
-         int jjbot = max( (jj-1)*levmult, 0         );
-         int jjtop = min( (jj+1)*levmult, jmaxsize-1);
-
-         int nlftval = -1;
-         int nrhtval = -1;
-         int nbotval = -1;
-         int ntopval = -1;
-
-         // Taking care of boundary cells
-         // Force each boundary cell to point to itself on its boundary direction
-         if (iicur <    1*levtable[levmx]  ) nlftval = ic;
-         if (jjcur <    1*levtable[levmx]  ) nbotval = ic;
-         if (iicur > imax*levtable[levmx]-1) nrhtval = ic;
-         if (jjcur > jmax*levtable[levmx]-1) ntopval = ic;
-         // Boundary cells next to corner boundary need special checks
-         if (iicur ==    1*levtable[levmx] &&  (jjcur < 1*levtable[levmx] || jjcur >= jmax*levtable[levmx] ) ) nlftval = ic;
-         if (jjcur ==    1*levtable[levmx] &&  (iicur < 1*levtable[levmx] || iicur >= imax*levtable[levmx] ) ) nbotval = ic;
-         if (iirht == imax*levtable[levmx] &&  (jjcur < 1*levtable[levmx] || jjcur >= jmax*levtable[levmx] ) ) nrhtval = ic;
-         if (jjtop == jmax*levtable[levmx] &&  (iicur < 1*levtable[levmx] || iicur >= imax*levtable[levmx] ) ) ntopval = ic;
-
-         // need to check for finer neighbor first
-         // Right and top neighbor don't change for finer, so drop through to same size
-         // Left and bottom need to be half of same size index for finer test
-         if (lev != levmx) {
-            int iilftfiner = iicur-(iicur-iilft)/2;
-            //int iirhtfiner = (iicur+iirht)/2;
-            int jjbotfiner = jjcur-(jjcur-jjbot)/2;
-            //int jjtopfiner = (jjcur+jjtop)/2;
-            if (nlftval < 0) nlftval = read_hash(jjcur*imaxsize+iilftfiner, hash);
-            if (nbotval < 0) nbotval = read_hash(jjbotfiner*imaxsize+iicur, hash);
-         }
-
-         // same size neighbor
-         if (nlftval < 0) nlftval = read_hash(jjcur*imaxsize+iilft, hash);
-         if (nrhtval < 0) nrhtval = read_hash(jjcur*imaxsize+iirht, hash);
-         if (nbotval < 0) nbotval = read_hash(jjbot*imaxsize+iicur, hash);
-         if (ntopval < 0) ntopval = read_hash(jjtop*imaxsize+iicur, hash);
-
-         // Now we need to take care of special case where bottom and left boundary need adjustment since
-         // expected cell doesn't exist on these boundaries if it is finer than current cell
-         if (lev != levmx) {
-            if (jjcur < 1*levtable[levmx]) {
-               if (nrhtval < 0) {
-                  int jjtopfiner = (jjcur+jjtop)/2;
-                  nrhtval = read_hash(jjtopfiner*imaxsize+iirht, hash);
-               }
-               if (nlftval < 0) {
-                  int iilftfiner = iicur-(iicur-iilft)/2;
-                  int jjtopfiner = (jjcur+jjtop)/2;
-                  nlftval = read_hash(jjtopfiner*imaxsize+iilftfiner, hash);
-               }
-            }
-         
-            if (iicur < 1*levtable[levmx]) {
-               if (ntopval < 0) {
-                  int iirhtfiner = (iicur+iirht)/2;
-                  ntopval = read_hash(jjtop*imaxsize+iirhtfiner, hash);
-               }
-               if (nbotval < 0) {
-                  int iirhtfiner = (iicur+iirht)/2;
-                  int jjbotfiner = jjcur-(jjcur-jjbot)/2;
-                  nbotval = read_hash(jjbotfiner*imaxsize+iirhtfiner, hash);
-               }
+   if (TIMING_LEVEL >= 2) {
+      cpu_time_hash_setup += cpu_timer_stop(tstart_lev2);
+      cpu_timer_start(&tstart_lev2);
+   }
+
+   uint read_collisions = 0;
+   uint queries = 0;
+   uint read_probe_hist[HASH_PROBE_BINS] = {0};
+
+   //fprintf(fp,"DEBUG ncells is %lu\n",ncells);
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:read_collisions, queries, read_probe_hist)
+#endif
+   for (uint iq=0; iq<nquery; iq++){
+      uint ic = (query_list != NULL) ? (uint)query_list[iq] : iq;
+      int ii = i[ic];
+      int jj = j[ic];
+      int lev = level[ic];
+      int levmult = levtable[levmx-lev];
+      int iicur = ii*levmult;
+      int iilft = max( (ii-1)*levmult, 0         );
+      int iirht = min( (ii+1)*levmult, imaxsize-1);
+      int jjcur = jj*levmult;
+      int jjbot = max( (jj-1)*levmult, 0         );
+      int jjtop = min( (jj+1)*levmult, jmaxsize-1);
+
+      // Faces are stored left, bottom, right, top so that the finer lookups,
+      // which only apply to the left and bottom, lead the batch
+      int nval[4] = {-1, -1, -1, -1};
+      int &nlftval = nval[0];
+      int &nbotval = nval[1];
+      int &nrhtval = nval[2];
+      int &ntopval = nval[3];
+      ulong keys[4];
+
+      // Taking care of boundary cells
+      // Force each boundary cell to point to itself on its boundary direction
+      if (iicur <    1*levtable[levmx]  ) nlftval = ic;
+      if (jjcur <    1*levtable[levmx]  ) nbotval = ic;
+      if (iicur > imax*levtable[levmx]-1) nrhtval = ic;
+      if (jjcur > jmax*levtable[levmx]-1) ntopval = ic;
+      // Boundary cells next to corner boundary need special checks
+      if (iicur ==    1*levtable[levmx] &&  (jjcur < 1*levtable[levmx] || jjcur >= jmax*levtable[levmx] ) ) nlftval = ic;
+      if (jjcur ==    1*levtable[levmx] &&  (iicur < 1*levtable[levmx] || iicur >= imax*levtable[levmx] ) ) nbotval = ic;
+      if (iirht == imax*levtable[levmx] &&  (jjcur < 1*levtable[levmx] || jjcur >= jmax*levtable[levmx] ) ) nrhtval = ic;
+      if (jjtop == jmax*levtable[levmx] &&  (iicur < 1*levtable[levmx] || iicur >= imax*levtable[levmx] ) ) ntopval = ic;
+
+      // need to check for finer neighbor first
+      // Right and top neighbor don't change for finer, so drop through to same size
+      // Left and bottom need to be half of same size index for finer test
+      if (lev != levmx) {
+         int iilftfiner = iicur-(iicur-iilft)/2;
+         //int iirhtfiner = (iicur+iirht)/2;
+         int jjbotfiner = jjcur-(jjcur-jjbot)/2;
+         //int jjtopfiner = (jjcur+jjtop)/2;
+         keys[0] = (ulong)jjcur*imaxsize+iilftfiner;
+         keys[1] = (ulong)jjbotfiner*imaxsize+iicur;
+         hash_probe_faces<METHOD, REPORT>(2, keys, nval, hash, read_collisions, queries, read_probe_hist);
+      }
+
+      // same size neighbor
+      keys[0] = (ulong)jjcur*imaxsize+iilft;
+      keys[1] = (ulong)jjbot*imaxsize+iicur;
+      keys[2] = (ulong)jjcur*imaxsize+iirht;
+      keys[3] = (ulong)jjtop*imaxsize+iicur;
+      hash_probe_faces<METHOD, REPORT>(4, keys, nval, hash, read_collisions, queries, read_probe_hist);
+
+      // Now we need to take care of special case where bottom and left boundary need adjustment since
+      // expected cell doesn't exist on these boundaries if it is finer than current cell
+      if (lev != levmx) {
+         if (jjcur < 1*levtable[levmx]) {
+            if (nrhtval < 0) {
+               int jjtopfiner = (jjcur+jjtop)/2;
+               nrhtval = hash_probe<METHOD, REPORT>((ulong)jjtopfiner*imaxsize+iirht, hash, read_collisions, queries, read_probe_hist);
             }
-         }
-         
-         // coarser neighbor
-         if (lev != 0){
             if (nlftval < 0) {
-               iilft -= iicur-iilft;
-               int jjlft = (jj/2)*2*levmult;
-               nlftval = read_hash(jjlft*imaxsize+iilft, hash);
+               int iilftfiner = iicur-(iicur-iilft)/2;
+               int jjtopfiner = (jjcur+jjtop)/2;
+               nlftval = hash_probe<METHOD, REPORT>((ulong)jjtopfiner*imaxsize+iilftfiner, hash, read_collisions, queries, read_probe_hist);
             }
-            if (nrhtval < 0) {
-               int jjrht = (jj/2)*2*levmult;
-               nrhtval = read_hash(jjrht*imaxsize+iirht, hash);
+         }
+      
+         if (iicur < 1*levtable[levmx]) {
+            if (ntopval < 0) {
+               int iirhtfiner = (iicur+iirht)/2;
+               ntopval = hash_probe<METHOD, REPORT>((ulong)jjtop*imaxsize+iirhtfiner, hash, read_collisions, queries, read_probe_hist);
             }
             if (nbotval < 0) {
-               jjbot -= jjcur-jjbot;
-               int iibot = (ii/2)*2*levmult;
-               nbotval = read_hash(jjbot*imaxsize+iibot, hash);
-            }
-            if (ntopval < 0) {
-               int iitop = (ii/2)*2*levmult;
-               ntopval = read_hash(jjtop*imaxsize+iitop, hash);
+               int iirhtfiner = (iicur+iirht)/2;
+               int jjbotfiner = jjcur-(jjcur-jjbot)/2;
+               nbotval = hash_probe<METHOD, REPORT>((ulong)jjbotfiner*imaxsize+iirhtfiner, hash, read_collisions, queries, read_probe_hist);
             }
          }
-
-         nlft[ic] = nlftval;
-         nrht[ic] = nrhtval;
-         nbot[ic] = nbotval;
-         ntop[ic] = ntopval;
-
-         //printf("neighbors[%d] = %d %d %d %d\n",ic,nlft[ic],nrht[ic],nbot[ic],ntop[ic]);
       }
+      
+      // coarser neighbor
+      if (lev != 0 && (nlftval < 0 || nbotval < 0 || nrhtval < 0 || ntopval < 0)){
+         iilft -= iicur-iilft;
+         jjbot -= jjcur-jjbot;
+         int jjcoarse = (jj/2)*2*levmult;
+         int iicoarse = (ii/2)*2*levmult;
+         keys[0] = (ulong)jjcoarse*imaxsize+iilft;
+         keys[1] = (ulong)jjbot*imaxsize+iicoarse;
+         keys[2] = (ulong)jjcoarse*imaxsize+iirht;
+         keys[3] = (ulong)jjtop*imaxsize+iicoarse;
+         hash_probe_faces<METHOD, REPORT>(4, keys, nval, hash, read_collisions, queries, read_probe_hist);
+      }
+
+      nlft[ic] = nlftval;
+      nrht[ic] = nrhtval;
+      nbot[ic] = nbotval;
+      ntop[ic] = ntopval;
+
+      //printf("neighbors[%d] = %d %d %d %d\n",ic,nlft[ic],nrht[ic],nbot[ic],ntop[ic]);
+   }
  
-      if (DEBUG) {
-         printf("\n                                    HASH numbering\n");
-         for (int jj = jmaxsize-1; jj>=0; jj--){
-            printf("%4d:",jj);
-            for (int ii = 0; ii<imaxsize; ii++){
-               printf("%5d",read_hash(jj*imaxsize+ii,hash));
-            }
-            printf("\n");
-         }
-         printf("     ");
+   // Only the build and the queries count toward the adaptive cost
+   compact_hash_context_timer_stop(hash);
+
+   if (REPORT) {
+      hash->hash_queries += queries;
+      hash->read_hash_collisions += read_collisions;
+      for (int ib = 0; ib < HASH_PROBE_BINS; ib++){
+         hash->read_probe_hist[ib] += read_probe_hist[ib];
+      }
+   }
+
+   if (DEBUG) {
+      printf("\n                                    HASH numbering\n");
+      for (int jj = jmaxsize-1; jj>=0; jj--){
+         printf("%4d:",jj);
          for (int ii = 0; ii<imaxsize; ii++){
-            printf("%4d:",ii);
+            printf("%5d",read_hash_context((ulong)jj*imaxsize+ii,hash));
          }
          printf("\n");
-   
+      }
+      printf("     ");
+      for (int ii = 0; ii<imaxsize; ii++){
+         printf("%4d:",ii);
+      }
+      printf("\n");
+
 /*
-         printf("\n                                    nlft numbering\n");
-         for (int jj = jmaxsize-1; jj>=0; jj--){
-            printf("%4d:",jj);
-            for (int ii = 0; ii<imaxsize; ii++){
-               if (read_hash(jj*imaxsize+ii,hash) >= 0) {
-                  printf("%5d",nlft[read_hash(jj*imaxsize+ii,hash)]);
-               } else {
-                  printf("     ");
-               }
-            }
-            printf("\n");
-         }
-         printf("     ");
+      printf("\n                                    nlft numbering\n");
+      for (int jj = jmaxsize-1; jj>=0; jj--){
+         printf("%4d:",jj);
          for (int ii = 0; ii<imaxsize; ii++){
-            printf("%4d:",ii);
-         }
-         printf("\n");
-   
-         printf("\n                                    nrht numbering\n");
-         for (int jj = jmaxsize-1; jj>=0; jj--){
-            printf("%4d:",jj);
-            for (int ii = 0; ii<imaxsize; ii++){
-               if (hash[jj][ii] >= 0) {
-                  printf("%5d",nrht[hash[jj][ii]]);
-               } else {
-                  printf("     ");
-               }
+            if (read_hash_context((ulong)jj*imaxsize+ii,hash) >= 0) {
+               printf("%5d",nlft[read_hash_context((ulong)jj*imaxsize+ii,hash)]);
+            } else {
+               printf("     ");
             }
-            printf("\n");
-         }
-         printf("     ");
-         for (int ii = 0; ii<imaxsize; ii++){
-            printf("%4d:",ii);
          }
          printf("\n");
+      }
+      printf("     ");
+      for (int ii = 0; ii<imaxsize; ii++){
+         printf("%4d:",ii);
+      }
+      printf("\n");
 
-         printf("\n                                    nbot numbering\n");
-         for (int jj = jmaxsize-1; jj>=0; jj--){
-            printf("%4d:",jj);
-            for (int ii = 0; ii<imaxsize; ii++){
-               if (hash[jj][ii] >= 0) {
-                  printf("%5d",nbot[hash[jj][ii]]);
-               } else {
-                  printf("     ");
-               }
-            }
-            printf("\n");
-         }
-         printf("     ");
+      printf("\n                                    nrht numbering\n");
+      for (int jj = jmaxsize-1; jj>=0; jj--){
+         printf("%4d:",jj);
          for (int ii = 0; ii<imaxsize; ii++){
-            printf("%4d:",ii);
+            if (hash[jj][ii] >= 0) {
+               printf("%5d",nrht[hash[jj][ii]]);
+            } else {
+               printf("     ");
+            }
          }
          printf("\n");
+      }
+      printf("     ");
+      for (int ii = 0; ii<imaxsize; ii++){
+         printf("%4d:",ii);
+      }
+      printf("\n");
 
-         printf("\n                                    ntop numbering\n");
-         for (int jj = jmaxsize-1; jj>=0; jj--){
-            printf("%4d:",jj);
-            for (int ii = 0; ii<imaxsize; ii++){
-               if (hash[jj][ii] >= 0) {
-                  printf("%5d",ntop[hash[jj][ii]]);
-               } else {
-                  printf("     ");
-               }
+      printf("\n                                    nbot numbering\n");
+      for (int jj = jmaxsize-1; jj>=0; jj--){
+         printf("%4d:",jj);
+         for (int ii = 0; ii<imaxsize; ii++){
+            if (hash[jj][ii] >= 0) {
+               printf("%5d",nbot[hash[jj][ii]]);
+            } else {
+               printf("     ");
             }
-            printf("\n");
          }
-         printf("     ");
+         printf("\n");
+      }
+      printf("     ");
+      for (int ii = 0; ii<imaxsize; ii++){
+         printf("%4d:",ii);
+      }
+      printf("\n");
+
+      printf("\n                                    ntop numbering\n");
+      for (int jj = jmaxsize-1; jj>=0; jj--){
+         printf("%4d:",jj);
          for (int ii = 0; ii<imaxsize; ii++){
-            printf("%4d:",ii);
+            if (hash[jj][ii] >= 0) {
+               printf("%5d",ntop[hash[jj][ii]]);
+            } else {
+               printf("     ");
+            }
          }
          printf("\n");
+      }
+      printf("     ");
+      for (int ii = 0; ii<imaxsize; ii++){
+         printf("%4d:",ii);
+      }
+      printf("\n");
 */
+   }
+}
+
+// Builds the hash table for the whole mesh and looks up the neighbors of the
+// cells in query_list, or of every cell if it is NULL
+void Mesh::calc_neighbors_hash_table(const int *query_list, uint nquery)
+{
+   struct timeval tstart_lev2;
+   if (TIMING_LEVEL >= 2) cpu_timer_start(&tstart_lev2);
+
+   int jmaxsize = (jmax+1)*levtable[levmx];
+   int imaxsize = (imax+1)*levtable[levmx];
+
+#ifdef _OPENMP
+   hash_context *hash = compact_hash_context_init_openmp(ncells, imaxsize, jmaxsize, 1, hash_select, 0);
+#else
+   hash_context *hash = compact_hash_context_init(ncells, imaxsize, jmaxsize, 1, hash_select, 0);
+#endif
+
+   // Select the probe specialization once for the whole build and query
+   int report = (hash->hash_report_level >= 1);
+   switch (hash->hash_method) {
+   case PERFECT_HASH:
+      if (report) calc_neighbors_hash<PERFECT_HASH, 1>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      else        calc_neighbors_hash<PERFECT_HASH, 0>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      break;
+   case LINEAR:
+      if (report) calc_neighbors_hash<LINEAR,       1>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      else        calc_neighbors_hash<LINEAR,       0>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      break;
+   case QUADRATIC:
+      if (report) calc_neighbors_hash<QUADRATIC,    1>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      else        calc_neighbors_hash<QUADRATIC,    0>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      break;
+   case PRIME_JUMP:
+      if (report) calc_neighbors_hash<PRIME_JUMP,   1>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      else        calc_neighbors_hash<PRIME_JUMP,   0>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      break;
+   case PAGED_HASH:
+      if (report) calc_neighbors_hash<PAGED_HASH,   1>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      else        calc_neighbors_hash<PAGED_HASH,   0>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      break;
+   case BUCKET_HASH:
+      if (report) calc_neighbors_hash<BUCKET_HASH,  1>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      else        calc_neighbors_hash<BUCKET_HASH,  0>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      break;
+   case ROBIN_HOOD:
+      if (report) calc_neighbors_hash<ROBIN_HOOD,   1>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      else        calc_neighbors_hash<ROBIN_HOOD,   0>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      break;
+   case CUCKOO_HASH:
+      if (report) calc_neighbors_hash<CUCKOO_HASH,  1>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      else        calc_neighbors_hash<CUCKOO_HASH,  0>(hash, imaxsize, jmaxsize, tstart_lev2, query_list, nquery);
+      break;
+   default:
+      printf("Error -- Illegal value of hash_method %d\n",hash->hash_method);
+      exit(1);
+   }
+
+   read_hash_context_collision_report(hash);
+   compact_hash_context_delete(hash);
+
+   if (TIMING_LEVEL >= 2) cpu_time_hash_query += cpu_timer_stop(tstart_lev2);
+}
+
+// Copies the neighbor arrays for the first nsize cells, ghosts included, into
+// one record per cell so a gather of a cell's neighbors touches a single line.
+// The separate arrays stay the ones the mesh maintains.
+void Mesh::calc_packed_neighbors(size_t nsize)
+{
+   if (nbrs.size() < 4*nsize) nbrs.resize(4*nsize);
+   int *nbrs_ptr = &nbrs[0];
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+   for (int ic = 0; ic < (int)nsize; ic++){
+      nbrs_ptr[4*ic  ] = nlft[ic];
+      nbrs_ptr[4*ic+1] = nrht[ic];
+      nbrs_ptr[4*ic+2] = nbot[ic];
+      nbrs_ptr[4*ic+3] = ntop[ic];
+   }
+}
+
+// Neighbor steps from a cell to the farthest cell its finite difference
+// stencil reads, the top neighbor of the left neighbor's top-left, plus one
+// for a boundary cell that copies its value from a ghost cell.
+#define BORDER_CELL_DEPTH 5
+
+// Any cell within BORDER_CELL_DEPTH neighbor steps of a ghost cell needs the
+// halo values and is a border cell. The distance spreads out one step per
+// pass from the cells with a ghost neighbor.
+void Mesh::calc_border_cells(void)
+{
+   interior_cells.clear();
+   border_cells.clear();
+
+   int nc = (int)ncells;
+   vector<int> ghost_steps(nc, BORDER_CELL_DEPTH+1);
+
+   for (int ic = 0; ic < nc; ic++){
+      if (nlft[ic] >= nc || nrht[ic] >= nc || nbot[ic] >= nc || ntop[ic] >= nc) ghost_steps[ic] = 1;
+   }
+
+   for (int isteps = 1; isteps < BORDER_CELL_DEPTH; isteps++){
+      for (int ic = 0; ic < nc; ic++){
+         if (ghost_steps[ic] <= isteps) continue;
+         if (ghost_steps[nlft[ic]] == isteps || ghost_steps[nrht[ic]] == isteps ||
+             ghost_steps[nbot[ic]] == isteps || ghost_steps[ntop[ic]] == isteps) ghost_steps[ic] = isteps+1;
       }
+   }
 
-      read_hash_collision_report();
-      compact_hash_delete(hash);
+   for (int ic = 0; ic < nc; ic++){
+      if (ghost_steps[ic] <= BORDER_CELL_DEPTH) {
+         border_cells.push_back(ic);
+      } else {
+         interior_cells.push_back(ic);
+      }
+   }
+}
+
+// A cell is regular when its four neighbors and the next cells out from them
+// are all at its level, which is as far as the finite difference looks for a
+// refinement jump. The regular cells can take a path without the jump cases.
+void Mesh::calc_regular_cells(void)
+{
+   int nc = (int)ncells;
+   if ((int)cell_regular.size() < nc) cell_regular.resize(nc);
+   char *regular = &cell_regular[0];
 
-      if (TIMING_LEVEL >= 2) cpu_time_hash_query += cpu_timer_stop(tstart_lev2);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+   for (int ic = 0; ic < nc; ic++){
+      int lev = level[ic];
+      int nl = nlft[ic], nr = nrht[ic], nb = nbot[ic], nt = ntop[ic];
+      regular[ic] = (level[nl] == lev && level[nr] == lev && level[nb] == lev && level[nt] == lev &&
+                     level[nlft[nl]] == lev && level[nrht[nr]] == lev &&
+                     level[nbot[nb]] == lev && level[ntop[nt]] == lev);
+   }
+
+   regular_cells.clear();
+   jump_cells.clear();
+   for (int ic = 0; ic < nc; ic++){
+      if (regular[ic]) {
+         regular_cells.push_back(ic);
+      } else {
+         jump_cells.push_back(ic);
+      }
+   }
+}
+
+// Appends the face between cells lo and hi, lo being on the low side, and
+// records it for the cells that see it as their first face on that side.
+static void add_face(int lo, int hi, const int *level, const int *nlo, const int *nhi,
+                     vector<int> &face_lo, vector<int> &face_hi, vector<int> &face_level,
+                     vector<int> &map_lo, vector<int> &map_hi)
+{
+   int iface = face_lo.size();
+   face_lo.push_back(lo);
+   face_hi.push_back(hi);
+   face_level.push_back(MAX(level[lo], level[hi]));
+   if (nhi[lo] == hi) map_hi[lo] = iface;
+   if (nlo[hi] == lo) map_lo[hi] = iface;
+}
+
+// Faces along one direction. nlo and nhi are the neighbors on the low and high
+// side, nside the one that steps to the second fine cell across a face. Between
+// real cells the finer cell adds the face, the low side one when they are the
+// same size; a real cell adds all of its faces against ghost cells.
+static void build_face_list(int ncells, const int *level, const int *nlo, const int *nhi, const int *nside,
+                            vector<int> &face_lo, vector<int> &face_hi, vector<int> &face_level,
+                            vector<int> &map_lo, vector<int> &map_hi)
+{
+   face_lo.clear();
+   face_hi.clear();
+   face_level.clear();
+
+   for (int ic = 0; ic < ncells; ic++){
+      int lvl = level[ic];
+
+      int nl = nlo[ic];
+      if (nl == ic) {
+         map_lo[ic] = face_lo.size();
+         face_lo.push_back(ic);
+         face_hi.push_back(ic);
+         face_level.push_back(lvl);
+      } else if (nl >= ncells) {
+         add_face(nl, ic, level, nlo, nhi, face_lo, face_hi, face_level, map_lo, map_hi);
+         map_lo[ic] = face_lo.size()-1;
+         if (level[nl] > lvl) {
+            add_face(nside[nl], ic, level, nlo, nhi, face_lo, face_hi, face_level, map_lo, map_hi);
+            map_hi[nside[nl]] = face_lo.size()-1;
+         }
+      } else if (level[nl] < lvl) {
+         add_face(nl, ic, level, nlo, nhi, face_lo, face_hi, face_level, map_lo, map_hi);
+      }
+
+      int nh = nhi[ic];
+      if (nh == ic) {
+         map_hi[ic] = face_lo.size();
+         face_lo.push_back(ic);
+         face_hi.push_back(ic);
+         face_level.push_back(lvl);
+      } else if (nh >= ncells) {
+         add_face(ic, nh, level, nlo, nhi, face_lo, face_hi, face_level, map_lo, map_hi);
+         map_hi[ic] = face_lo.size()-1;
+         if (level[nh] > lvl) {
+            add_face(ic, nside[nh], level, nlo, nhi, face_lo, face_hi, face_level, map_lo, map_hi);
+            map_lo[nside[nh]] = face_lo.size()-1;
+         }
+      } else if (level[nh] <= lvl) {
+         add_face(ic, nh, level, nlo, nhi, face_lo, face_hi, face_level, map_lo, map_hi);
+      }
+   }
+}
+
+void Mesh::calc_face_list(void)
+{
+   struct timeval tstart_cpu;
+   cpu_timer_start(&tstart_cpu);
+
+   size_t nsize = MAX(ncells, ncells_ghost);
+   if (map_xface_lft.size() < nsize) {
+      map_xface_lft.resize(nsize);
+      map_xface_rht.resize(nsize);
+      map_yface_bot.resize(nsize);
+      map_yface_top.resize(nsize);
+   }
+
+   build_face_list(ncells, level, nlft, nrht, ntop,
+                   xface_lo, xface_hi, xface_level, map_xface_lft, map_xface_rht);
+   build_face_list(ncells, level, nbot, ntop, nrht,
+                   yface_lo, yface_hi, yface_level, map_yface_bot, map_yface_top);
+
+   nxface = xface_lo.size();
+   nyface = yface_lo.size();
+
+   cpu_time_calc_neighbors += cpu_timer_stop(tstart_cpu);
+}
+
+// Looks up the neighbors again for the cells in update_list after a rezone
+// has carried the rest over. The mesh already holds new_ncells cells, but
+// ncells is only reset by the caller once rezone_all returns.
+void Mesh::calc_neighbors_update(uint new_ncells, vector<int> &update_list)
+{
+   struct timeval tstart_cpu;
+   cpu_timer_start(&tstart_cpu);
+
+   cpu_calc_neigh_counter++;
+   cpu_neigh_update_cells += update_list.size();
+   cpu_neigh_update_total += new_ncells;
+
+   size_t ncells_save = ncells;
+   ncells = new_ncells;
+   if (update_list.size() > 0) calc_neighbors_hash_table(&update_list[0], update_list.size());
+   ncells = ncells_save;
+
+   cpu_time_calc_neighbors += cpu_timer_stop(tstart_cpu);
+}
+
+void Mesh::calc_neighbors(void)
+{
+   struct timeval tstart_cpu;
+   cpu_timer_start(&tstart_cpu);
+
+   cpu_calc_neigh_counter++;
+   int flags = INDEX_ARRAY_MEMORY;
+
+#if defined (HAVE_J7)
+   if (parallel) flags |= LOAD_BALANCE_MEMORY;
+#endif
+   nlft = (int *)mesh_memory.memory_malloc(ncells, sizeof(int), flags, "nlft");
+   nrht = (int *)mesh_memory.memory_malloc(ncells, sizeof(int), flags, "nrht");
+   nbot = (int *)mesh_memory.memory_malloc(ncells, sizeof(int), flags, "nbot");
+   ntop = (int *)mesh_memory.memory_malloc(ncells, sizeof(int), flags, "ntop");
+
+   if (calc_neighbor_type == HASH_TABLE) {
+
+      calc_neighbors_hash_table(NULL, ncells);
 
    } else if (calc_neighbor_type == KDTREE) {
 
@@ -3633,6 +4088,170 @@ void Mesh::calc_neighbors(void)
    cpu_time_calc_neighbors += cpu_timer_stop(tstart_cpu);
 }
 
+// Hash build and neighbor query for the local cells in calc_neighbors_local with
+// the probe method and collision reporting fixed at compile time
+template <int METHOD, int REPORT>
+void Mesh::calc_neighbors_local_hash(hash_context *hash, int iminsize, int imaxsize, int jminsize, struct timeval &tstart_lev2)
+{
+   uint write_collisions = 0;
+   uint write_probe_hist[HASH_PROBE_BINS] = {0};
+
+   for(uint ic=0; ic<ncells; ic++){
+      int cellnumber = ic+noffset;
+      int lev = level[ic];
+      int levmult = levtable[levmx-lev];
+      int ii = i[ic]*levmult-iminsize;
+      int jj = j[ic]*levmult-jminsize;
+
+      uint collisions = 0;
+      write_hash_probe(METHOD, cellnumber, (ulong)jj*(imaxsize-iminsize)+ii, hash, &collisions);
+      if (REPORT) {
+         write_collisions += collisions;
+         write_probe_hist[hash_probe_bin(collisions)]++;
+      }
+   }    
+
+   if (REPORT) {
+      hash->hash_ncells += ncells;
+      hash->write_hash_collisions += write_collisions;
+      for (int ib = 0; ib < HASH_PROBE_BINS; ib++){
+         hash->write_probe_hist[ib] += write_probe_hist[ib];
+      }
+   }
+
+   if (TIMING_LEVEL >= 2) {
+      cpu_time_hash_setup += cpu_timer_stop(tstart_lev2);
+      cpu_timer_start(&tstart_lev2);
+   }
+
+   uint read_collisions = 0;
+   uint queries = 0;
+   uint read_probe_hist[HASH_PROBE_BINS] = {0};
+
+   // Set neighbors to global cell numbers from hash
+   int jmaxcalc = (jmax+1)*levtable[levmx];
+   int imaxcalc = (imax+1)*levtable[levmx];
+
+   for (uint ic=0; ic<ncells; ic++){
+      int ii = i[ic];
+      int jj = j[ic];
+      int lev = level[ic];
+      int levmult = levtable[levmx-lev];
+
+      int iicur = ii*levmult-iminsize;
+      int iilft = max( (ii-1)*levmult, 0         )-iminsize;
+      int iirht = min( (ii+1)*levmult, imaxcalc-1)-iminsize;   
+      int jjcur = jj*levmult-jminsize;
+      int jjbot = max( (jj-1)*levmult, 0         )-jminsize;
+      int jjtop = min( (jj+1)*levmult, jmaxcalc-1)-jminsize;   
+
+      // Faces are stored left, bottom, right, top so that the finer lookups,
+      // which only apply to the left and bottom, lead the batch
+      int nval[4] = {-1, -1, -1, -1};
+      int &nlftval = nval[0];
+      int &nbotval = nval[1];
+      int &nrhtval = nval[2];
+      int &ntopval = nval[3];
+      ulong keys[4];
+
+      // Taking care of boundary cells
+      // Force each boundary cell to point to itself on its boundary direction
+      if (iicur <    1*levtable[levmx]  -iminsize) nlftval = ic+noffset;
+      if (jjcur <    1*levtable[levmx]  -jminsize) nbotval = ic+noffset;
+      if (iicur > imax*levtable[levmx]-1-iminsize) nrhtval = ic+noffset;
+      if (jjcur > jmax*levtable[levmx]-1-jminsize) ntopval = ic+noffset;
+      // Boundary cells next to corner boundary need special checks
+      if (iicur ==    1*levtable[levmx]-iminsize &&  (jjcur < 1*levtable[levmx]-jminsize || jjcur >= jmax*levtable[levmx]-jminsize ) ) nlftval = ic+noffset;
+      if (jjcur ==    1*levtable[levmx]-jminsize &&  (iicur < 1*levtable[levmx]-iminsize || iicur >= imax*levtable[levmx]-iminsize ) ) nbotval = ic+noffset;
+      if (iirht == imax*levtable[levmx]-iminsize &&  (jjcur < 1*levtable[levmx]-jminsize || jjcur >= jmax*levtable[levmx]-jminsize ) ) nrhtval = ic+noffset;
+      if (jjtop == jmax*levtable[levmx]-jminsize &&  (iicur < 1*levtable[levmx]-iminsize || iicur >= imax*levtable[levmx]-iminsize ) ) ntopval = ic+noffset;
+
+      // need to check for finer neighbor first
+      // Right and top neighbor don't change for finer, so drop through to same size
+      // Left and bottom need to be half of same size index for finer test
+      if (lev != levmx) {
+         int iilftfiner = iicur-(iicur-iilft)/2;
+         int jjbotfiner = jjcur-(jjcur-jjbot)/2;
+         keys[0] = (ulong)jjcur     *(imaxsize-iminsize)+iilftfiner;
+         keys[1] = (ulong)jjbotfiner*(imaxsize-iminsize)+iicur;
+         hash_probe_faces<METHOD, REPORT>(2, keys, nval, hash, read_collisions, queries, read_probe_hist);
+      }
+
+      // same size neighbor
+      keys[0] = (ulong)jjcur*(imaxsize-iminsize)+iilft;
+      keys[1] = (ulong)jjbot*(imaxsize-iminsize)+iicur;
+      keys[2] = (ulong)jjcur*(imaxsize-iminsize)+iirht;
+      keys[3] = (ulong)jjtop*(imaxsize-iminsize)+iicur;
+      uint queried = hash_probe_faces<METHOD, REPORT>(4, keys, nval, hash, read_collisions, queries, read_probe_hist);
+      // left and bottom only count if the cell found is local and the same size
+      if ((queried & 0x1) && ! neighbor_at_level(nlftval, lev, level, ncells)) nlftval = -1;
+      if ((queried & 0x2) && ! neighbor_at_level(nbotval, lev, level, ncells)) nbotval = -1;
+           
+      // Now we need to take care of special case where bottom and left boundary need adjustment since
+      // expected cell doesn't exist on these boundaries if it is finer than current cell
+      if (lev != levmx) {
+         if (jjcur < 1*levtable[levmx]) {
+            if (nrhtval < 0) {
+               int jjtopfiner = (jjcur+jjtop)/2;
+               nrhtval = hash_probe<METHOD, REPORT>((ulong)jjtopfiner*(imaxsize-iminsize)+iirht, hash, read_collisions, queries, read_probe_hist);
+            }
+            if (nlftval < 0) {
+               int iilftfiner = iicur-(iicur-iilft)/2;
+               int jjtopfiner = (jjcur+jjtop)/2;
+               nlftval = hash_probe<METHOD, REPORT>((ulong)jjtopfiner*(imaxsize-iminsize)+iilftfiner, hash, read_collisions, queries, read_probe_hist);
+            }
+         }
+
+         if (iicur < 1*levtable[levmx]) {
+            if (ntopval < 0) {
+               int iirhtfiner = (iicur+iirht)/2;
+               ntopval = hash_probe<METHOD, REPORT>((ulong)jjtop*(imaxsize-iminsize)+iirhtfiner, hash, read_collisions, queries, read_probe_hist);
+            }
+            if (nbotval < 0) {
+               int iirhtfiner = (iicur+iirht)/2;
+               int jjbotfiner = jjcur-(jjcur-jjbot)/2;
+               nbotval = hash_probe<METHOD, REPORT>((ulong)jjbotfiner*(imaxsize-iminsize)+iirhtfiner, hash, read_collisions, queries, read_probe_hist);
+            }
+         }
+      }
+
+      // coarser neighbor
+      if (lev != 0 && (nlftval < 0 || nbotval < 0 || nrhtval < 0 || ntopval < 0)){
+         iilft -= iicur-iilft;
+         jjbot -= jjcur-jjbot;
+         int jjcoarse = (jj/2)*2*levmult-jminsize;
+         int iicoarse = (ii/2)*2*levmult-iminsize;
+         keys[0] = (ulong)jjcoarse*(imaxsize-iminsize)+iilft;
+         keys[1] = (ulong)jjbot*(imaxsize-iminsize)+iicoarse;
+         keys[2] = (ulong)jjcoarse*(imaxsize-iminsize)+iirht;
+         keys[3] = (ulong)jjtop*(imaxsize-iminsize)+iicoarse;
+         queried = hash_probe_faces<METHOD, REPORT>(4, keys, nval, hash, read_collisions, queries, read_probe_hist);
+         for (int k = 0; k < 4; k++){
+            if ((queried & (1u << k)) && ! neighbor_at_level(nval[k], lev-1, level, ncells)) nval[k] = -1;
+         }
+      }       
+
+      nlft[ic] = nlftval;
+      nrht[ic] = nrhtval;
+      nbot[ic] = nbotval;
+      ntop[ic] = ntopval;
+
+      //fprintf(fp,"%d: neighbors[%d] = %d %d %d %d\n",mype,ic,nlft[ic],nrht[ic],nbot[ic],ntop[ic]);
+   }
+
+   // Only the build and the queries count toward the adaptive cost; the
+   // caller restarts the clock for the ghost cell passes
+   compact_hash_context_timer_stop(hash);
+
+   if (REPORT) {
+      hash->hash_queries += queries;
+      hash->read_hash_collisions += read_collisions;
+      for (int ib = 0; ib < HASH_PROBE_BINS; ib++){
+         hash->read_probe_hist[ib] += read_probe_hist[ib];
+      }
+   }
+}
+
 void Mesh::calc_neighbors_local(void)
 {
    struct timeval tstart_cpu;
@@ -3687,7 +4306,8 @@ void Mesh::calc_neighbors_local(void)
       //if (DEBUG) fprintf(fp,"%d: Sizes are imin %d imax %d jmin %d jmax %d\n",mype,iminsize,imaxsize,jminsize,jmaxsize);
 
       //fprintf(fp,"DEBUG -- ncells %lu\n",ncells);
-      int *hash = compact_hash_init(ncells, imaxsize-iminsize, jmaxsize-jminsize, 1);
+      // The local bounding box moves at every rezone, so leave the table room to grow
+      hash_context *hash = compact_hash_context_init(ncells, imaxsize-iminsize, jmaxsize-jminsize, 1, hash_select, 1);
 
       //printf("%d: DEBUG -- noffset %d cells %d\n",mype,noffset,ncells);
 
@@ -3695,139 +4315,44 @@ void Mesh::calc_neighbors_local(void)
          fprintf(fp,"%d: Sizes are imin %d imax %d jmin %d jmax %d\n",mype,iminsize,imaxsize,jminsize,jmaxsize);
       }
 
-      for(uint ic=0; ic<ncells; ic++){
-         int cellnumber = ic+noffset;
-         int lev = level[ic];
-         int levmult = levtable[levmx-lev];
-         int ii = i[ic]*levmult-iminsize;
-         int jj = j[ic]*levmult-jminsize;
-
-         write_hash(cellnumber, jj*(imaxsize-iminsize)+ii, hash);
-      }    
-
-      if (TIMING_LEVEL >= 2) {
-         cpu_time_hash_setup += cpu_timer_stop(tstart_lev2);
-         cpu_timer_start(&tstart_lev2);
-      }
-
-      int ii, jj, lev, levmult;
-
-      // Set neighbors to global cell numbers from hash
-      int jmaxcalc = (jmax+1)*levtable[levmx];
-      int imaxcalc = (imax+1)*levtable[levmx];
-
-      for (uint ic=0; ic<ncells; ic++){
-         ii = i[ic];
-         jj = j[ic];
-         lev = level[ic];
-         levmult = levtable[levmx-lev];
-
-         int iicur = ii*levmult-iminsize;
-         int iilft = max( (ii-1)*levmult, 0         )-iminsize;
-         int iirht = min( (ii+1)*levmult, imaxcalc-1)-iminsize;   
-         int jjcur = jj*levmult-jminsize;
-         int jjbot = max( (jj-1)*levmult, 0         )-jminsize;
-         int jjtop = min( (jj+1)*levmult, jmaxcalc-1)-jminsize;   
-
-         int nlftval = -1;
-         int nrhtval = -1;
-         int nbotval = -1;
-         int ntopval = -1;
-
-         // Taking care of boundary cells
-         // Force each boundary cell to point to itself on its boundary direction
-         if (iicur <    1*levtable[levmx]  -iminsize) nlftval = ic+noffset;
-         if (jjcur <    1*levtable[levmx]  -jminsize) nbotval = ic+noffset;
-         if (iicur > imax*levtable[levmx]-1-iminsize) nrhtval = ic+noffset;
-         if (jjcur > jmax*levtable[levmx]-1-jminsize) ntopval = ic+noffset;
-         // Boundary cells next to corner boundary need special checks
-         if (iicur ==    1*levtable[levmx]-iminsize &&  (jjcur < 1*levtable[levmx]-jminsize || jjcur >= jmax*levtable[levmx]-jminsize ) ) nlftval = ic+noffset;
-         if (jjcur ==    1*levtable[levmx]-jminsize &&  (iicur < 1*levtable[levmx]-iminsize || iicur >= imax*levtable[levmx]-iminsize ) ) nbotval = ic+noffset;
-         if (iirht == imax*levtable[levmx]-iminsize &&  (jjcur < 1*levtable[levmx]-jminsize || jjcur >= jmax*levtable[levmx]-jminsize ) ) nrhtval = ic+noffset;
-         if (jjtop == jmax*levtable[levmx]-jminsize &&  (iicur < 1*levtable[levmx]-iminsize || iicur >= imax*levtable[levmx]-iminsize ) ) ntopval = ic+noffset;
-
-         // need to check for finer neighbor first
-         // Right and top neighbor don't change for finer, so drop through to same size
-         // Left and bottom need to be half of same size index for finer test
-         if (lev != levmx) {
-            int iilftfiner = iicur-(iicur-iilft)/2;
-            int jjbotfiner = jjcur-(jjcur-jjbot)/2;
-            if (nlftval < 0) nlftval = read_hash(jjcur     *(imaxsize-iminsize)+iilftfiner, hash);
-            if (nbotval < 0) nbotval = read_hash(jjbotfiner*(imaxsize-iminsize)+iicur,      hash);
-         }
-
-         // same size neighbor
-         if (nlftval < 0) {
-            int nlfttry = read_hash(jjcur*(imaxsize-iminsize)+iilft, hash);
-            if (nlfttry >= 0 && nlfttry < (int)ncells && level[nlfttry] == lev) nlftval = nlfttry;
-         }
-         if (nrhtval < 0) nrhtval = read_hash(jjcur*(imaxsize-iminsize)+iirht, hash);
-         if (nbotval < 0) {
-            int nbottry = read_hash(jjbot*(imaxsize-iminsize)+iicur, hash);
-            if (nbottry >= 0 && nbottry < (int)ncells && level[nbottry] == lev) nbotval = nbottry;
-         }
-         if (ntopval < 0) ntopval = read_hash(jjtop*(imaxsize-iminsize)+iicur, hash);
-              
-         // Now we need to take care of special case where bottom and left boundary need adjustment since
-         // expected cell doesn't exist on these boundaries if it is finer than current cell
-         if (lev != levmx) {
-            if (jjcur < 1*levtable[levmx]) {
-               if (nrhtval < 0) {
-                  int jjtopfiner = (jjcur+jjtop)/2;
-                  nrhtval = read_hash(jjtopfiner*(imaxsize-iminsize)+iirht, hash);
-               }
-               if (nlftval < 0) {
-                  int iilftfiner = iicur-(iicur-iilft)/2;
-                  int jjtopfiner = (jjcur+jjtop)/2;
-                  nlftval = read_hash(jjtopfiner*(imaxsize-iminsize)+iilftfiner, hash);
-               }
-            }
-
-            if (iicur < 1*levtable[levmx]) {
-               if (ntopval < 0) {
-                  int iirhtfiner = (iicur+iirht)/2;
-                  ntopval = read_hash(jjtop*(imaxsize-iminsize)+iirhtfiner, hash);
-               }
-               if (nbotval < 0) {
-                  int iirhtfiner = (iicur+iirht)/2;
-                  int jjbotfiner = jjcur-(jjcur-jjbot)/2;
-                  nbotval = read_hash(jjbotfiner*(imaxsize-iminsize)+iirhtfiner, hash);
-               }
-            }
-         }
-
-         // coarser neighbor
-         if (lev != 0){
-            if (nlftval < 0) {
-               iilft -= iicur-iilft;
-               int jjlft = (jj/2)*2*levmult-jminsize;
-               int nlfttry = read_hash(jjlft*(imaxsize-iminsize)+iilft, hash);
-               if (nlfttry >= 0 && nlfttry < (int)ncells && level[nlfttry] == lev-1) nlftval = nlfttry;
-            }       
-            if (nrhtval < 0) {
-               int jjrht = (jj/2)*2*levmult-jminsize;
-               int nrhttry = read_hash(jjrht*(imaxsize-iminsize)+iirht, hash);
-               if (nrhttry >= 0 && nrhttry < (int)ncells && level[nrhttry] == lev-1) nrhtval = nrhttry;
-            }       
-            if (nbotval < 0) {
-               jjbot -= jjcur-jjbot;
-               int iibot = (ii/2)*2*levmult-iminsize;
-               int nbottry = read_hash(jjbot*(imaxsize-iminsize)+iibot, hash);
-               if (nbottry >= 0 && nbottry < (int)ncells && level[nbottry] == lev-1) nbotval = nbottry;
-            }       
-            if (ntopval < 0) {
-               int iitop = (ii/2)*2*levmult-iminsize;
-               int ntoptry = read_hash(jjtop*(imaxsize-iminsize)+iitop, hash);
-               if (ntoptry >= 0 && ntoptry < (int)ncells && level[ntoptry] == lev-1) ntopval = ntoptry;
-            }       
-         }       
-
-         nlft[ic] = nlftval;
-         nrht[ic] = nrhtval;
-         nbot[ic] = nbotval;
-         ntop[ic] = ntopval;
-
-         //fprintf(fp,"%d: neighbors[%d] = %d %d %d %d\n",mype,ic,nlft[ic],nrht[ic],nbot[ic],ntop[ic]);
+      // Select the probe specialization once for the whole build and query
+      int report = (hash->hash_report_level >= 1);
+      switch (hash->hash_method) {
+      case PERFECT_HASH:
+         if (report) calc_neighbors_local_hash<PERFECT_HASH, 1>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         else        calc_neighbors_local_hash<PERFECT_HASH, 0>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         break;
+      case LINEAR:
+         if (report) calc_neighbors_local_hash<LINEAR,       1>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         else        calc_neighbors_local_hash<LINEAR,       0>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         break;
+      case QUADRATIC:
+         if (report) calc_neighbors_local_hash<QUADRATIC,    1>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         else        calc_neighbors_local_hash<QUADRATIC,    0>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         break;
+      case PRIME_JUMP:
+         if (report) calc_neighbors_local_hash<PRIME_JUMP,   1>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         else        calc_neighbors_local_hash<PRIME_JUMP,   0>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         break;
+      case PAGED_HASH:
+         if (report) calc_neighbors_local_hash<PAGED_HASH,   1>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         else        calc_neighbors_local_hash<PAGED_HASH,   0>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         break;
+      case BUCKET_HASH:
+         if (report) calc_neighbors_local_hash<BUCKET_HASH,  1>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         else        calc_neighbors_local_hash<BUCKET_HASH,  0>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         break;
+      case ROBIN_HOOD:
+         if (report) calc_neighbors_local_hash<ROBIN_HOOD,   1>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         else        calc_neighbors_local_hash<ROBIN_HOOD,   0>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         break;
+      case CUCKOO_HASH:
+         if (report) calc_neighbors_local_hash<CUCKOO_HASH,  1>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         else        calc_neighbors_local_hash<CUCKOO_HASH,  0>(hash, iminsize, imaxsize, jminsize, tstart_lev2);
+         break;
+      default:
+         printf("Error -- Illegal value of hash_method %d\n",hash->hash_method);
+         exit(1);
       }
 
       if (DEBUG) {
@@ -3841,7 +4366,7 @@ void Mesh::calc_neighbors_local(void)
             if (jj >= jminsize && jj < jmaxsize) {
                for (int ii = 0; ii<imaxglobal; ii++){
                   if (ii >= iminsize && ii < imaxsize) {
-                     fprintf(fp,"%5d",read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash));
+                     fprintf(fp,"%5d",read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash));
                   } else {
                      fprintf(fp,"     ");
                   }
@@ -3861,7 +4386,7 @@ void Mesh::calc_neighbors_local(void)
             if (jj >= jminsize && jj < jmaxsize) {
                for (int ii = 0; ii<imaxglobal; ii++){
                   if (ii >= iminsize && ii < imaxsize) {
-                     int hashval = read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash)-noffset;
+                     int hashval = read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash)-noffset;
                      if (hashval >= 0 && hashval < (int)ncells) {
                         fprintf(fp,"%5d",nlft[hashval]);
                      } else {
@@ -3886,7 +4411,7 @@ void Mesh::calc_neighbors_local(void)
             if (jj >= jminsize && jj < jmaxsize) {
                for (int ii = 0; ii<imaxglobal; ii++){
                   if (ii >= iminsize && ii < imaxsize) {
-                     int hashval = read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash)-noffset;
+                     int hashval = read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash)-noffset;
                      if (hashval >= 0 && hashval < (int)ncells) {
                         fprintf(fp,"%5d",nrht[hashval]);
                      } else {
@@ -3911,7 +4436,7 @@ void Mesh::calc_neighbors_local(void)
             if (jj >= jminsize && jj < jmaxsize) {
                for (int ii = 0; ii<imaxglobal; ii++){
                   if (ii >= iminsize && ii < imaxsize) {
-                     int hashval = read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash)-noffset;
+                     int hashval = read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash)-noffset;
                      if (hashval >= 0 && hashval < (int)ncells) {
                         fprintf(fp,"%5d",nbot[hashval]);
                      } else {
@@ -3936,7 +4461,7 @@ void Mesh::calc_neighbors_local(void)
             if (jj >= jminsize && jj < jmaxsize) {
                for (int ii = 0; ii<imaxglobal; ii++){
                   if (ii >= iminsize && ii < imaxsize) {
-                     int hashval = read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash)-noffset;
+                     int hashval = read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash)-noffset;
                      if (hashval >= 0 && hashval < (int)ncells) {
                         fprintf(fp,"%5d",ntop[hashval]);
                      } else {
@@ -3963,6 +4488,11 @@ void Mesh::calc_neighbors_local(void)
 
 #ifdef HAVE_MPI
       if (numpe > 1) {
+         int ii, jj, lev, levmult;
+
+         int jmaxcalc = (jmax+1)*levtable[levmx];
+         int imaxcalc = (imax+1)*levtable[levmx];
+
          vector<int> iminsize_global(numpe);
          vector<int> imaxsize_global(numpe);
          vector<int> jminsize_global(numpe);
@@ -4219,7 +4749,7 @@ void Mesh::calc_neighbors_local(void)
                if (jj >= jminsize && jj < jmaxsize) {
                   for (int ii = 0; ii<imaxglobal; ii++){
                      if (ii >= iminsize && ii < imaxsize) {
-                        fprintf(fp,"%5d",read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash));
+                        fprintf(fp,"%5d",read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash));
                      } else {
                         fprintf(fp,"     ");
                      }
@@ -4236,6 +4766,9 @@ void Mesh::calc_neighbors_local(void)
 
          vector<int> border_cell_needed_local(nbsize_local, 0);
 
+         // The border exchange above is not part of the hash cost
+         compact_hash_context_timer_start(hash);
+
          // Layer 1
          for (int ic =0; ic<nbsize_local; ic++){
             int jj = border_cell_j_local[ic];
@@ -4260,16 +4793,16 @@ void Mesh::calc_neighbors_local(void)
                // Check for finer cell left and bottom side
                if (lev != levmx){                                // finer neighbor
                   int iilftfiner = iicur-(iicur-iilft)/2;
-                  nlftval = read_hash(jjcur*(imaxsize-iminsize)+iilftfiner, hash);
+                  nlftval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iilftfiner, hash);
                   // Also check for finer cell left and top side
                   if (nlftval < 0) {
                      int jjtopfiner = (jjcur+jjtop)/2; 
-                     nlftval = read_hash(jjtopfiner*(imaxsize-iminsize)+iilftfiner, hash);
+                     nlftval = read_hash_context((ulong)jjtopfiner*(imaxsize-iminsize)+iilftfiner, hash);
                   }
                }
 
                if (nlftval < 0 && iilft >= 0) {  // same size
-                  int nlfttry = read_hash(jjcur*(imaxsize-iminsize)+iilft, hash);
+                  int nlfttry = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iilft, hash);
                   // we have to test for same level or it could be a finer cell one cell away that it is matching
                   if (nlfttry-noffset >= 0 && nlfttry-noffset < (int)ncells && level[nlfttry-noffset] == lev) {
                      nlftval = nlfttry;
@@ -4279,7 +4812,7 @@ void Mesh::calc_neighbors_local(void)
                if (lev != 0 && nlftval < 0 && iilft-(iicur-iilft) >= 0){      // coarser neighbor
                   iilft -= iicur-iilft;
                   int jjlft = (jj/2)*2*levmult-jminsize;
-                  int nlfttry = read_hash(jjlft*(imaxsize-iminsize)+iilft, hash);
+                  int nlfttry = read_hash_context((ulong)jjlft*(imaxsize-iminsize)+iilft, hash);
                   // we have to test for coarser level or it could be a same size cell one or two cells away that it is matching
                   if (nlfttry-noffset >= 0 && nlfttry-noffset < (int)ncells && level[nlfttry-noffset] == lev-1) {
                     nlftval = nlfttry;
@@ -4292,16 +4825,16 @@ void Mesh::calc_neighbors_local(void)
             if (iirht < imaxsize-iminsize && iirht >= 0 && jjcur >= 0 && jjtop < jmaxsize-jminsize) {
                int nrhtval = -1;
                // right neighbor -- finer, same size and coarser
-               nrhtval = read_hash(jjcur*(imaxsize-iminsize)+iirht, hash);
+               nrhtval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iirht, hash);
                // right neighbor -- finer right top test
                if (nrhtval < 0 && lev != levmx){
                   int jjtopfiner = (jjcur+jjtop)/2;
-                  nrhtval = read_hash(jjtopfiner*(imaxsize-iminsize)+iirht, hash);
+                  nrhtval = read_hash_context((ulong)jjtopfiner*(imaxsize-iminsize)+iirht, hash);
                }
                if (nrhtval < 0 && lev != 0) { // test for coarser, but not directly above
                   int jjrhtcoarser = (jj/2)*2*levmult-jminsize;
                   if (jjrhtcoarser != jjcur) {
-                     int nrhttry = read_hash(jjrhtcoarser*(imaxsize-iminsize)+iirht, hash);
+                     int nrhttry = read_hash_context((ulong)jjrhtcoarser*(imaxsize-iminsize)+iirht, hash);
                      if (nrhttry-noffset >= 0 && nrhttry-noffset < (int)ncells && level[nrhttry-noffset] == lev-1) {
                         nrhtval = nrhttry;
                      }
@@ -4316,16 +4849,16 @@ void Mesh::calc_neighbors_local(void)
                // Check for finer cell below and left side
                if (lev != levmx){                                // finer neighbor
                   int jjbotfiner = jjcur-(jjcur-jjbot)/2;
-                  nbotval = read_hash(jjbotfiner*(imaxsize-iminsize)+iicur, hash);
+                  nbotval = read_hash_context((ulong)jjbotfiner*(imaxsize-iminsize)+iicur, hash);
                   // Also check for finer cell below and right side
                   if (nbotval < 0) {
                      int iirhtfiner = (iicur+iirht)/2; 
-                     nbotval = read_hash(jjbotfiner*(imaxsize-iminsize)+iirhtfiner, hash);
+                     nbotval = read_hash_context((ulong)jjbotfiner*(imaxsize-iminsize)+iirhtfiner, hash);
                   }
                }
 
                if (nbotval < 0 && jjbot >= 0) {  // same size
-                  int nbottry = read_hash(jjbot*(imaxsize-iminsize)+iicur, hash);
+                  int nbottry = read_hash_context((ulong)jjbot*(imaxsize-iminsize)+iicur, hash);
                   // we have to test for same level or it could be a finer cell one cell away that it is matching
                   if (nbottry-noffset >= 0 && nbottry-noffset < (int)ncells && level[nbottry-noffset] == lev) {
                      nbotval = nbottry;
@@ -4335,7 +4868,7 @@ void Mesh::calc_neighbors_local(void)
                if (lev != 0 && nbotval < 0 && jjbot-(jjcur-jjbot) >= 0){      // coarser neighbor
                   jjbot -= jjcur-jjbot;
                   int iibot = (ii/2)*2*levmult-iminsize;
-                  int nbottry = read_hash(jjbot*(imaxsize-iminsize)+iibot, hash);
+                  int nbottry = read_hash_context((ulong)jjbot*(imaxsize-iminsize)+iibot, hash);
                   // we have to test for coarser level or it could be a same size cell one or two cells away that it is matching
                   if (nbottry-noffset >= 0 && nbottry-noffset < (int)ncells && level[nbottry-noffset] == lev-1) {
                     nbotval = nbottry;
@@ -4348,16 +4881,16 @@ void Mesh::calc_neighbors_local(void)
             if (iirht < imaxsize-iminsize && iicur >= 0 && jjtop >= 0 && jjtop < jmaxsize-jminsize) {
                int ntopval = -1;
                // top neighbor -- finer, same size and coarser
-               ntopval = read_hash(jjtop*(imaxsize-iminsize)+iicur, hash);
+               ntopval = read_hash_context((ulong)jjtop*(imaxsize-iminsize)+iicur, hash);
                // top neighbor -- finer top right test
                if (ntopval < 0 && lev != levmx){
                   int iirhtfiner = (iicur+iirht)/2;
-                  ntopval = read_hash(jjtop*(imaxsize-iminsize)+iirhtfiner, hash);
+                  ntopval = read_hash_context((ulong)jjtop*(imaxsize-iminsize)+iirhtfiner, hash);
                }
                if (ntopval < 0 && lev != 0) { // test for coarser, but not directly above
                   int iitopcoarser = (ii/2)*2*levmult-iminsize;
                   if (iitopcoarser != iicur) {
-                     int ntoptry = read_hash(jjtop*(imaxsize-iminsize)+iitopcoarser, hash);
+                     int ntoptry = read_hash_context((ulong)jjtop*(imaxsize-iminsize)+iitopcoarser, hash);
                      if (ntoptry-noffset >= 0 && ntoptry-noffset < (int)ncells && level[ntoptry-noffset] == lev-1) {
                         ntopval = ntoptry;
                      }
@@ -4386,7 +4919,7 @@ void Mesh::calc_neighbors_local(void)
             ii = border_cell_i_local[ic]*levmult-iminsize;
             jj = border_cell_j_local[ic]*levmult-jminsize;
 
-            write_hash(ncells+noffset+ic, jj*(imaxsize-iminsize)+ii, hash);
+            write_hash_context(ncells+noffset+ic, (ulong)jj*(imaxsize-iminsize)+ii, hash);
          }
 
          if (TIMING_LEVEL >= 2) {
@@ -4405,7 +4938,7 @@ void Mesh::calc_neighbors_local(void)
                if (jj >= jminsize && jj < jmaxsize) {
                   for (int ii = 0; ii<imaxglobal; ii++){
                      if (ii >= iminsize && ii < imaxsize) {
-                        fprintf(fp,"%5d",read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) );
+                        fprintf(fp,"%5d",read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) );
                      } else {
                         fprintf(fp,"     ");
                      }
@@ -4444,20 +4977,20 @@ void Mesh::calc_neighbors_local(void)
                // Check for finer cell left and bottom side
                if (lev != levmx){                                // finer neighbor
                   int iilftfiner = iicur-(iicur-iilft)/2;
-                  int nl = read_hash(jjcur*(imaxsize-iminsize)+iilftfiner, hash);
+                  int nl = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iilftfiner, hash);
                   if (nl >= (int)(ncells+noffset) && (border_cell_needed_local[nl-ncells-noffset] & 0x0001) == 0x0001) {
                      iborder = 0x0001;
                   } else {
                      // Also check for finer cell left and top side
                      int jjtopfiner = (jjcur+jjtop)/2;
-                     int nlt = read_hash(jjtopfiner*(imaxsize-iminsize)+iilftfiner, hash);
+                     int nlt = read_hash_context((ulong)jjtopfiner*(imaxsize-iminsize)+iilftfiner, hash);
                      if ( nlt >= (int)(ncells+noffset) && (border_cell_needed_local[nlt-ncells-noffset] & 0x0001) == 0x0001) {
                         iborder = 0x0001;
                      }
                   }
                }
                if ( (iborder & 0x0001) == 0 && iilft >= 0) { //same size
-                  int nl = read_hash(jjcur*(imaxsize-iminsize)+iilft, hash);
+                  int nl = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iilft, hash);
                   int levcheck = -1;
                   if (nl-noffset >= 0 && nl-noffset < (int)ncells) {
                      levcheck = level[nl-noffset];
@@ -4469,7 +5002,7 @@ void Mesh::calc_neighbors_local(void)
                   } else if (lev != 0 && iilft-(iicur-iilft) >= 0){      // coarser neighbor
                      iilft -= iicur-iilft;
                      int jjlft = (jj/2)*2*levmult-jminsize;
-                     nl = read_hash(jjlft*(imaxsize-iminsize)+iilft, hash);
+                     nl = read_hash_context((ulong)jjlft*(imaxsize-iminsize)+iilft, hash);
                      levcheck = -1;
                      if (nl-noffset >= 0 && nl-noffset < (int)ncells) {
                         levcheck = level[nl-noffset];
@@ -4487,13 +5020,13 @@ void Mesh::calc_neighbors_local(void)
             // Test for cell to right
             if (iirht < imaxsize-iminsize && iirht >= 0 && jjcur >= 0 && jjtop < jmaxsize-jminsize) {
                // right neighbor -- finer, same size and coarser
-               int nr = read_hash(jjcur*(imaxsize-iminsize)+iirht, hash);
+               int nr = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iirht, hash);
                if (nr >= (int)(ncells+noffset) && (border_cell_needed_local[nr-ncells-noffset] & 0x0002) == 0x0002) {
                   iborder = 0x0002;
                } else if (lev != levmx){
                   // right neighbor -- finer right top test
                   int jjtopfiner = (jjcur+jjtop)/2;
-                  int nrt = read_hash(jjtopfiner*(imaxsize-iminsize)+iirht, hash);
+                  int nrt = read_hash_context((ulong)jjtopfiner*(imaxsize-iminsize)+iirht, hash);
                   if (nrt >= (int)(ncells+noffset) && (border_cell_needed_local[nrt-ncells-noffset] & 0x0002) == 0x0002) {
                      iborder = 0x0002;
                   }
@@ -4501,7 +5034,7 @@ void Mesh::calc_neighbors_local(void)
                if ( (iborder & 0x0002) == 0  && lev != 0) { // test for coarser, but not directly right
                   int jjrhtcoarser = (jj/2)*2*levmult-jminsize;
                   if (jjrhtcoarser != jjcur) {
-                     int nr = read_hash(jjrhtcoarser*(imaxsize-iminsize)+iirht, hash);
+                     int nr = read_hash_context((ulong)jjrhtcoarser*(imaxsize-iminsize)+iirht, hash);
                      int levcheck = -1;
                      if (nr-noffset >= 0 && nr-noffset < (int)ncells) {
                         levcheck = level[nr-noffset];
@@ -4520,20 +5053,20 @@ void Mesh::calc_neighbors_local(void)
                // Check for finer cell below and left side
                if (lev != levmx){                                // finer neighbor
                   int jjbotfiner = jjcur-(jjcur-jjbot)/2;
-                  int nb = read_hash(jjbotfiner*(imaxsize-iminsize)+iicur, hash);
+                  int nb = read_hash_context((ulong)jjbotfiner*(imaxsize-iminsize)+iicur, hash);
                   if (nb >= (int)(ncells+noffset) && (border_cell_needed_local[nb-ncells-noffset] & 0x0004) == 0x0004) {
                      iborder = 0x0004;
                   } else {
                      // Also check for finer cell below and right side
                      int iirhtfiner = (iicur+iirht)/2;
-                     int nbr = read_hash(jjbotfiner*(imaxsize-iminsize)+iirhtfiner, hash);
+                     int nbr = read_hash_context((ulong)jjbotfiner*(imaxsize-iminsize)+iirhtfiner, hash);
                      if (nbr >= (int)(ncells+noffset) && (border_cell_needed_local[nbr-ncells-noffset] & 0x0004) == 0x0004) {
                         iborder = 0x0004;
                      }
                   }
                }
                if ( (iborder & 0x0004) == 0 && jjbot >= 0) { //same size
-                  int nb = read_hash(jjbot*(imaxsize-iminsize)+iicur, hash);
+                  int nb = read_hash_context((ulong)jjbot*(imaxsize-iminsize)+iicur, hash);
                   int levcheck = -1;
                   if (nb-noffset >= 0 && nb-noffset < (int)ncells) {
                      levcheck = level[nb-noffset];
@@ -4545,7 +5078,7 @@ void Mesh::calc_neighbors_local(void)
                   } else if (lev != 0 && jjbot-(jjcur-jjbot) >= 0){      // coarser neighbor
                      jjbot -= jjcur-jjbot;
                      int iibot = (ii/2)*2*levmult-iminsize;
-                     nb = read_hash(jjbot*(imaxsize-iminsize)+iibot, hash);
+                     nb = read_hash_context((ulong)jjbot*(imaxsize-iminsize)+iibot, hash);
                      levcheck = -1;
                      if (nb-noffset >= 0 && nb-noffset < (int)ncells) {
                         levcheck = level[nb-noffset];
@@ -4563,12 +5096,12 @@ void Mesh::calc_neighbors_local(void)
             // Test for cell to top
             if (iirht < imaxsize-iminsize && iicur >= 0 && jjtop >= 0 && jjtop < jmaxsize-jminsize) {
                // top neighbor -- finer, same size and coarser
-               int nt = read_hash(jjtop*(imaxsize-iminsize)+iicur, hash);
+               int nt = read_hash_context((ulong)jjtop*(imaxsize-iminsize)+iicur, hash);
                if (nt  >= (int)(ncells+noffset) && (border_cell_needed_local[nt-ncells-noffset] & 0x0008) == 0x0008) {
                   iborder = 0x0008;
                } else if (lev != levmx){
                   int iirhtfiner = (iicur+iirht)/2;
-                  int ntr = read_hash(jjtop*(imaxsize-iminsize)+iirhtfiner, hash);
+                  int ntr = read_hash_context((ulong)jjtop*(imaxsize-iminsize)+iirhtfiner, hash);
                   if ( ntr >= (int)(ncells+noffset) && (border_cell_needed_local[ntr-ncells-noffset] & 0x0008) == 0x0008) {
                      iborder = 0x0008;
                   }
@@ -4576,7 +5109,7 @@ void Mesh::calc_neighbors_local(void)
                if ( (iborder & 0x0008) == 0  && lev != 0) { // test for coarser, but not directly above
                   int iitopcoarser = (ii/2)*2*levmult-iminsize;
                   if (iitopcoarser != iicur) {
-                     int nb = read_hash(jjtop*(imaxsize-iminsize)+iitopcoarser, hash);
+                     int nb = read_hash_context((ulong)jjtop*(imaxsize-iminsize)+iitopcoarser, hash);
                      int levcheck = -1;
                      if (nb-noffset >= 0 && nb-noffset < (int)ncells) {
                         levcheck = level[nb-noffset];
@@ -4622,9 +5155,11 @@ void Mesh::calc_neighbors_local(void)
             int ii = border_cell_i_local[ic]*levmult-iminsize;
             int jj = border_cell_j_local[ic]*levmult-jminsize;
 
-            write_hash(-(ncells+ic), jj*(imaxsize-iminsize)+ii, hash);
+            write_hash_context(-(ncells+ic), (ulong)jj*(imaxsize-iminsize)+ii, hash);
          }
 
+         compact_hash_context_timer_stop(hash);
+
          if (TIMING_LEVEL >= 2) {
             cpu_time_layer2 += cpu_timer_stop(tstart_lev2);
             cpu_timer_start(&tstart_lev2);
@@ -4641,7 +5176,7 @@ void Mesh::calc_neighbors_local(void)
                if (jj >= jminsize && jj < jmaxsize) {
                   for (int ii = 0; ii<imaxglobal; ii++){
                      if (ii >= iminsize && ii < imaxsize) {
-                        fprintf(fp,"%5d",read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) );
+                        fprintf(fp,"%5d",read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) );
                      } else {
                         fprintf(fp,"     ");
                      }
@@ -4709,6 +5244,8 @@ void Mesh::calc_neighbors_local(void)
             print_local();
          }
 
+         compact_hash_context_timer_start(hash);
+
          for (uint ic=0; ic<ncells_ghost; ic++){
             ii = i[ic];
             jj = j[ic];
@@ -4732,21 +5269,21 @@ void Mesh::calc_neighbors_local(void)
             if (nlftval == -1){
                // Taking care of boundary cells
                // Force each boundary cell to point to itself on its boundary direction
-               if (iicur <    1*levtable[levmx]  -iminsize) nlftval = read_hash(jjcur*(imaxsize-iminsize)+iicur, hash);
+               if (iicur <    1*levtable[levmx]  -iminsize) nlftval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iicur, hash);
 
                // Boundary cells next to corner boundary need special checks
-               if (iicur ==    1*levtable[levmx]-iminsize &&  (jjcur < 1*levtable[levmx]-jminsize || jjcur >= jmax*levtable[levmx]-jminsize ) ) nlftval = read_hash(jjcur*(imaxsize-iminsize)+iicur, hash);
+               if (iicur ==    1*levtable[levmx]-iminsize &&  (jjcur < 1*levtable[levmx]-jminsize || jjcur >= jmax*levtable[levmx]-jminsize ) ) nlftval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iicur, hash);
 
                // need to check for finer neighbor first
                // Right and top neighbor don't change for finer, so drop through to same size
                // Left and bottom need to be half of same size index for finer test
                if (lev != levmx) {
                   int iilftfiner = iicur-(iicur-iilft)/2;
-                  if (nlftval == -1 && iilftfiner >= 0) nlftval = read_hash(jjcur*(imaxsize-iminsize)+iilftfiner, hash);
+                  if (nlftval == -1 && iilftfiner >= 0) nlftval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iilftfiner, hash);
                }
 
                // same size neighbor
-               if (nlftval == -1 && iilft >= 0) nlftval = read_hash(jjcur*(imaxsize-iminsize)+iilft, hash);
+               if (nlftval == -1 && iilft >= 0) nlftval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iilft, hash);
 
                // Now we need to take care of special case where bottom and left boundary need adjustment since
                // expected cell doesn't exist on these boundaries if it is finer than current cell
@@ -4754,7 +5291,7 @@ void Mesh::calc_neighbors_local(void)
                   if (nlftval == -1) {
                      int iilftfiner = iicur-(iicur-iilft)/2;
                      int jjtopfiner = (jjcur+jjtop)/2;
-                     if (jjtopfiner < jmaxsize-jminsize && iilftfiner >= 0) nlftval = read_hash(jjtopfiner*(imaxsize-iminsize)+iilftfiner, hash);
+                     if (jjtopfiner < jmaxsize-jminsize && iilftfiner >= 0) nlftval = read_hash_context((ulong)jjtopfiner*(imaxsize-iminsize)+iilftfiner, hash);
                   }
                }
 
@@ -4763,7 +5300,7 @@ void Mesh::calc_neighbors_local(void)
                   if (nlftval == -1) {
                      int iilftcoarser = iilft - (iicur-iilft);
                      int jjlft = (jj/2)*2*levmult-jminsize;
-                     if (iilftcoarser >=0) nlftval = read_hash(jjlft*(imaxsize-iminsize)+iilftcoarser, hash);
+                     if (iilftcoarser >=0) nlftval = read_hash_context((ulong)jjlft*(imaxsize-iminsize)+iilftcoarser, hash);
                   }
                }
 
@@ -4773,20 +5310,20 @@ void Mesh::calc_neighbors_local(void)
             if (nrhtval == -1) {
                // Taking care of boundary cells
                // Force each boundary cell to point to itself on its boundary direction
-               if (iicur > imax*levtable[levmx]-1-iminsize) nrhtval = read_hash(jjcur*(imaxsize-iminsize)+iicur, hash);
+               if (iicur > imax*levtable[levmx]-1-iminsize) nrhtval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iicur, hash);
 
                // Boundary cells next to corner boundary need special checks
-               if (iirht == imax*levtable[levmx]-iminsize &&  (jjcur < 1*levtable[levmx]-jminsize || jjcur >= jmax*levtable[levmx]-jminsize ) ) nrhtval = read_hash(jjcur*(imaxsize-iminsize)+iicur, hash);
+               if (iirht == imax*levtable[levmx]-iminsize &&  (jjcur < 1*levtable[levmx]-jminsize || jjcur >= jmax*levtable[levmx]-jminsize ) ) nrhtval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iicur, hash);
 
                // same size neighbor
-               if (nrhtval == -1 && iirht < imaxsize-iminsize) nrhtval = read_hash(jjcur*(imaxsize-iminsize)+iirht, hash);
+               if (nrhtval == -1 && iirht < imaxsize-iminsize) nrhtval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iirht, hash);
 
                // Now we need to take care of special case where bottom and left boundary need adjustment since
                // expected cell doesn't exist on these boundaries if it is finer than current cell
                if (jjcur < 1*levtable[levmx] && lev != levmx) {
                   if (nrhtval == -1) {
                      int jjtopfiner = (jjcur+jjtop)/2;
-                     if (jjtopfiner < jmaxsize-jminsize && iirht < imaxsize-iminsize) nrhtval = read_hash(jjtopfiner*(imaxsize-iminsize)+iirht, hash);
+                     if (jjtopfiner < jmaxsize-jminsize && iirht < imaxsize-iminsize) nrhtval = read_hash_context((ulong)jjtopfiner*(imaxsize-iminsize)+iirht, hash);
                   }
                }
 
@@ -4794,7 +5331,7 @@ void Mesh::calc_neighbors_local(void)
                if (lev != 0){
                   if (nrhtval == -1) {
                      int jjrht = (jj/2)*2*levmult-jminsize;
-                     if (iirht < imaxsize-iminsize) nrhtval = read_hash(jjrht*(imaxsize-iminsize)+iirht, hash);
+                     if (iirht < imaxsize-iminsize) nrhtval = read_hash_context((ulong)jjrht*(imaxsize-iminsize)+iirht, hash);
                   }
                }
                if (nrhtval != -1) nrht[ic] = nrhtval;
@@ -4803,20 +5340,20 @@ void Mesh::calc_neighbors_local(void)
             if (nbotval == -1) {
                // Taking care of boundary cells
                // Force each boundary cell to point to itself on its boundary direction
-               if (jjcur <    1*levtable[levmx]  -jminsize) nbotval = read_hash(jjcur*(imaxsize-iminsize)+iicur, hash);
+               if (jjcur <    1*levtable[levmx]  -jminsize) nbotval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iicur, hash);
                // Boundary cells next to corner boundary need special checks
-               if (jjcur ==    1*levtable[levmx]-jminsize &&  (iicur < 1*levtable[levmx]-iminsize || iicur >= imax*levtable[levmx]-iminsize ) ) nbotval = read_hash(jjcur*(imaxsize-iminsize)+iicur, hash);
+               if (jjcur ==    1*levtable[levmx]-jminsize &&  (iicur < 1*levtable[levmx]-iminsize || iicur >= imax*levtable[levmx]-iminsize ) ) nbotval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iicur, hash);
 
                // need to check for finer neighbor first
                // Right and top neighbor don't change for finer, so drop through to same size
                // Left and bottom need to be half of same size index for finer test
                if (lev != levmx) {
                   int jjbotfiner = jjcur-(jjcur-jjbot)/2;
-                  if (nbotval == -1 && jjbotfiner >= 0) nbotval = read_hash(jjbotfiner*(imaxsize-iminsize)+iicur, hash);
+                  if (nbotval == -1 && jjbotfiner >= 0) nbotval = read_hash_context((ulong)jjbotfiner*(imaxsize-iminsize)+iicur, hash);
                }
 
                // same size neighbor
-               if (nbotval == -1 && jjbot >=0) nbotval = read_hash(jjbot*(imaxsize-iminsize)+iicur, hash);
+               if (nbotval == -1 && jjbot >=0) nbotval = read_hash_context((ulong)jjbot*(imaxsize-iminsize)+iicur, hash);
 
                // Now we need to take care of special case where bottom and left boundary need adjustment since
                // expected cell doesn't exist on these boundaries if it is finer than current cell
@@ -4824,7 +5361,7 @@ void Mesh::calc_neighbors_local(void)
                   if (nbotval == -1) {
                      int iirhtfiner = (iicur+iirht)/2;
                      int jjbotfiner = jjcur-(jjcur-jjbot)/2;
-                     if (jjbotfiner >= 0 && iirhtfiner < imaxsize-iminsize) nbotval = read_hash(jjbotfiner*(imaxsize-iminsize)+iirhtfiner, hash);
+                     if (jjbotfiner >= 0 && iirhtfiner < imaxsize-iminsize) nbotval = read_hash_context((ulong)jjbotfiner*(imaxsize-iminsize)+iirhtfiner, hash);
                   }
                }
 
@@ -4833,7 +5370,7 @@ void Mesh::calc_neighbors_local(void)
                   if (nbotval == -1) {
                      int jjbotcoarser = jjbot - (jjcur-jjbot);
                      int iibot = (ii/2)*2*levmult-iminsize;
-                     if (jjbotcoarser >= 0 && iibot >= 0) nbotval = read_hash(jjbotcoarser*(imaxsize-iminsize)+iibot, hash);
+                     if (jjbotcoarser >= 0 && iibot >= 0) nbotval = read_hash_context((ulong)jjbotcoarser*(imaxsize-iminsize)+iibot, hash);
                   }
                }
                if (nbotval != -1) nbot[ic] = nbotval;
@@ -4842,17 +5379,17 @@ void Mesh::calc_neighbors_local(void)
             if (ntopval == -1) {
                // Taking care of boundary cells
                // Force each boundary cell to point to itself on its boundary direction
-               if (jjcur > jmax*levtable[levmx]-1-jminsize) ntopval = read_hash(jjcur*(imaxsize-iminsize)+iicur, hash);
+               if (jjcur > jmax*levtable[levmx]-1-jminsize) ntopval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iicur, hash);
                // Boundary cells next to corner boundary need special checks
-               if (jjtop == jmax*levtable[levmx]-jminsize &&  (iicur < 1*levtable[levmx]-iminsize || iicur >= imax*levtable[levmx]-iminsize ) ) ntopval = read_hash(jjcur*(imaxsize-iminsize)+iicur, hash);
+               if (jjtop == jmax*levtable[levmx]-jminsize &&  (iicur < 1*levtable[levmx]-iminsize || iicur >= imax*levtable[levmx]-iminsize ) ) ntopval = read_hash_context((ulong)jjcur*(imaxsize-iminsize)+iicur, hash);
 
                // same size neighbor
-               if (ntopval == -1 && jjtop < jmaxsize-jminsize) ntopval = read_hash(jjtop*(imaxsize-iminsize)+iicur, hash);
+               if (ntopval == -1 && jjtop < jmaxsize-jminsize) ntopval = read_hash_context((ulong)jjtop*(imaxsize-iminsize)+iicur, hash);
    
                if (iicur < 1*levtable[levmx]) {
                   if (ntopval == -1) {
                      int iirhtfiner = (iicur+iirht)/2;
-                     if (jjtop < jmaxsize-jminsize && iirhtfiner < imaxsize-iminsize) ntopval = read_hash(jjtop*(imaxsize-iminsize)+iirhtfiner, hash);
+                     if (jjtop < jmaxsize-jminsize && iirhtfiner < imaxsize-iminsize) ntopval = read_hash_context((ulong)jjtop*(imaxsize-iminsize)+iirhtfiner, hash);
                   }
                }
    
@@ -4860,7 +5397,7 @@ void Mesh::calc_neighbors_local(void)
                if (lev != 0){
                   if (ntopval == -1) {
                      int iitop = (ii/2)*2*levmult-iminsize;
-                     if (jjtop < jmaxsize-jminsize && iitop < imaxsize-iminsize) ntopval = read_hash(jjtop*(imaxsize-iminsize)+iitop, hash);
+                     if (jjtop < jmaxsize-jminsize && iitop < imaxsize-iminsize) ntopval = read_hash_context((ulong)jjtop*(imaxsize-iminsize)+iitop, hash);
                   }
                }
                if (ntopval != -1) ntop[ic] = ntopval;
@@ -4869,6 +5406,8 @@ void Mesh::calc_neighbors_local(void)
             //fprintf(fp,"%d: neighbors[%d] = %d %d %d %d\n",mype,ic,nlft[ic],nrht[ic],nbot[ic],ntop[ic]);
          }
 
+         compact_hash_context_timer_stop(hash);
+
          if (TIMING_LEVEL >= 2) {
             cpu_time_fill_neigh_ghost += cpu_timer_stop(tstart_lev2);
             cpu_timer_start(&tstart_lev2);
@@ -4986,7 +5525,7 @@ void Mesh::calc_neighbors_local(void)
                if (jj >= jminsize && jj < jmaxsize) {
                   for (int ii = 0; ii<imaxglobal; ii++){
                      if (ii >= iminsize && ii < imaxsize) {
-                        fprintf(fp,"%5d",read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) );
+                        fprintf(fp,"%5d",read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) );
                      } else {
                         fprintf(fp,"     ");
                      }
@@ -5006,7 +5545,7 @@ void Mesh::calc_neighbors_local(void)
                if (jj >= jminsize && jj < jmaxsize) {
                   for (int ii = 0; ii<imaxglobal; ii++){
                      if (ii >= iminsize && ii < imaxsize) {
-                        int hashval = read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) -noffset;
+                        int hashval = read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) -noffset;
                         if ( (hashval >= 0 && hashval < (int)ncells) ) {
                               fprintf(fp,"%5d",nlft[hashval]);
                         } else {
@@ -5029,7 +5568,7 @@ void Mesh::calc_neighbors_local(void)
                if (jj >= jminsize && jj < jmaxsize) {
                   for (int ii = 0; ii<imaxglobal; ii++){
                      if ( ii >= iminsize && ii < imaxsize ) {
-                        int hashval = read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) -noffset;
+                        int hashval = read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) -noffset;
                         if ( hashval >= 0 && hashval < (int)ncells ) {
                            fprintf(fp,"%5d",nrht[hashval]);
                         } else {
@@ -5052,7 +5591,7 @@ void Mesh::calc_neighbors_local(void)
                if (jj >= jminsize && jj < jmaxsize) {
                   for (int ii = 0; ii<imaxglobal; ii++){
                      if ( ii >= iminsize && ii < imaxsize ) {
-                        int hashval = read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) -noffset;
+                        int hashval = read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) -noffset;
                         if ( hashval >= 0 && hashval < (int)ncells ) {
                            fprintf(fp,"%5d",nbot[hashval]);
                         } else {
@@ -5075,7 +5614,7 @@ void Mesh::calc_neighbors_local(void)
                if (jj >= jminsize && jj < jmaxsize) {
                   for (int ii = 0; ii<imaxglobal; ii++){
                      if ( ii >= iminsize && ii < imaxsize ) {
-                        int hashval = read_hash((jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) -noffset;
+                        int hashval = read_hash_context((ulong)(jj-jminsize)*(imaxsize-iminsize)+(ii-iminsize), hash) -noffset;
                         if ( hashval >= 0 && hashval < (int)ncells ) {
                            fprintf(fp,"%5d",ntop[hashval]);
                         } else {
@@ -5110,9 +5649,9 @@ void Mesh::calc_neighbors_local(void)
       }
 #endif
 
-      write_hash_collision_report();
-      read_hash_collision_report();
-      compact_hash_delete(hash);
+      write_hash_context_collision_report(hash);
+      read_hash_context_collision_report(hash);
+      compact_hash_context_delete(hash);
 
 #ifdef BOUNDS_CHECK
       {
@@ -5210,6 +5749,8 @@ void Mesh::calc_neighbors_local(void)
 
    } // calc_neighbor_type
 
+   if (numpe > 1) calc_border_cells();
+
    cpu_time_calc_neighbors += cpu_timer_stop(tstart_cpu);
 }
 
@@ -6869,7 +7410,14 @@ void Mesh::print_calc_neighbor_type(void)
 {
    if ( calc_neighbor_type == HASH_TABLE ) {
       if (mype == 0) printf("Using hash tables to calculate neighbors\n");
-      if (mype == 0 && numpe == 1) final_hash_collision_report();
+      if (mype == 0 && cpu_neigh_update_total > 0) {
+         printf("Incremental neighbor updates -- looked up %ld of %ld cells, fraction %lf\n",
+            cpu_neigh_update_cells,cpu_neigh_update_total,(double)cpu_neigh_update_cells/(double)cpu_neigh_update_total);
+      }
+      if (mype == 0 && numpe == 1) {
+         final_hash_collision_report();
+         hash_selector_report(hash_select);
+      }
    } else {
       printf("hash table size %ld\n",ncells*(int)log(ncells)*sizeof(int));
       if (mype == 0) printf("Using k-D tree to calculate neighbors\n");
@@ -7116,14 +7664,16 @@ void Mesh::do_load_balance_local(size_t numcells, float *weight, MallocPlus &sta
          if (parallel) flags = LOAD_BALANCE_MEMORY;
 #endif
 
-         for (real_t *mem_ptr=(real_t *)state_memory_old.memory_begin();
-              mem_ptr!=NULL; mem_ptr=(real_t *)state_memory_old.memory_next()) {
-            real_t *state_temp = (real_t *)
-                                 state_memory.memory_malloc(ncells, sizeof(real_t),
-                                                            flags,
-                                                            "state_temp");
+         for (state_t *mem_ptr=(state_t *)state_memory_old.memory_begin();
+              mem_ptr!=NULL; mem_ptr=(state_t *)state_memory_old.memory_next()) {
+            if (state_memory_old.get_memory_flags(mem_ptr) & SCRATCH_MEMORY) continue;
+
+            state_t *state_temp = (state_t *)
+                                  state_memory.memory_malloc(ncells, sizeof(state_t),
+                                                             flags,
+                                                             "state_temp");
             //printf("%d: DEBUG L7_Update in do_load_balance_local mem_ptr %p\n",mype,mem_ptr);
-            L7_Update(mem_ptr, L7_REAL, load_balance_handle);
+            L7_Update(mem_ptr, L7_STATE, load_balance_handle);
             in = 0;
             if(lower_block_size > 0) {
                for(; in < MIN(lower_block_size, (int)ncells); in++) {
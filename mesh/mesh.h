@@ -82,8 +82,23 @@ typedef double      real_t;
 typedef float       real_t;
 #endif
 
+//  Storage type of the state variables held in the state memory. With mixed
+//  precision they are stored in float and all arithmetic stays in real_t.
+#ifdef HAVE_MIXED_PRECISION
+typedef float       state_t;
+#define MPI_C_STATE MPI_FLOAT
+#define L7_STATE    L7_FLOAT
+#else
+typedef real_t      state_t;
+#define MPI_C_STATE MPI_C_REAL
+#define L7_STATE    L7_REAL
+#endif
+
 typedef unsigned int uint;
 
+struct hash_context;
+struct hash_selector;
+
 //float mem_opt_factor = 1.0;
 
 enum boundary
@@ -105,6 +120,17 @@ enum neighbor_calc
 {  HASH_TABLE,                  //  Hash Table.
    KDTREE };                    //  kD-tree.
 
+//  Read-only views of one neighbor direction, indexed by cell like nlft. The
+//  packed view reads it out of the per-cell records in Mesh::nbrs, where
+//  the four directions of a cell share a 16 byte slot.
+struct neighbor_array
+{  const int *n;
+   int operator[](int ic) const { return(n[ic]); } };
+
+struct neighbor_packed
+{  const int *n;
+   int operator[](int ic) const { return(n[4*ic]); } };
+
 using namespace std;
 
 class Mesh
@@ -171,6 +197,11 @@ public:
    int      gpu_calc_neigh_counter;
    int      gpu_load_balance_counter;
 
+   long     cpu_neigh_update_cells;   //  cells looked up again by incremental neighbor updates
+   long     cpu_neigh_update_total;   //  cells in the meshes those updates covered
+
+   struct hash_selector *hash_select; //  adaptive hash method measurements for this mesh
+
    int            mype,
                   numpe,
                   parallel,
@@ -231,6 +262,26 @@ public:
                   deltaz;       //  Grid spacing along z-axis.
 
    vector<int>    index;        //  1D ordered index of mesh elements.
+   vector<int>    nbrs;         //  nlft, nrht, nbot, ntop of each cell side by side.
+
+   size_t         nxface,       //  Number of faces normal to the x-axis.
+                  nyface;       //  Number of faces normal to the y-axis.
+   vector<int>    xface_lo,     //  Cell to the left of each x-face.
+                  xface_hi,     //  Cell to the right of each x-face.
+                  xface_level,  //  Refinement level of each x-face, the finer of its two cells.
+                  yface_lo,     //  Cell below each y-face.
+                  yface_hi,     //  Cell above each y-face.
+                  yface_level,  //  Refinement level of each y-face.
+                  map_xface_lft,//  x-face on the left side of each cell; the lower one against finer cells.
+                  map_xface_rht,//  x-face on the right side of each cell.
+                  map_yface_bot,//  y-face on the bottom side of each cell; the left one against finer cells.
+                  map_yface_top;//  y-face on the top side of each cell.
+
+   vector<int>    interior_cells,//  Real cells whose finite difference stencil reaches no ghost cell.
+                  border_cells; //  Real cells whose stencil reaches a ghost cell or a boundary cell filled from one.
+   vector<int>    regular_cells,//  Cells whose neighbors, and their neighbors beyond, are all at the cell's level.
+                  jump_cells;   //  Cells with a refinement jump within that reach.
+   vector<char>   cell_regular; //  1 for the cells in regular_cells, 0 for those in jump_cells.
 
    int            *i,            //  1D ordered index of mesh element x-indices for k-D tree.
                   *j,            //  1D ordered index of mesh element y-indices for k-D tree.
@@ -387,6 +438,34 @@ public:
    **************************************************************************************/
    void calc_neighbors(void);
    void calc_neighbors_local(void);
+   void calc_packed_neighbors(size_t nsize);
+   /**************************************************************************************
+   * Split the real cells into interior and border cells for the halo exchange overlap
+   *  Input -- from within the object
+   *    nlft, nrht, nbot, ntop arrays with the ghost cells from calc_neighbors_local
+   *  Output -- in the object
+   *    interior_cells and border_cells lists
+   **************************************************************************************/
+   void calc_border_cells(void);
+   /**************************************************************************************
+   * Bucket the cells by whether their stencil crosses a refinement jump
+   *  Input -- from within the object
+   *    level, nlft, nrht, nbot, ntop arrays
+   *  Output -- in the object
+   *    regular_cells, jump_cells and cell_regular for the first ncells cells
+   **************************************************************************************/
+   void calc_regular_cells(void);
+   /**************************************************************************************
+   * Build the list of cell faces from the neighbor arrays
+   *  Input -- from within the object
+   *    level, nlft, nrht, nbot, ntop arrays for the real and ghost cells
+   *  Output -- in the object
+   *    xface_lo/hi/level, yface_lo/hi/level and the map_?face_* arrays
+   *  Each face appears once; a coarse cell against finer ones has two faces on
+   *  that side, the second one reached through the map of the upper or right
+   *  fine cell.
+   **************************************************************************************/
+   void calc_face_list(void);
 #ifdef HAVE_OPENCL
    void gpu_calc_neighbors(void);
    void gpu_calc_neighbors_local(void);
@@ -494,9 +573,9 @@ public:
    void compare_mpot_all_to_gpu_local(int *mpot, int *mpot_global, cl_mem dev_mpot, cl_mem dev_mpot_global, uint ncells_global, int *nsizes, int *ndispl, int ncycle);
    void compare_ioffset_gpu_global_to_cpu_global(uint old_ncells, int *mpot);
    void compare_ioffset_all_to_gpu_local(uint old_ncells, uint old_ncells_global, int block_size, int block_size_global, int *mpot, int *mpot_global, cl_mem dev_ioffset, cl_mem dev_ioffset_global, int *ioffset, int *ioffset_global, int *celltype_global, int *i_global, int *j_global);
-   void compare_coordinates_gpu_global_to_cpu_global(cl_mem dev_x, cl_mem dev_dx, cl_mem dev_y, cl_mem dev_dy, cl_mem dev_H, real_t *H);
+   void compare_coordinates_gpu_global_to_cpu_global(cl_mem dev_x, cl_mem dev_dx, cl_mem dev_y, cl_mem dev_dy, cl_mem dev_H, state_t *H);
 #endif
-   void compare_coordinates_cpu_local_to_cpu_global(uint ncells_global, int *nsizes, int *ndispl, real_t *x, real_t *dx, real_t *y, real_t *dy, real_t *H, real_t *x_global, real_t *dx_global, real_t *y_global, real_t *dy_global, real_t *H_global, int cycle);
+   void compare_coordinates_cpu_local_to_cpu_global(uint ncells_global, int *nsizes, int *ndispl, real_t *x, real_t *dx, real_t *y, real_t *dy, state_t *H, real_t *x_global, real_t *dx_global, real_t *y_global, real_t *dy_global, state_t *H_global, int cycle);
 #ifdef HAVE_OPENCL
    void compare_indices_gpu_global_to_cpu_global(void);
 #endif
@@ -521,6 +600,13 @@ private:
 
    void print(void);
    void print_local(void);
+
+   void calc_neighbors_hash_table(const int *query_list, uint nquery);
+   void calc_neighbors_update(uint new_ncells, vector<int> &update_list);
+   template <int METHOD, int REPORT>
+   void calc_neighbors_hash(hash_context *hash, int imaxsize, int jmaxsize, struct timeval &tstart_lev2, const int *query_list, uint nquery);
+   template <int METHOD, int REPORT>
+   void calc_neighbors_local_hash(hash_context *hash, int iminsize, int imaxsize, int jminsize, struct timeval &tstart_lev2);
 #ifdef HAVE_OPENCL
    void print_dev_local();
 #endif
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Thread scaling of clamr_openmponly on a fixed problem. Runs the same problem
+# with OMP_NUM_THREADS set to each count in THREADS and prints the total CPU time
+# and the speedup over the first run. Extra arguments are passed to clamr.
+#
+#   THREADS="1 2 4 8 16" ./runopenmpscaling.sh -N hash_incremental
+
+THREADS=${THREADS:-"1 2 4 8"}
+PROBLEM="-n 256 -l 2 -t 500 -i 100"
+
+echo "./clamr_openmponly $PROBLEM $@"
+echo "threads  total CPU (s)  finite diff (s)  refine pot (s)  speedup"
+
+base=""
+for nt in $THREADS; do
+   OMP_NUM_THREADS=$nt ./clamr_openmponly $PROBLEM "$@" > openmpscaling.$nt.out 2>&1
+   total=`grep "Profiling: Total CPU" openmpscaling.$nt.out | awk '{print $6}'`
+   fdiff=`grep "state->finite_diff" openmpscaling.$nt.out | awk '{print $5}'`
+   rpot=`grep "mesh->refine_potential" openmpscaling.$nt.out | awk '{print $5}'`
+   if [ -z "$base" ]; then base=$total; fi
+   echo "$nt $total $fdiff $rpot $base" | awk '{printf "%7d  %13.4f  %15.4f  %14.4f  %7.2f\n", $1, $2, $3, $4, $5/$2}'
+done
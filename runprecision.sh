@@ -0,0 +1,21 @@
+#!/bin/sh
+# Precision comparison of the finite difference on a fixed problem. Runs the
+# same clamr_cpuonly with the double and the float kernels and prints the
+# finite difference time, the final mass change and the speedup over double.
+# Extra arguments are passed to clamr.
+#
+#   ./runprecision.sh -k -I
+
+PROBLEM="-n 256 -l 2 -t 500 -i 100"
+
+echo "./clamr_cpuonly $PROBLEM $@"
+echo "precision  finite diff (s)  mass change  speedup"
+
+base=""
+for prec in double float; do
+   ./clamr_cpuonly $PROBLEM -R $prec "$@" > precision.$prec.out 2>&1
+   fdiff=`grep "state->finite_diff" precision.$prec.out | awk '{print $5}'`
+   dmass=`grep "Mass Change" precision.$prec.out | tail -1 | awk '{print $NF}'`
+   if [ -z "$base" ]; then base=$fdiff; fi
+   echo "$prec $fdiff $dmass $base" | awk '{printf "%9s  %15.4f  %11.4g  %7.2f\n", $1, $2, $3, $4/$2}'
+done
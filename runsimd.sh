@@ -0,0 +1,24 @@
+#!/bin/sh
+# SIMD comparison of the finite difference on a fixed problem. Runs the same
+# clamr_cpuonly with the cells bucketed by level, first with the scalar loop
+# for the regular cells and then with the SIMD kernels for this processor, and
+# prints the cell updates per second, the final mass sum and the speedup over
+# scalar. Extra arguments are passed to clamr.
+#
+#   ./runsimd.sh -k -R float
+
+PROBLEM="-n 256 -l 2 -t 500 -i 100"
+
+echo "./clamr_cpuonly $PROBLEM $@"
+echo "  kernels  cell updates/s     mass sum  speedup"
+
+base=""
+for kernels in scalar simd; do
+   if [ $kernels = scalar ]; then flag=-j; else flag=-X; fi
+   ./clamr_cpuonly $PROBLEM $flag "$@" > simd.$kernels.out 2>&1
+   rate=`grep "cell updates per second" simd.$kernels.out | awk '{print $6}'`
+   isa=`grep "cell updates per second" simd.$kernels.out | awk '{print $9}'`
+   mass=`grep "Mass Sum" simd.$kernels.out | tail -1 | awk '{print $(NF-3)}'`
+   if [ -z "$base" ]; then base=$rate; fi
+   echo "$isa $rate $mass $base" | awk '{printf "%9s  %14.4g  %11s  %7.2f\n", $1, $2, $3, $2/$4}'
+done
@@ -65,6 +65,9 @@
 #ifdef HAVE_MPI
 #include <mpi.h>
 #endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #ifdef HAVE_REPROBLAS
 #ifdef __cplusplus
@@ -134,11 +137,26 @@ void kahan_sum(struct esum_type *in, struct esum_type *inout, int *len, MPI_Data
 #endif
 
 int save_ncells;
+extern int packed_neighbors;
+int face_fluxes = 0;
+int fused_timestep = 0;
+int interleaved_state = 0;
+int float_kernels = 0;
+int subcycling = 0;
+int activity_tracking = 0;
+int tiled_execution = 0;
+int level_buckets = 0;
+int simd_kernels = 0;
 
 #define CONSERVED_EQNS
 #define REFINE_GRADIENT  0.10
 #define COARSEN_GRADIENT 0.05
 
+#define QUIESCENT_TOLERANCE  1.0e-12  // Relative departure from rest of a cell skipped by activity tracking
+#define ACTIVE_STENCIL_DEPTH 2        // Neighbor steps the finite difference stencil reaches
+#define TILE_CELLS (16*TILE_SIZE)     // Cells in a tile of the tiled sweep, so its state and neighbors fit in L2
+#define SIMD_BLOCK 256                // Cells per pass of the SIMD loop, whose new values are held until the scatter
+
 #ifdef HAVE_CL_DOUBLE
 #define ZERO 0.0
 #define ONE 1.0
@@ -170,55 +188,64 @@ cl_kernel kernel_reduce_epsum_mass_stage1of2;
 cl_kernel kernel_reduce_epsum_mass_stage2of2;
 #endif
 
-inline real_t U_halfstep(// XXX Fix the subindices to be more intuitive XXX
-        real_t    deltaT,     // Timestep
-        real_t    U_i,        // Initial cell's (downwind's) state variable
-        real_t    U_n,        // Next cell's    (upwind's)   state variable
-        real_t    F_i,        // Initial cell's (downwind's) state variable flux
-        real_t    F_n,        // Next cell's    (upwind's)   state variable flux
-        real_t    r_i,        // Initial cell's (downwind's) center to face distance
-        real_t    r_n,        // Next cell's    (upwind's)   center to face distance
-        real_t    A_i,        // Cell's            face surface area
-        real_t    A_n,        // Cell's neighbor's face surface area
-        real_t    V_i,        // Cell's            volume
-        real_t    V_n) {      // Cell's neighbor's volume
+// The flux helpers are templated on the arithmetic type so the finite
+// difference can be instantiated in float and in double.
+template <class REAL>
+inline REAL U_halfstep(// XXX Fix the subindices to be more intuitive XXX
+        REAL      deltaT,     // Timestep
+        REAL      U_i,        // Initial cell's (downwind's) state variable
+        REAL      U_n,        // Next cell's    (upwind's)   state variable
+        REAL      F_i,        // Initial cell's (downwind's) state variable flux
+        REAL      F_n,        // Next cell's    (upwind's)   state variable flux
+        REAL      r_i,        // Initial cell's (downwind's) center to face distance
+        REAL      r_n,        // Next cell's    (upwind's)   center to face distance
+        REAL      A_i,        // Cell's            face surface area
+        REAL      A_n,        // Cell's neighbor's face surface area
+        REAL      V_i,        // Cell's            volume
+        REAL      V_n) {      // Cell's neighbor's volume
+
+   const REAL one = ONE, half = HALF;
 
    return (( r_i*U_n + r_n*U_i ) / ( r_i + r_n )) 
-          - HALF*deltaT*(( F_n*A_n*min(ONE, A_i/A_n) - F_i*A_i*min(ONE, A_n/A_i) )
-                    / ( V_n*min(HALF, V_i/V_n) + V_i*min(HALF, V_n/V_i) ));
+          - half*deltaT*(( F_n*A_n*min(one, A_i/A_n) - F_i*A_i*min(one, A_n/A_i) )
+                    / ( V_n*min(half, V_i/V_n) + V_i*min(half, V_n/V_i) ));
 
 }
 
-inline real_t U_fullstep(
-        real_t    deltaT,
-        real_t    dr,
-        real_t    U,
-        real_t    F_plus,
-        real_t    F_minus,
-        real_t    G_plus,
-        real_t    G_minus) {
+template <class REAL>
+inline REAL U_fullstep(
+        REAL      deltaT,
+        REAL      dr,
+        REAL      U,
+        REAL      F_plus,
+        REAL      F_minus,
+        REAL      G_plus,
+        REAL      G_minus) {
 
    return (U - (deltaT / dr)*(F_plus - F_minus + G_plus - G_minus));
 
 }
 
 
-inline real_t w_corrector(
-        real_t    deltaT,       // Timestep
-        real_t    dr,           // Cell's center to face distance
-        real_t    U_eigen,      // State variable's eigenvalue (speed)
-        real_t    grad_half,    // Centered gradient
-        real_t    grad_minus,   // Downwind gradient
-        real_t    grad_plus) {  // Upwind gradient
+template <class REAL>
+inline REAL w_corrector(
+        REAL      deltaT,       // Timestep
+        REAL      dr,           // Cell's center to face distance
+        REAL      U_eigen,      // State variable's eigenvalue (speed)
+        REAL      grad_half,    // Centered gradient
+        REAL      grad_minus,   // Downwind gradient
+        REAL      grad_plus) {  // Upwind gradient
+
+   const REAL zero = ZERO, one = ONE, half = HALF, epsilon = EPSILON;
 
-   real_t nu     = HALF * U_eigen * deltaT / dr;
-   nu          = nu * (ONE - nu);
+   REAL nu     = half * U_eigen * deltaT / dr;
+   nu          = nu * (one - nu);
 
-   real_t rdenom = ONE / max(SQR(grad_half), EPSILON);
-   real_t rplus  = (grad_plus  * grad_half) * rdenom;
-   real_t rminus = (grad_minus * grad_half) * rdenom;
+   REAL rdenom = one / max(SQR(grad_half), epsilon);
+   REAL rplus  = (grad_plus  * grad_half) * rdenom;
+   REAL rminus = (grad_minus * grad_half) * rdenom;
 
-   return HALF*nu*(ONE- max(MIN3(ONE, rplus, rminus), ZERO));
+   return half*nu*(one- max(MIN3(one, rplus, rminus), zero));
 
 }
 
@@ -243,6 +270,28 @@ State::State(Mesh *mesh_in)
 
    mesh = mesh_in;
 
+   next_deltaT        = 0.0;
+   next_deltaT_local  = 0.0;
+   next_deltaT_rezone = -1;
+   timestep_g         = 0.0;
+   timestep_sigma     = 0.0;
+   Active             = NULL;
+   active_cell_count  = 0;
+   active_cell_total  = 0;
+   tile_refine_ready  = 0;
+   tile_cell_count    = 0;
+   tile_cell_total    = 0;
+   subcycle_cell_updates   = 0;
+   subcycle_global_updates = 0;
+   fd_cell_updates    = 0;
+   fd_regular_updates = 0;
+#ifdef HAVE_MPI
+   next_deltaT_request = MPI_REQUEST_NULL;
+#endif
+#ifdef HAVE_MIXED_PRECISION
+   storage_mass_drift = 0.0;
+#endif
+
 #ifdef HAVE_MPI
    int mpi_init;
    MPI_Initialized(&mpi_init);
@@ -300,9 +349,17 @@ void State::allocate(size_t ncells){
    if (mesh->parallel) flags = LOAD_BALANCE_MEMORY;
 #endif
 
-   H = (real_t *)state_memory.memory_malloc(ncells, sizeof(real_t), flags, "H");
-   U = (real_t *)state_memory.memory_malloc(ncells, sizeof(real_t), flags, "U");
-   V = (real_t *)state_memory.memory_malloc(ncells, sizeof(real_t), flags, "V");
+   H = (state_t *)state_memory.memory_malloc(ncells, sizeof(state_t), flags, "H");
+   U = (state_t *)state_memory.memory_malloc(ncells, sizeof(state_t), flags, "U");
+   V = (state_t *)state_memory.memory_malloc(ncells, sizeof(state_t), flags, "V");
+
+   // Every cell starts out tracked
+   if (activity_tracking) {
+      Active = (state_t *)state_memory.memory_malloc(ncells, sizeof(state_t), flags, "Active");
+      for (uint ic=0; ic<ncells; ic++){
+         Active[ic] = 1.0;
+      }
+   }
 }
 
 void State::resize(size_t new_ncells){
@@ -315,9 +372,10 @@ void State::resize(size_t new_ncells){
 }
 
 void State::memory_reset_ptrs(void){
-   H = (real_t *)state_memory.get_memory_ptr("H");
-   U = (real_t *)state_memory.get_memory_ptr("U");
-   V = (real_t *)state_memory.get_memory_ptr("V");
+   H = (state_t *)state_memory.get_memory_ptr("H");
+   U = (state_t *)state_memory.get_memory_ptr("U");
+   V = (state_t *)state_memory.get_memory_ptr("V");
+   Active = (state_t *)state_memory.get_memory_ptr("Active");
 
    //printf("\nDEBUG -- Calling state memory reset_ptrs at line %d\n",__LINE__);
    //state_memory.memory_report();
@@ -329,6 +387,11 @@ void State::terminate(void)
    state_memory.memory_delete(H);
    state_memory.memory_delete(U);
    state_memory.memory_delete(V);
+   if (Active != NULL) state_memory.memory_delete(Active);
+   state_memory.memory_delete("H_new");
+   state_memory.memory_delete("U_new");
+   state_memory.memory_delete("V_new");
+   if (interleaved_state) state_memory.memory_delete("HUV");
 
 #ifdef HAVE_OPENCL
    ezcl_device_memory_delete(dev_deltaT);
@@ -411,9 +474,9 @@ void State::add_boundary_cells(void)
       
    int new_ncells = ncells + icount;
    // Increase the arrays for the new boundary cells
-   H=(real_t *)state_memory.memory_realloc(new_ncells, sizeof(real_t), H);
-   U=(real_t *)state_memory.memory_realloc(new_ncells, sizeof(real_t), U);
-   V=(real_t *)state_memory.memory_realloc(new_ncells, sizeof(real_t), V);
+   H=(state_t *)state_memory.memory_realloc(new_ncells, sizeof(state_t), H);
+   U=(state_t *)state_memory.memory_realloc(new_ncells, sizeof(state_t), U);
+   V=(state_t *)state_memory.memory_realloc(new_ncells, sizeof(state_t), V);
    //printf("\nDEBUG add_boundary cells\n"); 
    //state_memory.memory_report();
    //printf("DEBUG end add_boundary cells\n\n"); 
@@ -602,7 +665,11 @@ void State::apply_boundary_conditions_local(void)
    int *nbot = mesh->nbot;
    int *ntop = mesh->ntop;
 
-   // This is for a mesh with boundary cells
+   // This is for a mesh with boundary cells. Boundary cells only read from
+   // the real cell next to them so they can be filled in any order.
+#ifdef _OPENMP
+#pragma omp parallel for private(nl, nr, nb, nt)
+#endif
    for (uint ic=0; ic<ncells; ic++) {
       if (mesh->is_left_boundary(ic)) {
          nr = nrht[ic];
@@ -649,7 +716,11 @@ void State::apply_boundary_conditions_ghost(void)
    int *nbot = mesh->nbot;
    int *ntop = mesh->ntop;
 
-   // This is for a mesh with boundary cells
+   // This is for a mesh with boundary cells. Boundary cells only read from
+   // the real cell next to them so they can be filled in any order.
+#ifdef _OPENMP
+#pragma omp parallel for private(nl, nr, nb, nt)
+#endif
    for (uint ic=0; ic<ncells; ic++) {
       if (mesh->is_left_boundary(ic)) {
          nr = nrht[ic];
@@ -687,17 +758,28 @@ void State::apply_boundary_conditions_ghost(void)
 }
 
 void State::apply_boundary_conditions(void)
+{
+   apply_boundary_conditions_cells(NULL, mesh->ncells);
+}
+
+// Fills the boundary cells among the cells in cell_list, or among the first
+// ncell_list cells when cell_list is NULL.
+void State::apply_boundary_conditions_cells(const int *cell_list, int ncell_list)
 {
    int nl, nr, nb, nt;
 
-   size_t &ncells = mesh->ncells;
    int *nlft = mesh->nlft;
    int *nrht = mesh->nrht;
    int *nbot = mesh->nbot;
    int *ntop = mesh->ntop;
 
-   // This is for a mesh with boundary cells
-   for (uint ic=0; ic<ncells; ic++) {
+   // This is for a mesh with boundary cells. Boundary cells only read from
+   // the real cell next to them so they can be filled in any order.
+#ifdef _OPENMP
+#pragma omp parallel for private(nl, nr, nb, nt)
+#endif
+   for (int ilist=0; ilist<ncell_list; ilist++) {
+      int ic = (cell_list != NULL) ? cell_list[ilist] : ilist;
       if (mesh->is_left_boundary(ic)) {
          nr = nrht[ic];
          H[ic] =  H[nr];
@@ -747,9 +829,9 @@ void State::remove_boundary_cells(void)
 
    // Resize to drop all the boundary cells
    ncells = save_ncells;
-   H=(real_t *)state_memory.memory_realloc(save_ncells, sizeof(real_t), H);
-   U=(real_t *)state_memory.memory_realloc(save_ncells, sizeof(real_t), U);
-   V=(real_t *)state_memory.memory_realloc(save_ncells, sizeof(real_t), V);
+   H=(state_t *)state_memory.memory_realloc(save_ncells, sizeof(state_t), H);
+   U=(state_t *)state_memory.memory_realloc(save_ncells, sizeof(state_t), U);
+   V=(state_t *)state_memory.memory_realloc(save_ncells, sizeof(state_t), V);
    //printf("\nDEBUG remove_boundary cells\n"); 
    //state_memory.memory_report();
    //printf("DEBUG end remove_boundary cells\n\n"); 
@@ -787,6 +869,15 @@ void State::remove_boundary_cells(void)
 
 }
 
+// Completes the reduction of the next timestep across processors started at
+// the end of calc_finite_difference.
+void State::wait_next_deltaT(void)
+{
+#ifdef HAVE_MPI
+   if (next_deltaT_request != MPI_REQUEST_NULL) MPI_Wait(&next_deltaT_request, MPI_STATUS_IGNORE);
+#endif
+}
+
 double State::set_timestep(double g, double sigma)
 {
    int lev;
@@ -797,6 +888,19 @@ double State::set_timestep(double g, double sigma)
 
    cpu_timer_start(&tstart_cpu);
 
+   // With the fused timestep the finite difference has already found it,
+   // unless the mesh has been rezoned since. Subcycled steps and activity
+   // tracking, which steps fewer cells than it has to check, always reduce here
+   if (fused_timestep && ! subcycling && ! activity_tracking) {
+      wait_next_deltaT();
+      if (next_deltaT_rezone == mesh->cpu_rezone_counter && g == timestep_g && sigma == timestep_sigma) {
+         cpu_time_set_timestep += cpu_timer_stop(tstart_cpu);
+         return(next_deltaT);
+      }
+      timestep_g     = g;
+      timestep_sigma = sigma;
+   }
+
    size_t &ncells        = mesh->ncells;
 #ifdef HAVE_MPI
    int &parallel         = mesh->parallel;
@@ -805,21 +909,18 @@ double State::set_timestep(double g, double sigma)
    int *&level    = mesh->level;
 
    int ic;
-#ifdef HAVE_OPENMP
-#ifdef __INTEL_COMPILER
-//#if (_OPENMP > 200600)
 #ifdef _OPENMP
-#pragma omp parallel for private(ic) reduction(min:mindeltaT)
-#endif
-#endif
+#pragma omp parallel for private(ic, lev, wavespeed, xspeed, yspeed, deltaT) reduction(min:mindeltaT)
 #endif
    for (ic=0; ic<(int)ncells; ic++) {
-      if (celltype[ic] == REAL_CELL) {
+      if (celltype[ic] == REAL_CELL && (Active == NULL || Active[ic] != 0.0)) {
          lev = level[ic];
          wavespeed = sqrt(g*H[ic]);
          xspeed = (fabs(U[ic])+wavespeed)/mesh->lev_deltax[lev];
          yspeed = (fabs(V[ic])+wavespeed)/mesh->lev_deltay[lev];
          deltaT=sigma/(xspeed+yspeed);
+         // Subcycled, a level steps by the timestep of level 0 halved per level
+         if (subcycling) deltaT *= (double)(1 << lev);
          if (deltaT < mindeltaT) mindeltaT = deltaT;
       }
    }
@@ -973,9 +1074,10 @@ void State::fill_circle(double  circ_radius,//  Radius of circle in grid units.
 
 void State::state_reorder(vector<int> iorder)
 {
-   H = state_memory.memory_reorder(H, &iorder[0]);
-   U = state_memory.memory_reorder(U, &iorder[0]);
-   V = state_memory.memory_reorder(V, &iorder[0]);
+   H = (state_t *)state_memory.memory_reorder(H, &iorder[0]);
+   U = (state_t *)state_memory.memory_reorder(U, &iorder[0]);
+   V = (state_t *)state_memory.memory_reorder(V, &iorder[0]);
+   if (Active != NULL) Active = (state_t *)state_memory.memory_reorder(Active, &iorder[0]);
    //printf("\nDEBUG reorder cells\n"); 
    //state_memory.memory_report();
    //printf("DEBUG end reorder cells\n\n"); 
@@ -1091,85 +1193,135 @@ void State::gpu_rezone_all(int icount, int jcount, bool localStencil)
 #define VUNEWFLUXMINUS2  ( Vyminus2*Uyminus2/Hyminus2 )
 #define VUNEWFLUXPLUS2   ( Vyplus2 *Uyplus2 /Hyplus2 )
 
-void State::calc_finite_difference(double deltaT){
-   double   g     = 9.80;   // gravitational constant
-   double   ghalf = 0.5*g;
-
-   struct timeval tstart_cpu;
-
-   cpu_timer_start(&tstart_cpu);
-
-   size_t &ncells     = mesh->ncells;
-   size_t &ncells_ghost = mesh->ncells_ghost;
-   if (ncells_ghost < ncells) ncells_ghost = ncells;
+// Face loop of the face-based finite difference. Computes the half-step
+// H, U, V and their fluxes once for each face in the mesh face list, with
+// the same expressions the cell loop uses for either side of the face.
+template <class REAL>
+void State::calc_face_fluxes(double deltaT)
+{
+   REAL     g     = 9.80;   // gravitational constant
+   REAL     ghalf = 0.5*g;
 
-   //printf("\nDEBUG finite diff\n"); 
+   int *level = mesh->level;
 
-#ifdef HAVE_MPI
-   // We need to populate the ghost regions since the calc neighbors has just been
-   // established for the mesh shortly before
-   if (mesh->numpe > 1) {
-      apply_boundary_conditions_local();
+   vector<real_t> &lev_deltax = mesh->lev_deltax;
+   vector<real_t> &lev_deltay = mesh->lev_deltay;
 
-      H=(real_t *)state_memory.memory_realloc(ncells_ghost, sizeof(real_t), H);
-      U=(real_t *)state_memory.memory_realloc(ncells_ghost, sizeof(real_t), U);
-      V=(real_t *)state_memory.memory_realloc(ncells_ghost, sizeof(real_t), V);
+   int nxface = mesh->nxface;
+   int nyface = mesh->nyface;
+   if (xface_flux.size() < 6*(size_t)nxface) xface_flux.resize(6*nxface);
+   if (yface_flux.size() < 6*(size_t)nyface) yface_flux.resize(6*nyface);
 
-      L7_Update(&H[0], L7_REAL, mesh->cell_handle);
-      L7_Update(&U[0], L7_REAL, mesh->cell_handle);
-      L7_Update(&V[0], L7_REAL, mesh->cell_handle);
+   const int *xface_lo = &mesh->xface_lo[0];
+   const int *xface_hi = &mesh->xface_hi[0];
+   const int *yface_lo = &mesh->yface_lo[0];
+   const int *yface_hi = &mesh->yface_hi[0];
+   double *xflux = &xface_flux[0];
+   double *yflux = &yface_flux[0];
 
-      apply_boundary_conditions_ghost();
-   } else {
-      apply_boundary_conditions();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+   for (int iface = 0; iface < nxface; iface++){
+      int nl = xface_lo[iface];
+      int nr = xface_hi[iface];
+
+      REAL Hl = H[nl], Ul = U[nl], Vl = V[nl];
+      REAL Hr = H[nr], Ur = U[nr], Vr = V[nr];
+      REAL dxl = lev_deltax[level[nl]];
+      REAL dxr = lev_deltax[level[nr]];
+
+      REAL Hxminus = U_halfstep<REAL>(deltaT, Hl, Hr, HXFLUXNL, HXFLUXNR,
+                                  dxl, dxr, dxl, dxr, SQR(dxl), SQR(dxr));
+      REAL Uxminus = U_halfstep<REAL>(deltaT, Ul, Ur, UXFLUXNL, UXFLUXNR,
+                                  dxl, dxr, dxl, dxr, SQR(dxl), SQR(dxr));
+      REAL Vxminus = U_halfstep<REAL>(deltaT, Vl, Vr, UVFLUXNL, UVFLUXNR,
+                                  dxl, dxr, dxl, dxr, SQR(dxl), SQR(dxr));
+
+      double *f = &xflux[6*iface];
+      f[0] = Hxminus;
+      f[1] = Uxminus;
+      f[2] = Vxminus;
+      f[3] = HNEWXFLUXMINUS;
+      f[4] = UNEWXFLUXMINUS;
+      f[5] = UVNEWFLUXMINUS;
    }
-#else
-   apply_boundary_conditions();
+
+#ifdef _OPENMP
+#pragma omp parallel for
 #endif
+   for (int iface = 0; iface < nyface; iface++){
+      int nb = yface_lo[iface];
+      int nt = yface_hi[iface];
+
+      REAL Hb = H[nb], Ub = U[nb], Vb = V[nb];
+      REAL Ht = H[nt], Ut = U[nt], Vt = V[nt];
+      REAL dyb = lev_deltay[level[nb]];
+      REAL dyt = lev_deltay[level[nt]];
+
+      REAL Hyminus = U_halfstep<REAL>(deltaT, Hb, Ht, HYFLUXNB, HYFLUXNT,
+                                  dyb, dyt, dyb, dyt, SQR(dyb), SQR(dyt));
+      REAL Uyminus = U_halfstep<REAL>(deltaT, Ub, Ut, VUFLUXNB, VUFLUXNT,
+                                  dyb, dyt, dyb, dyt, SQR(dyb), SQR(dyt));
+      REAL Vyminus = U_halfstep<REAL>(deltaT, Vb, Vt, VYFLUXNB, VYFLUXNT,
+                                  dyb, dyt, dyb, dyt, SQR(dyb), SQR(dyt));
+
+      double *f = &yflux[6*iface];
+      f[0] = Hyminus;
+      f[1] = Uyminus;
+      f[2] = Vyminus;
+      f[3] = HNEWYFLUXMINUS;
+      f[4] = VUNEWFLUXMINUS;
+      f[5] = VNEWYFLUXMINUS;
+   }
+}
+
+// Cell loop of calc_finite_difference, computed in REAL arithmetic whatever
+// the storage type of the state. It runs over the cells in cell_list, or over
+// the first ncell_list cells when cell_list is NULL. NEIGH reads the neighbor indices either
+// from the mesh's separate arrays or from its packed per-cell records, and
+// STATEV reads H, U and V from the state arrays or from interleaved records. With
+// FACES set the half-step values and fluxes are gathered from the face pass
+// rather than computed for each side of every cell. With the fused timestep
+// it returns the smallest timestep of the new values over the real cells,
+// worked out the same way as set_timestep. When subcycling, each cell steps
+// with the timestep of its level and adds what crosses its coarse/fine faces
+// into the flux register. With REGULAR set every cell in the list is one of
+// the mesh's regular cells, and the refinement jump cases are compiled out.
+template <class REAL, class NEIGH, class STATEV, int FACES, int REGULAR>
+double State::calc_finite_difference_cells(double deltaT_cycle, const int *cell_list, int ncell_list,
+                                           NEIGH nlft, NEIGH nrht, NEIGH nbot, NEIGH ntop,
+                                           STATEV H, STATEV U, STATEV V,
+                                           state_t *H_new, state_t *U_new, state_t *V_new)
+{
+   REAL     g     = 9.80;   // gravitational constant
+   REAL     ghalf = 0.5*g;
+   const REAL half = HALF;
 
-   int *nlft  = mesh->nlft;
-   int *nrht  = mesh->nrht;
-   int *nbot  = mesh->nbot;
-   int *ntop  = mesh->ntop;
    int *level = mesh->level;
+   int *celltype = mesh->celltype;
 
    vector<real_t> &lev_deltax = mesh->lev_deltax;
    vector<real_t> &lev_deltay = mesh->lev_deltay;
 
-   int flags = 0;
-#if defined (HAVE_J7)
-   if (mesh->parallel) flags = LOAD_BALANCE_MEMORY;
-#endif
-   real_t *H_new = (real_t *)state_memory.memory_malloc(ncells_ghost,
-                                                        sizeof(real_t),
-                                                        flags,
-                                                        "H_new");
-   real_t *U_new = (real_t *)state_memory.memory_malloc(ncells_ghost,
-                                                        sizeof(real_t),
-                                                        flags,
-                                                        "U_new");
-   real_t *V_new = (real_t *)state_memory.memory_malloc(ncells_ghost,
-                                                        sizeof(real_t),
-                                                        flags,
-                                                        "V_new");
-
-   int gix;
-#ifdef HAVE_OPENMP
-#ifdef __INTEL_COMPILER
-#ifdef _OPENMP
-#pragma omp parallel for \
-      private(gix) \
-      shared(deltaT, g, ghalf, H_new, U_new, V_new, ncells, level, nlft, nrht, nbot, ntop, lev_deltax, lev_deltay) \
-      default(none)
-#else
-#pragma omp parallel for \
-      private(gix) \
-      shared(deltaT, g, ghalf, H_new, U_new, V_new) \
-      default(none)
-#endif
+   int do_timestep = (fused_timestep && timestep_sigma > 0.0);
+   double mindeltaT = 1000.0;
+#ifdef HAVE_MIXED_PRECISION
+   double storage_drift = 0.0;
 #endif
+
+   const double *lev_dt = subcycling ? &lev_deltaT[0] : NULL;
+   double *flux_reg = subcycling ? &flux_register[0] : NULL;
+
+   int ilist;
+#if defined(_OPENMP) && defined(HAVE_MIXED_PRECISION)
+#pragma omp parallel for private(ilist) reduction(min:mindeltaT) reduction(+:storage_drift)
+#elif defined(_OPENMP)
+#pragma omp parallel for private(ilist) reduction(min:mindeltaT)
 #endif
-   for(gix = 0; gix < (int)ncells; gix++) {
+   for(ilist = 0; ilist < ncell_list; ilist++) {
+      int gix = (cell_list != NULL) ? cell_list[ilist] : ilist;
+
 #ifdef DEBUG
       printf("%d: DEBUG gix is %d at line %d in file %s\n",mesh->mype,gix,__LINE__,__FILE__);
 #endif
@@ -1180,44 +1332,46 @@ void State::calc_finite_difference(double deltaT){
       int nt      = ntop[gix];
       int nb      = nbot[gix];
 
+      double deltaT = (lev_dt != NULL) ? lev_dt[lvl] : deltaT_cycle;
+
 #ifdef DEBUG
       if (gix < 0 || gix >= H.size() ) printf("%d: Problem at file %s line %d with gix %d\n",mesh->mype,__FILE__,__LINE__,gix);
 #endif
-      double Hic     = H[gix];
-      double Uic     = U[gix];
-      double Vic     = V[gix];
+      REAL Hic     = H[gix];
+      REAL Uic     = U[gix];
+      REAL Vic     = V[gix];
 
 #ifdef DEBUG
       if (nl < 0 || nl >= H.size() ) printf("%d: Problem at file %s line %d with nl %ld\n",mesh->mype,__FILE__,__LINE__,nl);
 #endif
       int nll     = nlft[nl];
-      double Hl      = H[nl];
-      double Ul      = U[nl];
-      double Vl      = V[nl];
+      REAL Hl      = H[nl];
+      REAL Ul      = U[nl];
+      REAL Vl      = V[nl];
 
 #ifdef DEBUG
       if (nr < 0 || nr >= H.size() ) printf("%d: Problem at file %s line %d with nr %ld\n",mesh->mype,__FILE__,__LINE__,nr);
 #endif
       int nrr     = nrht[nr];
-      double Hr      = H[nr];
-      double Ur      = U[nr];
-      double Vr      = V[nr];
+      REAL Hr      = H[nr];
+      REAL Ur      = U[nr];
+      REAL Vr      = V[nr];
 
 #ifdef DEBUG
       if (nt < 0 || nt >= H.size() ) printf("%d: Problem at file %s line %d with nt %ld\n",mesh->mype,__FILE__,__LINE__,nt);
 #endif
       int ntt     = ntop[nt];
-      double Ht      = H[nt];
-      double Ut      = U[nt];
-      double Vt      = V[nt];
+      REAL Ht      = H[nt];
+      REAL Ut      = U[nt];
+      REAL Vt      = V[nt];
 
 #ifdef DEBUG
       if (nb < 0 || nb >= H.size() ) printf("%d: Problem at file %s line %d with nb %ld\n",mesh->mype,__FILE__,__LINE__,nb);
 #endif
       int nbb     = nbot[nb];
-      double Hb      = H[nb];
-      double Ub      = U[nb];
-      double Vb      = V[nb];
+      REAL Hb      = H[nb];
+      REAL Ub      = U[nb];
+      REAL Vb      = V[nb];
 
       int nlt     = ntop[nl];
       int nrt     = ntop[nr];
@@ -1227,55 +1381,55 @@ void State::calc_finite_difference(double deltaT){
 #ifdef DEBUG
       if (nll < 0 || nll >= H.size() ) printf("%d: Problem at file %s line %d with nll %ld\n",mesh->mype,__FILE__,__LINE__,nll);
 #endif
-      double Hll     = H[nll];
-      double Ull     = U[nll];
+      REAL Hll     = H[nll];
+      REAL Ull     = U[nll];
       //double Vll     = V[nll];
 
 #ifdef DEBUG
       if (nrr < 0 || nrr >= H.size() ) printf("%d: Problem at file %s line %d with nrr %ld\n",mesh->mype,__FILE__,__LINE__,nrr);
 #endif
-      double Hrr     = H[nrr];
-      double Urr     = U[nrr];
+      REAL Hrr     = H[nrr];
+      REAL Urr     = U[nrr];
       //double Vrr     = V[nrr];
 
 #ifdef DEBUG
       if (ntt < 0 || ntt >= H.size() ) printf("%d: Problem at file %s line %d with ntt %ld\n",mesh->mype,__FILE__,__LINE__,ntt);
 #endif
-      double Htt     = H[ntt];
+      REAL Htt     = H[ntt];
       //double Utt     = U[ntt];
-      double Vtt     = V[ntt];
+      REAL Vtt     = V[ntt];
 
 #ifdef DEBUG
       if (nbb < 0 || nbb >= H.size() ) {printf("%d: Problem at file %s line %d ic %d %d with nbb %ld\n",mesh->mype,__FILE__,__LINE__,gix,gix+mesh->noffset,nbb); sleep(15); }
 #endif
-      double Hbb     = H[nbb];
+      REAL Hbb     = H[nbb];
       //double Ubb     = U[nbb];
-      double Vbb     = V[nbb];
+      REAL Vbb     = V[nbb];
 
 #ifdef DEBUG
       if (lvl < 0 || lvl >= (int)lev_deltax.size() ) printf("%d: Problem at file %s line %d with lvl %d\n",mesh->mype,__FILE__,__LINE__,lvl);
 #endif
-      double dxic    = lev_deltax[lvl];
-      double dyic    = lev_deltay[lvl];
+      REAL dxic    = lev_deltax[lvl];
+      REAL dyic    = lev_deltay[lvl];
 
-      double dxl     = lev_deltax[level[nl]];
-      double dxr     = lev_deltax[level[nr]];
+      REAL dxl     = REGULAR ? dxic : lev_deltax[level[nl]];
+      REAL dxr     = REGULAR ? dxic : lev_deltax[level[nr]];
 
-      double dyt     = lev_deltay[level[nt]];
-      double dyb     = lev_deltay[level[nb]];
+      REAL dyt     = REGULAR ? dyic : lev_deltay[level[nt]];
+      REAL dyb     = REGULAR ? dyic : lev_deltay[level[nb]];
 
-      double drl     = dxl;
-      double drr     = dxr;
-      double drt     = dyt;
-      double drb     = dyb;
+      REAL drl     = dxl;
+      REAL drr     = dxr;
+      REAL drt     = dyt;
+      REAL drb     = dyb;
 
-      double dric    = dxic;
+      REAL dric    = dxic;
 
       int nltl = 0;
-      double Hlt = 0.0, Ult = 0.0, Vlt = 0.0;
-      double Hll2 = 0.0;
-      double Ull2 = 0.0;
-      if(lvl < level[nl]) {
+      REAL Hlt = 0.0, Ult = 0.0, Vlt = 0.0;
+      REAL Hll2 = 0.0;
+      REAL Ull2 = 0.0;
+      if(! REGULAR && lvl < level[nl]) {
 #ifdef DEBUG
          if (nlt < 0 || nlt > H.size() ) printf("%d: Problem at file %s line %d with nlt %ld\n",mesh->mype,__FILE__,__LINE__,nlt);
 #endif
@@ -1291,10 +1445,10 @@ void State::calc_finite_difference(double deltaT){
       }
 
       int nrtr = 0;
-      double Hrt = 0.0, Urt = 0.0, Vrt = 0.0;
-      double Hrr2 = 0.0;
-      double Urr2 = 0.0;
-      if(lvl < level[nr]) {
+      REAL Hrt = 0.0, Urt = 0.0, Vrt = 0.0;
+      REAL Hrr2 = 0.0;
+      REAL Urr2 = 0.0;
+      if(! REGULAR && lvl < level[nr]) {
 #ifdef DEBUG
          if (nrt < 0 || nrt > H.size() ) printf("%d: Problem at file %s line %d with nrt %ld\n",mesh->mype,__FILE__,__LINE__,nrt);
 #endif
@@ -1310,10 +1464,10 @@ void State::calc_finite_difference(double deltaT){
       }
 
       int nbrb = 0;
-      double Hbr = 0.0, Ubr = 0.0, Vbr = 0.0;
-      double Hbb2 = 0.0;
-      double Vbb2 = 0.0;
-      if(lvl < level[nb]) {
+      REAL Hbr = 0.0, Ubr = 0.0, Vbr = 0.0;
+      REAL Hbb2 = 0.0;
+      REAL Vbb2 = 0.0;
+      if(! REGULAR && lvl < level[nb]) {
 #ifdef DEBUG
          if (nbr < 0 || nbr > H.size() ) printf("%d: Problem at file %s line %d with nbr %ld\n",mesh->mype,__FILE__,__LINE__,nbr);
 #endif
@@ -1329,10 +1483,10 @@ void State::calc_finite_difference(double deltaT){
       }
 
       int ntrt = 0;
-      double Htr = 0.0, Utr = 0.0, Vtr = 0.0;
-      double Htt2 = 0.0;
-      double Vtt2 = 0.0;
-      if(lvl < level[nt]) {
+      REAL Htr = 0.0, Utr = 0.0, Vtr = 0.0;
+      REAL Htt2 = 0.0;
+      REAL Vtt2 = 0.0;
+      if(! REGULAR && lvl < level[nt]) {
 #ifdef DEBUG
          if (ntr < 0 || ntr > H.size() ) printf("%d: Problem at file %s line %d with ntr %ld\n",mesh->mype,__FILE__,__LINE__,ntr);
 #endif
@@ -1348,452 +1502,1574 @@ void State::calc_finite_difference(double deltaT){
       }
 
 
-      double Hxminus = U_halfstep(deltaT, Hl, Hic, HXFLUXNL, HXFLUXIC,
-                           dxl, dxic, dxl, dxic, SQR(dxl), SQR(dxic));
-      double Uxminus = U_halfstep(deltaT, Ul, Uic, UXFLUXNL, UXFLUXIC,
-                           dxl, dxic, dxl, dxic, SQR(dxl), SQR(dxic));
-      double Vxminus = U_halfstep(deltaT, Vl, Vic, UVFLUXNL, UVFLUXIC,
-                           dxl, dxic, dxl, dxic, SQR(dxl), SQR(dxic));
-
-      double Hxplus  = U_halfstep(deltaT, Hic, Hr, HXFLUXIC, HXFLUXNR,
-                           dxic, dxr, dxic, dxr, SQR(dxic), SQR(dxr));
-      double Uxplus  = U_halfstep(deltaT, Uic, Ur, UXFLUXIC, UXFLUXNR,
-                           dxic, dxr, dxic, dxr, SQR(dxic), SQR(dxr));
-      double Vxplus  = U_halfstep(deltaT, Vic, Vr, UVFLUXIC, UVFLUXNR,
-                           dxic, dxr, dxic, dxr, SQR(dxic), SQR(dxr));
-
-      double Hyminus = U_halfstep(deltaT, Hb, Hic, HYFLUXNB, HYFLUXIC,
-                           dyb, dyic, dyb, dyic, SQR(dyb), SQR(dyic));
-      double Uyminus = U_halfstep(deltaT, Ub, Uic, VUFLUXNB, VUFLUXIC,
-                           dyb, dyic, dyb, dyic, SQR(dyb), SQR(dyic));
-      double Vyminus = U_halfstep(deltaT, Vb, Vic, VYFLUXNB, VYFLUXIC,
-                           dyb, dyic, dyb, dyic, SQR(dyb), SQR(dyic));
-
-      double Hyplus  = U_halfstep(deltaT, Hic, Ht, HYFLUXIC, HYFLUXNT,
-                           dyic, dyt, dyic, dyt, SQR(dyic), SQR(dyt));
-      double Uyplus  = U_halfstep(deltaT, Uic, Ut, VUFLUXIC, VUFLUXNT,
-                           dyic, dyt, dyic, dyt, SQR(dyic), SQR(dyt));
-      double Vyplus  = U_halfstep(deltaT, Vic, Vt, VYFLUXIC, VYFLUXNT,
-                           dyic, dyt, dyic, dyt, SQR(dyic), SQR(dyt));
-
-      double Hxfluxminus = HNEWXFLUXMINUS;
-      double Uxfluxminus = UNEWXFLUXMINUS;
-      double Vxfluxminus = UVNEWFLUXMINUS;
-
-      double Hxfluxplus  = HNEWXFLUXPLUS;
-      double Uxfluxplus  = UNEWXFLUXPLUS;
-      double Vxfluxplus  = UVNEWFLUXPLUS;
-
-      double Hyfluxminus = HNEWYFLUXMINUS;
-      double Uyfluxminus = VUNEWFLUXMINUS;
-      double Vyfluxminus = VNEWYFLUXMINUS;
-
-      double Hyfluxplus  = HNEWYFLUXPLUS;
-      double Uyfluxplus  = VUNEWFLUXPLUS;
-      double Vyfluxplus  = VNEWYFLUXPLUS;
-
-      double Hxminus2 = 0.0;
-      double Uxminus2 = 0.0;
-      double Vxminus2 = 0.0;
-      if(lvl < level[nl]) {
-
-         Hxminus2 = U_halfstep(deltaT, Hlt, Hic, HXFLUXNLT, HXFLUXIC,
-                               drl, dric, drl, dric, SQR(drl), SQR(dric));
-         Uxminus2 = U_halfstep(deltaT, Ult, Uic, UXFLUXNLT, UXFLUXIC,
-                               drl, dric, drl, dric, SQR(drl), SQR(dric));
-         Vxminus2 = U_halfstep(deltaT, Vlt, Vic, UVFLUXNLT, UVFLUXIC,
-                               drl, dric, drl, dric, SQR(drl), SQR(dric));
+      REAL Hxminus, Uxminus, Vxminus, Hxplus, Uxplus, Vxplus;
+      REAL Hyminus, Uyminus, Vyminus, Hyplus, Uyplus, Vyplus;
+      REAL Hxfluxminus, Uxfluxminus, Vxfluxminus, Hxfluxplus, Uxfluxplus, Vxfluxplus;
+      REAL Hyfluxminus, Uyfluxminus, Vyfluxminus, Hyfluxplus, Uyfluxplus, Vyfluxplus;
+      REAL Hxminus2 = 0.0, Uxminus2 = 0.0, Vxminus2 = 0.0, Hxplus2 = 0.0, Uxplus2 = 0.0, Vxplus2 = 0.0;
+      REAL Hyminus2 = 0.0, Uyminus2 = 0.0, Vyminus2 = 0.0, Hyplus2 = 0.0, Uyplus2 = 0.0, Vyplus2 = 0.0;
+
+      if (FACES) {
+         // Half-step values and fluxes come from the face pass; the second
+         // face against finer neighbors is found through the upper or right
+         // fine cell.
+         const double *fxm = &xface_flux[6*mesh->map_xface_lft[gix]];
+         const double *fxp = &xface_flux[6*mesh->map_xface_rht[gix]];
+         const double *fym = &yface_flux[6*mesh->map_yface_bot[gix]];
+         const double *fyp = &yface_flux[6*mesh->map_yface_top[gix]];
+
+         Hxminus = fxm[0]; Uxminus = fxm[1]; Vxminus = fxm[2];
+         Hxplus  = fxp[0]; Uxplus  = fxp[1]; Vxplus  = fxp[2];
+         Hyminus = fym[0]; Uyminus = fym[1]; Vyminus = fym[2];
+         Hyplus  = fyp[0]; Uyplus  = fyp[1]; Vyplus  = fyp[2];
+
+         Hxfluxminus = fxm[3]; Uxfluxminus = fxm[4]; Vxfluxminus = fxm[5];
+         Hxfluxplus  = fxp[3]; Uxfluxplus  = fxp[4]; Vxfluxplus  = fxp[5];
+         Hyfluxminus = fym[3]; Uyfluxminus = fym[4]; Vyfluxminus = fym[5];
+         Hyfluxplus  = fyp[3]; Uyfluxplus  = fyp[4]; Vyfluxplus  = fyp[5];
+
+         if(! REGULAR && lvl < level[nl]) {
+            const double *f2 = &xface_flux[6*mesh->map_xface_rht[nlt]];
+            Hxminus2 = f2[0]; Uxminus2 = f2[1]; Vxminus2 = f2[2];
+            Hxfluxminus = (Hxfluxminus + f2[3]) * half;
+            Uxfluxminus = (Uxfluxminus + f2[4]) * half;
+            Vxfluxminus = (Vxfluxminus + f2[5]) * half;
+         }
+         if(! REGULAR && lvl < level[nr]) {
+            const double *f2 = &xface_flux[6*mesh->map_xface_lft[nrt]];
+            Hxplus2 = f2[0]; Uxplus2 = f2[1]; Vxplus2 = f2[2];
+            Hxfluxplus  = (Hxfluxplus + f2[3]) * half;
+            Uxfluxplus  = (Uxfluxplus + f2[4]) * half;
+            Vxfluxplus  = (Vxfluxplus + f2[5]) * half;
+         }
+         if(! REGULAR && lvl < level[nb]) {
+            const double *f2 = &yface_flux[6*mesh->map_yface_top[nbr]];
+            Hyminus2 = f2[0]; Uyminus2 = f2[1]; Vyminus2 = f2[2];
+            Hyfluxminus = (Hyfluxminus + f2[3]) * half;
+            Uyfluxminus = (Uyfluxminus + f2[4]) * half;
+            Vyfluxminus = (Vyfluxminus + f2[5]) * half;
+         }
+         if(! REGULAR && lvl < level[nt]) {
+            const double *f2 = &yface_flux[6*mesh->map_yface_bot[ntr]];
+            Hyplus2 = f2[0]; Uyplus2 = f2[1]; Vyplus2 = f2[2];
+            Hyfluxplus  = (Hyfluxplus + f2[3]) * half;
+            Uyfluxplus  = (Uyfluxplus + f2[4]) * half;
+            Vyfluxplus  = (Vyfluxplus + f2[5]) * half;
+         }
+      } else {
 
-         Hxfluxminus = (Hxfluxminus + HNEWXFLUXMINUS2) * HALF;
-         Uxfluxminus = (Uxfluxminus + UNEWXFLUXMINUS2) * HALF;
-         Vxfluxminus = (Vxfluxminus + UVNEWFLUXMINUS2) * HALF;
+         Hxminus = U_halfstep<REAL>(deltaT, Hl, Hic, HXFLUXNL, HXFLUXIC,
+                              dxl, dxic, dxl, dxic, SQR(dxl), SQR(dxic));
+         Uxminus = U_halfstep<REAL>(deltaT, Ul, Uic, UXFLUXNL, UXFLUXIC,
+                              dxl, dxic, dxl, dxic, SQR(dxl), SQR(dxic));
+         Vxminus = U_halfstep<REAL>(deltaT, Vl, Vic, UVFLUXNL, UVFLUXIC,
+                              dxl, dxic, dxl, dxic, SQR(dxl), SQR(dxic));
+
+         Hxplus  = U_halfstep<REAL>(deltaT, Hic, Hr, HXFLUXIC, HXFLUXNR,
+                              dxic, dxr, dxic, dxr, SQR(dxic), SQR(dxr));
+         Uxplus  = U_halfstep<REAL>(deltaT, Uic, Ur, UXFLUXIC, UXFLUXNR,
+                              dxic, dxr, dxic, dxr, SQR(dxic), SQR(dxr));
+         Vxplus  = U_halfstep<REAL>(deltaT, Vic, Vr, UVFLUXIC, UVFLUXNR,
+                              dxic, dxr, dxic, dxr, SQR(dxic), SQR(dxr));
+
+         Hyminus = U_halfstep<REAL>(deltaT, Hb, Hic, HYFLUXNB, HYFLUXIC,
+                              dyb, dyic, dyb, dyic, SQR(dyb), SQR(dyic));
+         Uyminus = U_halfstep<REAL>(deltaT, Ub, Uic, VUFLUXNB, VUFLUXIC,
+                              dyb, dyic, dyb, dyic, SQR(dyb), SQR(dyic));
+         Vyminus = U_halfstep<REAL>(deltaT, Vb, Vic, VYFLUXNB, VYFLUXIC,
+                              dyb, dyic, dyb, dyic, SQR(dyb), SQR(dyic));
+
+         Hyplus  = U_halfstep<REAL>(deltaT, Hic, Ht, HYFLUXIC, HYFLUXNT,
+                              dyic, dyt, dyic, dyt, SQR(dyic), SQR(dyt));
+         Uyplus  = U_halfstep<REAL>(deltaT, Uic, Ut, VUFLUXIC, VUFLUXNT,
+                              dyic, dyt, dyic, dyt, SQR(dyic), SQR(dyt));
+         Vyplus  = U_halfstep<REAL>(deltaT, Vic, Vt, VYFLUXIC, VYFLUXNT,
+                              dyic, dyt, dyic, dyt, SQR(dyic), SQR(dyt));
+
+         Hxfluxminus = HNEWXFLUXMINUS;
+         Uxfluxminus = UNEWXFLUXMINUS;
+         Vxfluxminus = UVNEWFLUXMINUS;
+
+         Hxfluxplus  = HNEWXFLUXPLUS;
+         Uxfluxplus  = UNEWXFLUXPLUS;
+         Vxfluxplus  = UVNEWFLUXPLUS;
+
+         Hyfluxminus = HNEWYFLUXMINUS;
+         Uyfluxminus = VUNEWFLUXMINUS;
+         Vyfluxminus = VNEWYFLUXMINUS;
+
+         Hyfluxplus  = HNEWYFLUXPLUS;
+         Uyfluxplus  = VUNEWFLUXPLUS;
+         Vyfluxplus  = VNEWYFLUXPLUS;
+
+         if(! REGULAR && lvl < level[nl]) {
+
+            Hxminus2 = U_halfstep<REAL>(deltaT, Hlt, Hic, HXFLUXNLT, HXFLUXIC,
+                                  drl, dric, drl, dric, SQR(drl), SQR(dric));
+            Uxminus2 = U_halfstep<REAL>(deltaT, Ult, Uic, UXFLUXNLT, UXFLUXIC,
+                                  drl, dric, drl, dric, SQR(drl), SQR(dric));
+            Vxminus2 = U_halfstep<REAL>(deltaT, Vlt, Vic, UVFLUXNLT, UVFLUXIC,
+                                  drl, dric, drl, dric, SQR(drl), SQR(dric));
+
+            Hxfluxminus = (Hxfluxminus + HNEWXFLUXMINUS2) * half;
+            Uxfluxminus = (Uxfluxminus + UNEWXFLUXMINUS2) * half;
+            Vxfluxminus = (Vxfluxminus + UVNEWFLUXMINUS2) * half;
 
-      }
+         }
 
-      double Hxplus2 = 0.0;
-      double Uxplus2 = 0.0;
-      double Vxplus2 = 0.0;
-      if(lvl < level[nr]) {
+         if(! REGULAR && lvl < level[nr]) {
 
-         Hxplus2  = U_halfstep(deltaT, Hic, Hrt, HXFLUXIC, HXFLUXNRT,
-                               dric, drr, dric, drr, SQR(dric), SQR(drr));
-         Uxplus2  = U_halfstep(deltaT, Uic, Urt, UXFLUXIC, UXFLUXNRT,
-                               dric, drr, dric, drr, SQR(dric), SQR(drr));
-         Vxplus2  = U_halfstep(deltaT, Vic, Vrt, UVFLUXIC, UVFLUXNRT,
-                               dric, drr, dric, drr, SQR(dric), SQR(drr));
+            Hxplus2 = U_halfstep<REAL>(deltaT, Hic, Hrt, HXFLUXIC, HXFLUXNRT,
+                                 dric, drr, dric, drr, SQR(dric), SQR(drr));
+            Uxplus2 = U_halfstep<REAL>(deltaT, Uic, Urt, UXFLUXIC, UXFLUXNRT,
+                                 dric, drr, dric, drr, SQR(dric), SQR(drr));
+            Vxplus2 = U_halfstep<REAL>(deltaT, Vic, Vrt, UVFLUXIC, UVFLUXNRT,
+                                 dric, drr, dric, drr, SQR(dric), SQR(drr));
 
-         Hxfluxplus  = (Hxfluxplus + HNEWXFLUXPLUS2) * HALF;
-         Uxfluxplus  = (Uxfluxplus + UNEWXFLUXPLUS2) * HALF;
-         Vxfluxplus  = (Vxfluxplus + UVNEWFLUXPLUS2) * HALF;
+            Hxfluxplus  = (Hxfluxplus + HNEWXFLUXPLUS2) * half;
+            Uxfluxplus  = (Uxfluxplus + UNEWXFLUXPLUS2) * half;
+            Vxfluxplus  = (Vxfluxplus + UVNEWFLUXPLUS2) * half;
 
-      }
+         }
 
-      double Hyminus2 = 0.0;
-      double Uyminus2 = 0.0;
-      double Vyminus2 = 0.0;
-      if(lvl < level[nb]) {
+         if(! REGULAR && lvl < level[nb]) {
 
-         Hyminus2 = U_halfstep(deltaT, Hbr, Hic, HYFLUXNBR, HYFLUXIC,
-                               drb, dric, drb, dric, SQR(drb), SQR(dric));
-         Uyminus2 = U_halfstep(deltaT, Ubr, Uic, VUFLUXNBR, VUFLUXIC,
-                               drb, dric, drb, dric, SQR(drb), SQR(dric));
-         Vyminus2 = U_halfstep(deltaT, Vbr, Vic, VYFLUXNBR, VYFLUXIC,
-                               drb, dric, drb, dric, SQR(drb), SQR(dric));
+            Hyminus2 = U_halfstep<REAL>(deltaT, Hbr, Hic, HYFLUXNBR, HYFLUXIC,
+                                  drb, dric, drb, dric, SQR(drb), SQR(dric));
+            Uyminus2 = U_halfstep<REAL>(deltaT, Ubr, Uic, VUFLUXNBR, VUFLUXIC,
+                                  drb, dric, drb, dric, SQR(drb), SQR(dric));
+            Vyminus2 = U_halfstep<REAL>(deltaT, Vbr, Vic, VYFLUXNBR, VYFLUXIC,
+                                  drb, dric, drb, dric, SQR(drb), SQR(dric));
 
-         Hyfluxminus = (Hyfluxminus + HNEWYFLUXMINUS2) * HALF;
-         Uyfluxminus = (Uyfluxminus + VUNEWFLUXMINUS2) * HALF;
-         Vyfluxminus = (Vyfluxminus + VNEWYFLUXMINUS2) * HALF;
+            Hyfluxminus = (Hyfluxminus + HNEWYFLUXMINUS2) * half;
+            Uyfluxminus = (Uyfluxminus + VUNEWFLUXMINUS2) * half;
+            Vyfluxminus = (Vyfluxminus + VNEWYFLUXMINUS2) * half;
 
-      }
+         }
 
-      double Hyplus2 = 0.0;
-      double Uyplus2 = 0.0;
-      double Vyplus2 = 0.0;
-      if(lvl < level[nt]) {
+         if(! REGULAR && lvl < level[nt]) {
 
-         Hyplus2  = U_halfstep(deltaT, Hic, Htr, HYFLUXIC, HYFLUXNTR,
-                               dric, drt, dric, drt, SQR(dric), SQR(drt));
-         Uyplus2  = U_halfstep(deltaT, Uic, Utr, VUFLUXIC, VUFLUXNTR,
-                               dric, drt, dric, drt, SQR(dric), SQR(drt));
-         Vyplus2  = U_halfstep(deltaT, Vic, Vtr, VYFLUXIC, VYFLUXNTR,
-                               dric, drt, dric, drt, SQR(dric), SQR(drt));
+            Hyplus2 = U_halfstep<REAL>(deltaT, Hic, Htr, HYFLUXIC, HYFLUXNTR,
+                                 dric, drt, dric, drt, SQR(dric), SQR(drt));
+            Uyplus2 = U_halfstep<REAL>(deltaT, Uic, Utr, VUFLUXIC, VUFLUXNTR,
+                                 dric, drt, dric, drt, SQR(dric), SQR(drt));
+            Vyplus2 = U_halfstep<REAL>(deltaT, Vic, Vtr, VYFLUXIC, VYFLUXNTR,
+                                 dric, drt, dric, drt, SQR(dric), SQR(drt));
 
-         Hyfluxplus  = (Hyfluxplus + HNEWYFLUXPLUS2) * HALF;
-         Uyfluxplus  = (Uyfluxplus + VUNEWFLUXPLUS2) * HALF;
-         Vyfluxplus  = (Vyfluxplus + VNEWYFLUXPLUS2) * HALF;
+            Hyfluxplus  = (Hyfluxplus + HNEWYFLUXPLUS2) * half;
+            Uyfluxplus  = (Uyfluxplus + VUNEWFLUXPLUS2) * half;
+            Vyfluxplus  = (Vyfluxplus + VNEWYFLUXPLUS2) * half;
 
+         }
       }
 
-
       ////////////////////////////////////////
       /// Artificial Viscosity corrections ///
       ////////////////////////////////////////
 
 
-      if(level[nl] < level[nll]) {
+      if(! REGULAR && level[nl] < level[nll]) {
 #ifdef DEBUG
          size_t nllt = ntop[nll];
          if (nllt < 0 || nllt >= H.size() ) printf("%d: Problem at file %s line %d with nllt %ld\n",mesh->mype,__FILE__,__LINE__,nllt);
 #endif
-         Hll = (Hll + H[ ntop[nll] ]) * HALF;
-         Ull = (Ull + U[ ntop[nll] ]) * HALF;
+         Hll = (Hll + H[ ntop[nll] ]) * half;
+         Ull = (Ull + U[ ntop[nll] ]) * half;
       }
 
-      real_t Hr2 = Hr;
-      real_t Ur2 = Ur;
-      if(lvl < level[nr]) {
-         Hr2 = (Hr2 + Hrt) * HALF;
-         Ur2 = (Ur2 + Urt) * HALF;
+      REAL Hr2 = Hr;
+      REAL Ur2 = Ur;
+      if(! REGULAR && lvl < level[nr]) {
+         Hr2 = (Hr2 + Hrt) * half;
+         Ur2 = (Ur2 + Urt) * half;
       }
 
-      double wminusx_H = w_corrector(deltaT, (dric+dxl)*HALF, fabs(Uxminus/Hxminus) + sqrt(g*Hxminus),
+      REAL wminusx_H = w_corrector<REAL>(deltaT, (dric+dxl)*half, fabs(Uxminus/Hxminus) + sqrt(g*Hxminus),
                               Hic-Hl, Hl-Hll, Hr2-Hic);
 
       wminusx_H *= Hic - Hl;
 
-      if(lvl < level[nl]) {
+      if(! REGULAR && lvl < level[nl]) {
          if(level[nlt] < level[nltl])
-            Hll2 = (Hll2 + H[ ntop[nltl] ]) * HALF;
-         wminusx_H = ((w_corrector(deltaT, (dric+dxl)*HALF, fabs(Uxminus2/Hxminus2) +
+            Hll2 = (Hll2 + H[ ntop[nltl] ]) * half;
+         wminusx_H = ((w_corrector<REAL>(deltaT, (dric+dxl)*half, fabs(Uxminus2/Hxminus2) +
                                   sqrt(g*Hxminus2), Hic-Hlt, Hlt-Hll2, Hr2-Hic) *
-                      (Hic - Hlt)) + wminusx_H)*HALF*HALF;
+                      (Hic - Hlt)) + wminusx_H)*half*half;
       }
 
 
-      if(level[nr] < level[nrr]) {
+      if(! REGULAR && level[nr] < level[nrr]) {
 #ifdef DEBUG
          size_t nrrt = ntop[nrr];
          if (nrrt < 0 || nrrt >= H.size() ) printf("%d: Problem at file %s line %d with nrrt %ld\n",mesh->mype,__FILE__,__LINE__,nrrt);
 #endif
-         Hrr = (Hrr + H[ ntop[nrr] ]) * HALF;
-         Urr = (Urr + U[ ntop[nrr] ]) * HALF;
+         Hrr = (Hrr + H[ ntop[nrr] ]) * half;
+         Urr = (Urr + U[ ntop[nrr] ]) * half;
       }
 
-      real_t Hl2 = Hl;
-      real_t Ul2 = Ul;
-      if(lvl < level[nl]) {
-         Hl2 = (Hl2 + Hlt) * HALF;
-         Ul2 = (Ul2 + Ult) * HALF;
+      REAL Hl2 = Hl;
+      REAL Ul2 = Ul;
+      if(! REGULAR && lvl < level[nl]) {
+         Hl2 = (Hl2 + Hlt) * half;
+         Ul2 = (Ul2 + Ult) * half;
       }
 
-      double wplusx_H = w_corrector(deltaT, (dric+dxr)*HALF, fabs(Uxplus/Hxplus) + sqrt(g*Hxplus),
+      REAL wplusx_H = w_corrector<REAL>(deltaT, (dric+dxr)*half, fabs(Uxplus/Hxplus) + sqrt(g*Hxplus),
                            Hr-Hic, Hic-Hl2, Hrr-Hr);
 
       wplusx_H *= Hr - Hic;
 
-      if(lvl < level[nr]) {
+      if(! REGULAR && lvl < level[nr]) {
          if(level[nrt] < level[nrtr])
-            Hrr2 = (Hrr2 + H[ ntop[nrtr] ]) * HALF;
-         wplusx_H = ((w_corrector(deltaT, (dric+dxr)*HALF, fabs(Uxplus2/Hxplus2) +
+            Hrr2 = (Hrr2 + H[ ntop[nrtr] ]) * half;
+         wplusx_H = ((w_corrector<REAL>(deltaT, (dric+dxr)*half, fabs(Uxplus2/Hxplus2) +
                                   sqrt(g*Hxplus2), Hrt-Hic, Hic-Hl2, Hrr2-Hrt) *
-                      (Hrt - Hic))+wplusx_H)*HALF*HALF;
+                      (Hrt - Hic))+wplusx_H)*half*half;
       }
 
 
-      double wminusx_U = w_corrector(deltaT, (dric+dxl)*HALF, fabs(Uxminus/Hxminus) + sqrt(g*Hxminus),
+      REAL wminusx_U = w_corrector<REAL>(deltaT, (dric+dxl)*half, fabs(Uxminus/Hxminus) + sqrt(g*Hxminus),
                               Uic-Ul, Ul-Ull, Ur2-Uic);
 
       wminusx_U *= Uic - Ul;
 
-      if(lvl < level[nl]) {
+      if(! REGULAR && lvl < level[nl]) {
          if(level[nlt] < level[nltl])
-            Ull2 = (Ull2 + U[ ntop[nltl] ]) * HALF;
-         wminusx_U = ((w_corrector(deltaT, (dric+dxl)*HALF, fabs(Uxminus2/Hxminus2) +
+            Ull2 = (Ull2 + U[ ntop[nltl] ]) * half;
+         wminusx_U = ((w_corrector<REAL>(deltaT, (dric+dxl)*half, fabs(Uxminus2/Hxminus2) +
                                   sqrt(g*Hxminus2), Uic-Ult, Ult-Ull2, Ur2-Uic) *
-                      (Uic - Ult))+wminusx_U)*HALF*HALF;
+                      (Uic - Ult))+wminusx_U)*half*half;
       }
 
 
-      double wplusx_U = w_corrector(deltaT, (dric+dxr)*HALF, fabs(Uxplus/Hxplus) + sqrt(g*Hxplus),
+      REAL wplusx_U = w_corrector<REAL>(deltaT, (dric+dxr)*half, fabs(Uxplus/Hxplus) + sqrt(g*Hxplus),
                               Ur-Uic, Uic-Ul2, Urr-Ur);
 
       wplusx_U *= Ur - Uic;
 
-      if(lvl < level[nr]) {
+      if(! REGULAR && lvl < level[nr]) {
          if(level[nrt] < level[nrtr])
-            Urr2 = (Urr2 + U[ ntop[nrtr] ]) * HALF;
-         wplusx_U = ((w_corrector(deltaT, (dric+dxr)*HALF, fabs(Uxplus2/Hxplus2) +
+            Urr2 = (Urr2 + U[ ntop[nrtr] ]) * half;
+         wplusx_U = ((w_corrector<REAL>(deltaT, (dric+dxr)*half, fabs(Uxplus2/Hxplus2) +
                                   sqrt(g*Hxplus2), Urt-Uic, Uic-Ul2, Urr2-Urt) *
-                      (Urt - Uic))+wplusx_U)*HALF*HALF;
+                      (Urt - Uic))+wplusx_U)*half*half;
       }
 
 
-      if(level[nb] < level[nbb]) {
+      if(! REGULAR && level[nb] < level[nbb]) {
 #ifdef DEBUG
          size_t nbbr = nrht[nbb];
          if (nbbr < 0 || nbbr >= H.size() ) printf("%d: Problem at file %s line %d gix %d %d with nbbr %ld\n",mesh->mype,__FILE__,__LINE__,gix,gix+mesh->noffset,nbbr);
 #endif
-         Hbb = (Hbb + H[ nrht[nbb] ]) * HALF;
-         Vbb = (Vbb + V[ nrht[nbb] ]) * HALF;
+         Hbb = (Hbb + H[ nrht[nbb] ]) * half;
+         Vbb = (Vbb + V[ nrht[nbb] ]) * half;
       }
 
-      real_t Ht2 = Ht;
-      real_t Vt2 = Vt;
-      if(lvl < level[nt]) {
-         Ht2 = (Ht2 + Htr) * HALF;
-         Vt2 = (Vt2 + Vtr) * HALF;
+      REAL Ht2 = Ht;
+      REAL Vt2 = Vt;
+      if(! REGULAR && lvl < level[nt]) {
+         Ht2 = (Ht2 + Htr) * half;
+         Vt2 = (Vt2 + Vtr) * half;
       }
 
-      double wminusy_H = w_corrector(deltaT, (dric+dyb)*HALF, fabs(Vyminus/Hyminus) + sqrt(g*Hyminus),
+      REAL wminusy_H = w_corrector<REAL>(deltaT, (dric+dyb)*half, fabs(Vyminus/Hyminus) + sqrt(g*Hyminus),
                               Hic-Hb, Hb-Hbb, Ht2-Hic);
 
       wminusy_H *= Hic - Hb;
 
-      if(lvl < level[nb]) {
+      if(! REGULAR && lvl < level[nb]) {
          if(level[nbr] < level[nbrb])
-            Hbb2 = (Hbb2 + H[ nrht[nbrb] ]) * HALF;
-         wminusy_H = ((w_corrector(deltaT, (dric+dyb)*HALF, fabs(Vyminus2/Hyminus2) +
+            Hbb2 = (Hbb2 + H[ nrht[nbrb] ]) * half;
+         wminusy_H = ((w_corrector<REAL>(deltaT, (dric+dyb)*half, fabs(Vyminus2/Hyminus2) +
                                   sqrt(g*Hyminus2), Hic-Hbr, Hbr-Hbb2, Ht2-Hic) *
-                      (Hic - Hbr))+wminusy_H)*HALF*HALF;
+                      (Hic - Hbr))+wminusy_H)*half*half;
       }
 
 
-      if(level[nt] < level[ntt]) {
+      if(! REGULAR && level[nt] < level[ntt]) {
 #ifdef DEBUG
          size_t nttr = nrht[ntt];
          if (nttr < 0 || nttr >= H.size() ) printf("%d: Problem at file %s line %d with nttr %ld\n",mesh->mype,__FILE__,__LINE__,nttr);
 #endif
-         Htt = (Htt + H[ nrht[ntt] ]) * HALF;
-         Vtt = (Vtt + V[ nrht[ntt] ]) * HALF;
+         Htt = (Htt + H[ nrht[ntt] ]) * half;
+         Vtt = (Vtt + V[ nrht[ntt] ]) * half;
       }
 
-      real_t Hb2 = Hb;
-      real_t Vb2 = Vb;
-      if(lvl < level[nb]) {
-         Hb2 = (Hb2 + Hbr) * HALF;
-         Vb2 = (Vb2 + Vbr) * HALF;
+      REAL Hb2 = Hb;
+      REAL Vb2 = Vb;
+      if(! REGULAR && lvl < level[nb]) {
+         Hb2 = (Hb2 + Hbr) * half;
+         Vb2 = (Vb2 + Vbr) * half;
       }
 
-      double wplusy_H = w_corrector(deltaT, (dric+dyt)*HALF, fabs(Vyplus/Hyplus) + sqrt(g*Hyplus),
+      REAL wplusy_H = w_corrector<REAL>(deltaT, (dric+dyt)*half, fabs(Vyplus/Hyplus) + sqrt(g*Hyplus),
                              Ht-Hic, Hic-Hb2, Htt-Ht);
 
       wplusy_H *= Ht - Hic;
 
-      if(lvl < level[nt]) {
+      if(! REGULAR && lvl < level[nt]) {
          if(level[ntr] < level[ntrt])
-            Htt2 = (Htt2 + H[ nrht[ntrt] ]) * HALF;
-         wplusy_H = ((w_corrector(deltaT, (dric+dyt)*HALF, fabs(Vyplus2/Hyplus2) +
+            Htt2 = (Htt2 + H[ nrht[ntrt] ]) * half;
+         wplusy_H = ((w_corrector<REAL>(deltaT, (dric+dyt)*half, fabs(Vyplus2/Hyplus2) +
                                   sqrt(g*Hyplus2), Htr-Hic, Hic-Hb2, Htt2-Htr) *
-                      (Htr - Hic))+wplusy_H)*HALF*HALF;
+                      (Htr - Hic))+wplusy_H)*half*half;
       }
 
-      double wminusy_V = w_corrector(deltaT, (dric+dyb)*HALF, fabs(Vyminus/Hyminus) + sqrt(g*Hyminus),
+      REAL wminusy_V = w_corrector<REAL>(deltaT, (dric+dyb)*half, fabs(Vyminus/Hyminus) + sqrt(g*Hyminus),
                               Vic-Vb, Vb-Vbb, Vt2-Vic);
 
       wminusy_V *= Vic - Vb;
 
-      if(lvl < level[nb]) {
+      if(! REGULAR && lvl < level[nb]) {
          if(level[nbr] < level[nbrb])
-            Vbb2 = (Vbb2 + V[ nrht[nbrb] ]) * HALF;
-         wminusy_V = ((w_corrector(deltaT, (dric+dyb)*HALF, fabs(Vyminus2/Hyminus2) +
+            Vbb2 = (Vbb2 + V[ nrht[nbrb] ]) * half;
+         wminusy_V = ((w_corrector<REAL>(deltaT, (dric+dyb)*half, fabs(Vyminus2/Hyminus2) +
                                   sqrt(g*Hyminus2), Vic-Vbr, Vbr-Vbb2, Vt2-Vic) *
-                      (Vic - Vbr))+wminusy_V)*HALF*HALF;
+                      (Vic - Vbr))+wminusy_V)*half*half;
       }
 
-      double wplusy_V = w_corrector(deltaT, (dric+dyt)*HALF, fabs(Vyplus/Hyplus) + sqrt(g*Hyplus),
+      REAL wplusy_V = w_corrector<REAL>(deltaT, (dric+dyt)*half, fabs(Vyplus/Hyplus) + sqrt(g*Hyplus),
                            Vt-Vic, Vic-Vb2, Vtt-Vt);
 
       wplusy_V *= Vt - Vic;
 
-      if(lvl < level[nt]) {
+      if(! REGULAR && lvl < level[nt]) {
          if(level[ntr] < level[ntrt])
-            Vtt2 = (Vtt2 + V[ nrht[ntrt] ]) * HALF;
-         wplusy_V = ((w_corrector(deltaT, (dric+dyt)*HALF, fabs(Vyplus2/Hyplus2) +
+            Vtt2 = (Vtt2 + V[ nrht[ntrt] ]) * half;
+         wplusy_V = ((w_corrector<REAL>(deltaT, (dric+dyt)*half, fabs(Vyplus2/Hyplus2) +
                                   sqrt(g*Hyplus2), Vtr-Vic, Vic-Vb2, Vtt2-Vtr) *
-                      (Vtr - Vic))+wplusy_V)*HALF*HALF;
+                      (Vtr - Vic))+wplusy_V)*half*half;
       }
 
-      H_new[gix] = U_fullstep(deltaT, dxic, Hic,
+      REAL Hnew = U_fullstep<REAL>(deltaT, dxic, Hic,
                        Hxfluxplus, Hxfluxminus, Hyfluxplus, Hyfluxminus)
                   - wminusx_H + wplusx_H - wminusy_H + wplusy_H;
-      U_new[gix] = U_fullstep(deltaT, dxic, Uic,
+      H_new[gix] = Hnew;
+      U_new[gix] = U_fullstep<REAL>(deltaT, dxic, Uic,
                        Uxfluxplus, Uxfluxminus, Uyfluxplus, Uyfluxminus)
                   - wminusx_U + wplusx_U;
-      V_new[gix] = U_fullstep(deltaT, dxic, Vic,
+      V_new[gix] = U_fullstep<REAL>(deltaT, dxic, Vic,
                        Vxfluxplus, Vxfluxminus, Vyfluxplus, Vyfluxminus)
                   - wminusy_V + wplusy_V;
 
-   } // cell loop
+      // Amounts of H, U and V that came in across each face to a cell of
+      // another level, as mass and momentum, for the refluxing
+      if (! REGULAR && flux_reg != NULL) {
+         double dtdx = deltaT/dxic;
+         double area = dxic*dyic;
+         double *reg = &flux_reg[12*gix];
+         if (level[nl] != lvl) {
+            reg[0]  += ( dtdx*Hxfluxminus - wminusx_H)*area;
+            reg[1]  += ( dtdx*Uxfluxminus - wminusx_U)*area;
+            reg[2]  += ( dtdx*Vxfluxminus)*area;
+         }
+         if (level[nr] != lvl) {
+            reg[3]  += (-dtdx*Hxfluxplus  + wplusx_H)*area;
+            reg[4]  += (-dtdx*Uxfluxplus  + wplusx_U)*area;
+            reg[5]  += (-dtdx*Vxfluxplus)*area;
+         }
+         if (level[nb] != lvl) {
+            reg[6]  += ( dtdx*Hyfluxminus - wminusy_H)*area;
+            reg[7]  += ( dtdx*Uyfluxminus)*area;
+            reg[8]  += ( dtdx*Vyfluxminus - wminusy_V)*area;
+         }
+         if (level[nt] != lvl) {
+            reg[9]  += (-dtdx*Hyfluxplus  + wplusy_H)*area;
+            reg[10] += (-dtdx*Uyfluxplus)*area;
+            reg[11] += (-dtdx*Vyfluxplus  + wplusy_V)*area;
+         }
+      }
 
-   // Replace H with H_new and deallocate H. New memory will have the characteristics
-   // of the new memory and the name of the old. Both return and arg1 will be reset to new memory
-   H = (real_t *)state_memory.memory_replace(H, H_new);
-   U = (real_t *)state_memory.memory_replace(U, U_new);
-   V = (real_t *)state_memory.memory_replace(V, V_new);
+      if (do_timestep && celltype[gix] == REAL_CELL) {
+         double wavespeed = sqrt(timestep_g*H_new[gix]);
+         double xspeed = (fabs(U_new[gix])+wavespeed)/lev_deltax[lvl];
+         double yspeed = (fabs(V_new[gix])+wavespeed)/lev_deltay[lvl];
+         double cell_deltaT = timestep_sigma/(xspeed+yspeed);
+         if (cell_deltaT < mindeltaT) mindeltaT = cell_deltaT;
+      }
 
-   //state_memory.memory_report();
-   //printf("DEBUG end finite diff\n\n"); 
+#ifdef HAVE_MIXED_PRECISION
+      if (celltype[gix] == REAL_CELL) storage_drift += ((double)H_new[gix] - Hnew)*dxic*dyic;
+#endif
 
-   cpu_time_finite_difference += cpu_timer_stop(tstart_cpu);
+   } // cell loop
+
+#ifdef HAVE_MIXED_PRECISION
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+   storage_mass_drift += storage_drift;
+#endif
+
+   return(mindeltaT);
 }
 
-#ifdef HAVE_OPENCL
-void State::gpu_calc_finite_difference(double deltaT)
+// Arguments of the SIMD loop over regular cells, gathered from the state and
+// the mesh so the loop can be a free function compiled for each instruction set.
+template <class NEIGH, class STATEV>
+struct regular_stencil_args
+{  const double *lev_dt;
+   const int *cell_list;
+   int ncell_list;
+   NEIGH nlft, nrht, nbot, ntop;
+   STATEV H, U, V;
+   state_t *H_new, *U_new, *V_new;
+   const int *level, *celltype;
+   const real_t *lev_deltax, *lev_deltay;
+   int do_timestep;
+   double timestep_g, timestep_sigma; };
+
+// The cell loop of calc_finite_difference for regular cells only, written so
+// the compiler can run it a vector of cells at a time. With every neighbor at
+// the cell's level the update is straight arithmetic on gathered values, the
+// same arithmetic in the same order as the general loop, so the results match
+// it. There are no branches in the loop, so it takes a list of cells and a
+// timestep for each level, subcycled or not. It is inlined into a wrapper for
+// each instruction set below.
+template <class REAL, class NEIGH, class STATEV>
+static inline __attribute__((always_inline))
+double finite_difference_regular_loop(const regular_stencil_args<NEIGH, STATEV> &a, double &storage_drift)
 {
-   struct timeval tstart_cpu;
-   cpu_timer_start(&tstart_cpu);
+   const REAL g     = 9.80;   // gravitational constant
+   const REAL ghalf = 0.5*g;
+   const REAL half  = HALF;
+
+   const double *lev_dt = a.lev_dt;
+   const int *cell_list = a.cell_list;
+   const NEIGH nlft = a.nlft, nrht = a.nrht, nbot = a.nbot, ntop = a.ntop;
+   const STATEV H = a.H, U = a.U, V = a.V;
+   state_t *H_new = a.H_new, *U_new = a.U_new, *V_new = a.V_new;
+   const int *level = a.level, *celltype = a.celltype;
+   const real_t *lev_deltax = a.lev_deltax, *lev_deltay = a.lev_deltay;
+   const int do_timestep = a.do_timestep;
+   const double timestep_g = a.timestep_g, timestep_sigma = a.timestep_sigma;
 
-   cl_command_queue command_queue = ezcl_get_command_queue();
+   double mindeltaT = 1000.0;
+   double drift = 0.0;
 
-   //cl_mem dev_ptr = NULL;
+   int block_start;
+#ifdef _OPENMP
+#pragma omp parallel for private(block_start) reduction(min:mindeltaT) reduction(+:drift)
+#endif
+   for(block_start = 0; block_start < a.ncell_list; block_start += SIMD_BLOCK) {
+      int nblock = min(SIMD_BLOCK, a.ncell_list - block_start);
+      state_t H_block[SIMD_BLOCK], U_block[SIMD_BLOCK], V_block[SIMD_BLOCK];
+
+      // The new values go to the block arrays in the vector loop and are
+      // scattered to the cells after it
+#if defined(_OPENMP) || defined(HAVE_OPENMP_SIMD)
+#pragma omp simd reduction(min:mindeltaT) reduction(+:drift)
+#endif
+      for(int iblock = 0; iblock < nblock; iblock++) {
+         int gix = cell_list[block_start+iblock];
+
+         int lvl = level[gix];
+         int nl  = nlft[gix];
+         int nr  = nrht[gix];
+         int nt  = ntop[gix];
+         int nb  = nbot[gix];
+         int real_cell = (celltype[gix] == REAL_CELL);
+
+         double deltaT = lev_dt[lvl];
+
+         REAL Hic = H[gix], Uic = U[gix], Vic = V[gix];
+         REAL Hl  = H[nl],  Ul  = U[nl],  Vl  = V[nl];
+         REAL Hr  = H[nr],  Ur  = U[nr],  Vr  = V[nr];
+         REAL Ht  = H[nt],  Ut  = U[nt],  Vt  = V[nt];
+         REAL Hb  = H[nb],  Ub  = U[nb],  Vb  = V[nb];
+
+         int nll = nlft[nl], nrr = nrht[nr], ntt = ntop[nt], nbb = nbot[nb];
+         REAL Hll = H[nll], Ull = U[nll];
+         REAL Hrr = H[nrr], Urr = U[nrr];
+         REAL Htt = H[ntt], Vtt = V[ntt];
+         REAL Hbb = H[nbb], Vbb = V[nbb];
+
+         REAL dxic = lev_deltax[lvl];
+         REAL dyic = lev_deltay[lvl];
+         REAL dxl = dxic, dxr = dxic, dyt = dyic, dyb = dyic;
+         REAL dric = dxic;
+
+         REAL Hxminus = U_halfstep<REAL>(deltaT, Hl, Hic, HXFLUXNL, HXFLUXIC,
+                                   dxl, dxic, dxl, dxic, SQR(dxl), SQR(dxic));
+         REAL Uxminus = U_halfstep<REAL>(deltaT, Ul, Uic, UXFLUXNL, UXFLUXIC,
+                                   dxl, dxic, dxl, dxic, SQR(dxl), SQR(dxic));
+         REAL Vxminus = U_halfstep<REAL>(deltaT, Vl, Vic, UVFLUXNL, UVFLUXIC,
+                                   dxl, dxic, dxl, dxic, SQR(dxl), SQR(dxic));
+
+         REAL Hxplus  = U_halfstep<REAL>(deltaT, Hic, Hr, HXFLUXIC, HXFLUXNR,
+                                   dxic, dxr, dxic, dxr, SQR(dxic), SQR(dxr));
+         REAL Uxplus  = U_halfstep<REAL>(deltaT, Uic, Ur, UXFLUXIC, UXFLUXNR,
+                                   dxic, dxr, dxic, dxr, SQR(dxic), SQR(dxr));
+         REAL Vxplus  = U_halfstep<REAL>(deltaT, Vic, Vr, UVFLUXIC, UVFLUXNR,
+                                   dxic, dxr, dxic, dxr, SQR(dxic), SQR(dxr));
+
+         REAL Hyminus = U_halfstep<REAL>(deltaT, Hb, Hic, HYFLUXNB, HYFLUXIC,
+                                   dyb, dyic, dyb, dyic, SQR(dyb), SQR(dyic));
+         REAL Uyminus = U_halfstep<REAL>(deltaT, Ub, Uic, VUFLUXNB, VUFLUXIC,
+                                   dyb, dyic, dyb, dyic, SQR(dyb), SQR(dyic));
+         REAL Vyminus = U_halfstep<REAL>(deltaT, Vb, Vic, VYFLUXNB, VYFLUXIC,
+                                   dyb, dyic, dyb, dyic, SQR(dyb), SQR(dyic));
+
+         REAL Hyplus  = U_halfstep<REAL>(deltaT, Hic, Ht, HYFLUXIC, HYFLUXNT,
+                                   dyic, dyt, dyic, dyt, SQR(dyic), SQR(dyt));
+         REAL Uyplus  = U_halfstep<REAL>(deltaT, Uic, Ut, VUFLUXIC, VUFLUXNT,
+                                   dyic, dyt, dyic, dyt, SQR(dyic), SQR(dyt));
+         REAL Vyplus  = U_halfstep<REAL>(deltaT, Vic, Vt, VYFLUXIC, VYFLUXNT,
+                                   dyic, dyt, dyic, dyt, SQR(dyic), SQR(dyt));
+
+         REAL Hxfluxminus = HNEWXFLUXMINUS;
+         REAL Uxfluxminus = UNEWXFLUXMINUS;
+         REAL Vxfluxminus = UVNEWFLUXMINUS;
+
+         REAL Hxfluxplus  = HNEWXFLUXPLUS;
+         REAL Uxfluxplus  = UNEWXFLUXPLUS;
+         REAL Vxfluxplus  = UVNEWFLUXPLUS;
+
+         REAL Hyfluxminus = HNEWYFLUXMINUS;
+         REAL Uyfluxminus = VUNEWFLUXMINUS;
+         REAL Vyfluxminus = VNEWYFLUXMINUS;
+
+         REAL Hyfluxplus  = HNEWYFLUXPLUS;
+         REAL Uyfluxplus  = VUNEWFLUXPLUS;
+         REAL Vyfluxplus  = VNEWYFLUXPLUS;
+
+         // Artificial viscosity corrections
+         REAL wminusx_H = w_corrector<REAL>(deltaT, (dric+dxl)*half, fabs(Uxminus/Hxminus) + sqrt(g*Hxminus),
+                                 Hic-Hl, Hl-Hll, Hr-Hic);
+         wminusx_H *= Hic - Hl;
+
+         REAL wplusx_H = w_corrector<REAL>(deltaT, (dric+dxr)*half, fabs(Uxplus/Hxplus) + sqrt(g*Hxplus),
+                              Hr-Hic, Hic-Hl, Hrr-Hr);
+         wplusx_H *= Hr - Hic;
+
+         REAL wminusx_U = w_corrector<REAL>(deltaT, (dric+dxl)*half, fabs(Uxminus/Hxminus) + sqrt(g*Hxminus),
+                                 Uic-Ul, Ul-Ull, Ur-Uic);
+         wminusx_U *= Uic - Ul;
+
+         REAL wplusx_U = w_corrector<REAL>(deltaT, (dric+dxr)*half, fabs(Uxplus/Hxplus) + sqrt(g*Hxplus),
+                                 Ur-Uic, Uic-Ul, Urr-Ur);
+         wplusx_U *= Ur - Uic;
+
+         REAL wminusy_H = w_corrector<REAL>(deltaT, (dric+dyb)*half, fabs(Vyminus/Hyminus) + sqrt(g*Hyminus),
+                                 Hic-Hb, Hb-Hbb, Ht-Hic);
+         wminusy_H *= Hic - Hb;
+
+         REAL wplusy_H = w_corrector<REAL>(deltaT, (dric+dyt)*half, fabs(Vyplus/Hyplus) + sqrt(g*Hyplus),
+                                Ht-Hic, Hic-Hb, Htt-Ht);
+         wplusy_H *= Ht - Hic;
+
+         REAL wminusy_V = w_corrector<REAL>(deltaT, (dric+dyb)*half, fabs(Vyminus/Hyminus) + sqrt(g*Hyminus),
+                                 Vic-Vb, Vb-Vbb, Vt-Vic);
+         wminusy_V *= Vic - Vb;
+
+         REAL wplusy_V = w_corrector<REAL>(deltaT, (dric+dyt)*half, fabs(Vyplus/Hyplus) + sqrt(g*Hyplus),
+                              Vt-Vic, Vic-Vb, Vtt-Vt);
+         wplusy_V *= Vt - Vic;
+
+         REAL Hnew = U_fullstep<REAL>(deltaT, dxic, Hic,
+                          Hxfluxplus, Hxfluxminus, Hyfluxplus, Hyfluxminus)
+                     - wminusx_H + wplusx_H - wminusy_H + wplusy_H;
+         state_t Hs = Hnew;
+         state_t Us = U_fullstep<REAL>(deltaT, dxic, Uic,
+                          Uxfluxplus, Uxfluxminus, Uyfluxplus, Uyfluxminus)
+                     - wminusx_U + wplusx_U;
+         state_t Vs = U_fullstep<REAL>(deltaT, dxic, Vic,
+                          Vxfluxplus, Vxfluxminus, Vyfluxplus, Vyfluxminus)
+                     - wminusy_V + wplusy_V;
+         H_block[iblock] = Hs;
+         U_block[iblock] = Us;
+         V_block[iblock] = Vs;
+
+         // Found for every cell and kept for the real ones
+         double wavespeed = sqrt(timestep_g*Hs);
+         double xspeed = (fabs(Us)+wavespeed)/lev_deltax[lvl];
+         double yspeed = (fabs(Vs)+wavespeed)/lev_deltay[lvl];
+         double cell_deltaT = timestep_sigma/(xspeed+yspeed);
+         mindeltaT = (do_timestep && real_cell) ? min(mindeltaT, cell_deltaT) : mindeltaT;
+
+#ifdef HAVE_MIXED_PRECISION
+         drift += real_cell ? ((double)Hs - Hnew)*dxic*dyic : 0.0;
+#endif
+      } // cell loop
 
-   size_t &ncells    = mesh->ncells;
-   size_t &ncells_ghost = mesh->ncells_ghost;
-   if (ncells_ghost < ncells) ncells_ghost = ncells;
-   int &levmx           = mesh->levmx;
-   cl_mem &dev_celltype = mesh->dev_celltype;
-   cl_mem &dev_nlft     = mesh->dev_nlft;
-   cl_mem &dev_nrht     = mesh->dev_nrht;
-   cl_mem &dev_nbot     = mesh->dev_nbot;
-   cl_mem &dev_ntop     = mesh->dev_ntop;
-   cl_mem &dev_level    = mesh->dev_level;
-   cl_mem &dev_levdx    = mesh->dev_levdx;
-   cl_mem &dev_levdy    = mesh->dev_levdy;
+      for(int iblock = 0; iblock < nblock; iblock++) {
+         int gix = cell_list[block_start+iblock];
+         H_new[gix] = H_block[iblock];
+         U_new[gix] = U_block[iblock];
+         V_new[gix] = V_block[iblock];
+      }
+   } // block loop
 
-   assert(dev_H);
-   assert(dev_U);
-   assert(dev_V);
-   assert(dev_nlft);
-   assert(dev_nrht);
-   assert(dev_nbot);
-   assert(dev_ntop);
-   assert(dev_level);
-   assert(dev_levdx);
-   assert(dev_levdy);
+   storage_drift = drift;
+   return(mindeltaT);
+}
 
-   cl_mem dev_H_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_H_new"));
-   cl_mem dev_U_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_U_new"));
-   cl_mem dev_V_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_V_new"));
- 
-   size_t local_work_size = 128;
-   size_t global_work_size = ((ncells+local_work_size - 1) /local_work_size) * local_work_size;
+// Instruction sets the regular cell loop has been compiled for. SIMD_SCALAR
+// leaves the regular cells to the general loop.
+enum simd_isa_type { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
 
-#ifdef HAVE_MPI
-   if (mesh->numpe > 1) {
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 0, sizeof(cl_int), &ncells);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 1, sizeof(cl_mem), &dev_celltype);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 2, sizeof(cl_mem), &dev_nlft);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 3, sizeof(cl_mem), &dev_nrht);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 4, sizeof(cl_mem), &dev_ntop);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 5, sizeof(cl_mem), &dev_nbot);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 6, sizeof(cl_mem), &dev_H);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 7, sizeof(cl_mem), &dev_U);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 8, sizeof(cl_mem), &dev_V);
-      ezcl_enqueue_ndrange_kernel(command_queue, kernel_apply_boundary_conditions_local,   1, NULL, &global_work_size, &local_work_size, NULL);
-    
-        /*
-        __kernel void copy_state_data_cl(
-                         const int    isize,         // 0
-                __global      real_t  *H,            // 1
-                __global      real_t  *U,            // 2
-                __global      real_t  *V,            // 3
-                __global      real_t  *H_new,        // 4
-                __global      real_t  *U_new,        // 5
-                __global      real_t  *V_new)        // 6
-        */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+// Copies of the regular cell loop for AVX2 and AVX-512. state.cpp is built
+// without contraction into fused multiply-adds, which keeps the vector
+// results the same as the scalar ones.
+#define HAVE_SIMD_DISPATCH
 
-      ezcl_set_kernel_arg(kernel_copy_state_data, 0, sizeof(cl_int), (void *)&ncells);
-      ezcl_set_kernel_arg(kernel_copy_state_data, 1, sizeof(cl_mem), (void *)&dev_H);
-      ezcl_set_kernel_arg(kernel_copy_state_data, 2, sizeof(cl_mem), (void *)&dev_U);
-      ezcl_set_kernel_arg(kernel_copy_state_data, 3, sizeof(cl_mem), (void *)&dev_V);
-      ezcl_set_kernel_arg(kernel_copy_state_data, 4, sizeof(cl_mem), (void *)&dev_H_new);
-      ezcl_set_kernel_arg(kernel_copy_state_data, 5, sizeof(cl_mem), (void *)&dev_U_new);
-      ezcl_set_kernel_arg(kernel_copy_state_data, 6, sizeof(cl_mem), (void *)&dev_V_new);
+template <class REAL, class NEIGH, class STATEV>
+__attribute__((target("avx2")))
+static double finite_difference_regular_avx2(const regular_stencil_args<NEIGH, STATEV> &a, double &storage_drift)
+{
+   return(finite_difference_regular_loop<REAL>(a, storage_drift));
+}
 
-      //ezcl_enqueue_ndrange_kernel(command_queue, kernel_copy_state_data,   1, NULL, &global_work_size, &local_work_size, &copy_state_data_event);
-      ezcl_enqueue_ndrange_kernel(command_queue, kernel_copy_state_data,   1, NULL, &global_work_size, &local_work_size, NULL);
+template <class REAL, class NEIGH, class STATEV>
+__attribute__((target("avx512f")))
+static double finite_difference_regular_avx512(const regular_stencil_args<NEIGH, STATEV> &a, double &storage_drift)
+{
+   return(finite_difference_regular_loop<REAL>(a, storage_drift));
+}
+#endif
 
-      dev_H = (cl_mem)gpu_state_memory.memory_replace(dev_H, dev_H_new);
-      dev_U = (cl_mem)gpu_state_memory.memory_replace(dev_U, dev_U_new);
-      dev_V = (cl_mem)gpu_state_memory.memory_replace(dev_V, dev_V_new);
+// Widest instruction set of this processor that there is a regular cell loop
+// for, found the first time it is asked for.
+static int simd_isa_detect(void)
+{
+   static int simd_isa = -1;
+
+   if (simd_isa < 0) {
+      simd_isa = SIMD_SCALAR;
+#ifdef HAVE_SIMD_DISPATCH
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f")) {
+         simd_isa = SIMD_AVX512;
+      } else if (__builtin_cpu_supports("avx2")) {
+         simd_isa = SIMD_AVX2;
+      }
+#endif
+   }
+   return(simd_isa);
+}
 
-      L7_Dev_Update(dev_H, L7_REAL, mesh->cell_handle);
-      L7_Dev_Update(dev_U, L7_REAL, mesh->cell_handle);
-      L7_Dev_Update(dev_V, L7_REAL, mesh->cell_handle);
+static const char *simd_isa_name(int simd_isa)
+{
+   if (simd_isa == SIMD_AVX512) return("avx512f");
+   if (simd_isa == SIMD_AVX2)   return("avx2");
+   return("scalar");
+}
 
-      dev_H_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_H_new"));
-      dev_U_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_U_new"));
-      dev_V_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_V_new"));
+// Runs the regular cells of cell_list through the SIMD loop for this
+// processor. Returns 0 without doing anything when there is none or when the
+// sweep has no cell list, so the caller falls back on the general loop.
+template <class REAL, class NEIGH, class STATEV>
+int State::calc_finite_difference_simd(double deltaT, const int *cell_list, int ncell_list,
+                                       NEIGH nlft, NEIGH nrht, NEIGH nbot, NEIGH ntop,
+                                       STATEV H, STATEV U, STATEV V,
+                                       state_t *H_new, state_t *U_new, state_t *V_new, double &mindeltaT)
+{
+   int simd_isa = simd_isa_detect();
+   if (simd_isa == SIMD_SCALAR || cell_list == NULL) return(0);
+
+   vector<double> uniform_dt(mesh->levmx+1, deltaT);
+   const double *lev_dt = subcycling ? &lev_deltaT[0] : &uniform_dt[0];
+
+   regular_stencil_args<NEIGH, STATEV> a = {lev_dt, cell_list, ncell_list,
+                                            nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new,
+                                            mesh->level, mesh->celltype, &mesh->lev_deltax[0], &mesh->lev_deltay[0],
+                                            (fused_timestep && timestep_sigma > 0.0), timestep_g, timestep_sigma};
+   double storage_drift = 0.0;
+
+#ifdef HAVE_SIMD_DISPATCH
+   if (simd_isa == SIMD_AVX512)
+      mindeltaT = finite_difference_regular_avx512<REAL>(a, storage_drift);
+   else
+      mindeltaT = finite_difference_regular_avx2<REAL>(a, storage_drift);
+#endif
 
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 0, sizeof(cl_int), &ncells);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 1, sizeof(cl_mem), &dev_celltype);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 2, sizeof(cl_mem), &dev_nlft);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 3, sizeof(cl_mem), &dev_nrht);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 4, sizeof(cl_mem), &dev_ntop);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 5, sizeof(cl_mem), &dev_nbot);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 6, sizeof(cl_mem), &dev_H);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 7, sizeof(cl_mem), &dev_U);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 8, sizeof(cl_mem), &dev_V);
-      ezcl_enqueue_ndrange_kernel(command_queue, kernel_apply_boundary_conditions_ghost,   1, NULL, &global_work_size, &local_work_size, NULL);
-   } else {
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 0, sizeof(cl_int), &ncells);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 1, sizeof(cl_mem), &dev_celltype);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 2, sizeof(cl_mem), &dev_nlft);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 3, sizeof(cl_mem), &dev_nrht);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 4, sizeof(cl_mem), &dev_ntop);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 5, sizeof(cl_mem), &dev_nbot);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 6, sizeof(cl_mem), &dev_H);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 7, sizeof(cl_mem), &dev_U);
-      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 8, sizeof(cl_mem), &dev_V);
-      ezcl_enqueue_ndrange_kernel(command_queue, kernel_apply_boundary_conditions,   1, NULL, &global_work_size, &local_work_size, NULL);
-   }
-#else
-   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 0, sizeof(cl_int), &ncells);
-   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 1, sizeof(cl_mem), &dev_celltype);
-   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 2, sizeof(cl_mem), &dev_nlft);
-   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 3, sizeof(cl_mem), &dev_nrht);
-   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 4, sizeof(cl_mem), &dev_ntop);
-   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 5, sizeof(cl_mem), &dev_nbot);
-   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 6, sizeof(cl_mem), &dev_H);
-   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 7, sizeof(cl_mem), &dev_U);
-   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 8, sizeof(cl_mem), &dev_V);
-   ezcl_enqueue_ndrange_kernel(command_queue, kernel_apply_boundary_conditions,   1, NULL, &global_work_size, &local_work_size, NULL);
+#ifdef HAVE_MIXED_PRECISION
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+   storage_mass_drift += storage_drift;
 #endif
 
-     /*
-     __kernel void calc_finite_difference_cl(
-                      const int    ncells,   // 0  Total number of cells.
-                      const int    lvmax,    // 1  Maximum level
+   return(1);
+}
+
+// Picks the state layout for the cell loop. HUV holds the interleaved records,
+// or is NULL to read the state arrays.
+template <class NEIGH>
+double State::calc_finite_difference_layout(double deltaT, const int *cell_list, int ncell_list, int regular,
+                                            NEIGH nlft, NEIGH nrht, NEIGH nbot, NEIGH ntop,
+                                            state_t *HUV, state_t *H_new, state_t *U_new, state_t *V_new)
+{
+   if (HUV != NULL) {
+      state_interleaved Hv = {HUV}, Uv = {HUV+1}, Vv = {HUV+2};
+      return(calc_finite_difference_precision(deltaT, cell_list, ncell_list, regular, nlft, nrht, nbot, ntop, Hv, Uv, Vv, H_new, U_new, V_new));
+   }
+
+   state_array Hv = {H}, Uv = {U}, Vv = {V};
+   return(calc_finite_difference_precision(deltaT, cell_list, ncell_list, regular, nlft, nrht, nbot, ntop, Hv, Uv, Vv, H_new, U_new, V_new));
+}
+
+// Picks the arithmetic type, the face or cell fluxes and the regular or
+// general stencil for the cell loop. With SIMD kernels the regular cells go
+// to the loop for the widest instruction set of the processor, if any.
+template <class NEIGH, class STATEV>
+double State::calc_finite_difference_precision(double deltaT, const int *cell_list, int ncell_list, int regular,
+                                               NEIGH nlft, NEIGH nrht, NEIGH nbot, NEIGH ntop,
+                                               STATEV H, STATEV U, STATEV V,
+                                               state_t *H_new, state_t *U_new, state_t *V_new)
+{
+   if (regular && simd_kernels && ! face_fluxes) {
+      double mindeltaT;
+      if (float_kernels) {
+         if (calc_finite_difference_simd<float>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new, mindeltaT))
+            return(mindeltaT);
+      } else {
+         if (calc_finite_difference_simd<double>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new, mindeltaT))
+            return(mindeltaT);
+      }
+   }
+
+   if (float_kernels) {
+      if (face_fluxes) {
+         if (regular)
+            return(calc_finite_difference_cells<float, NEIGH, STATEV, 1, 1>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new));
+         return(calc_finite_difference_cells<float, NEIGH, STATEV, 1, 0>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new));
+      }
+      if (regular)
+         return(calc_finite_difference_cells<float, NEIGH, STATEV, 0, 1>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new));
+      return(calc_finite_difference_cells<float, NEIGH, STATEV, 0, 0>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new));
+   }
+
+   if (face_fluxes) {
+      if (regular)
+         return(calc_finite_difference_cells<double, NEIGH, STATEV, 1, 1>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new));
+      return(calc_finite_difference_cells<double, NEIGH, STATEV, 1, 0>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new));
+   }
+   if (regular)
+      return(calc_finite_difference_cells<double, NEIGH, STATEV, 0, 1>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new));
+   return(calc_finite_difference_cells<double, NEIGH, STATEV, 0, 0>(deltaT, cell_list, ncell_list, nlft, nrht, nbot, ntop, H, U, V, H_new, U_new, V_new));
+}
+
+// Returns the spare state buffer with the given name sized to nelem records of
+// elsize bytes. The buffer from the previous cycle is reused when it was
+// allocated with the same flags and is large enough, so only the first cycle
+// after a rezone allocates.
+static state_t *state_scratch_buffer(MallocPlus &state_memory, const char *name, size_t nelem, size_t elsize, int flags)
+{
+   state_t *mem_ptr = (state_t *)state_memory.get_memory_ptr(name);
+
+   if (mem_ptr != NULL && (state_memory.get_memory_flags(mem_ptr) & flags) == flags &&
+       state_memory.get_memory_capacity(mem_ptr) >= nelem) {
+      if (state_memory.get_memory_size(mem_ptr) != nelem)
+         mem_ptr = (state_t *)state_memory.memory_realloc(nelem, elsize, mem_ptr);
+      return(mem_ptr);
+   }
+
+   if (mem_ptr != NULL) state_memory.memory_delete(mem_ptr);
+   return((state_t *)state_memory.memory_malloc(nelem, elsize, flags, name));
+}
+
+// Copies H, U and V of the cells in cell_list, or of cells ifirst to ilast-1
+// when cell_list is NULL, into their interleaved records.
+static void interleave_state(state_t *HUV, const state_t *H, const state_t *U, const state_t *V,
+                             const int *cell_list, int ifirst, int ilast)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+   for (int ilist = ifirst; ilist < ilast; ilist++){
+      int ic = (cell_list != NULL) ? cell_list[ilist] : ilist;
+      HUV[3*ic  ] = H[ic];
+      HUV[3*ic+1] = U[ic];
+      HUV[3*ic+2] = V[ic];
+   }
+}
+
+// Copies the new H, U and V of the cells in cell_list back into the state arrays.
+static void copy_state_cells(state_t *H, state_t *U, state_t *V,
+                             const state_t *H_new, const state_t *U_new, const state_t *V_new,
+                             const int *cell_list, int ncell_list)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+   for (int ilist = 0; ilist < ncell_list; ilist++){
+      int ic = cell_list[ilist];
+      H[ic] = H_new[ic];
+      U[ic] = U_new[ic];
+      V[ic] = V_new[ic];
+   }
+}
+
+// Picks the cells of cell_list, or the first ncell_list cells when cell_list
+// is NULL, that are within max_hops neighbor steps of a cell not at rest.
+static void select_active_cells(vector<int> &cells, const vector<char> &active_hops, int max_hops,
+                                const int *cell_list, int ncell_list)
+{
+   cells.clear();
+   for (int ilist = 0; ilist < ncell_list; ilist++){
+      int ic = (cell_list != NULL) ? cell_list[ilist] : ilist;
+      if (active_hops[ic] != 0 && active_hops[ic] <= max_hops+1) cells.push_back(ic);
+   }
+}
+
+// Finds how many neighbor steps each cell is from the nearest cell that is not
+// at rest, for activity tracking. A cell is at rest when it and its neighbors
+// have no velocity and the same H, to QUIESCENT_TOLERANCE of its H. A cell next
+// to a ghost cell never is. Only the cells tracked last cycle are tested, as
+// the others have not been stepped since they came to rest. The cells within
+// ACTIVE_STENCIL_DEPTH steps are stepped. Tracking reaches twice as far plus
+// one step, which holds every cell the next cycle can step and the stencils
+// of the refinement potential. It is kept in Active for set_timestep and the
+// next cycle, and rezone and load balance carry it like the state.
+void State::calc_active_cells(void)
+{
+   size_t &ncells = mesh->ncells;
+   int *nlft  = mesh->nlft;
+   int *nrht  = mesh->nrht;
+   int *nbot  = mesh->nbot;
+   int *ntop  = mesh->ntop;
+   int *level = mesh->level;
+
+   int track_depth = 2*ACTIVE_STENCIL_DEPTH + 1;
+
+   active_hops.assign(ncells, 0);
+
+   int ic;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+   for (ic=0; ic<(int)ncells; ic++){
+      if (Active[ic] == 0.0) continue;
+
+      double tol = QUIESCENT_TOLERANCE*H[ic];
+      int at_rest = (fabs(U[ic]) <= tol && fabs(V[ic]) <= tol);
+      int nbr[4] = {nlft[ic], nrht[ic], nbot[ic], ntop[ic]};
+      for (int side = 0; side < 4 && at_rest; side++){
+         int nn = nbr[side];
+         at_rest = (nn < (int)ncells && fabs(U[nn]) <= tol && fabs(V[nn]) <= tol &&
+                    fabs(H[nn] - H[ic]) <= tol);
+      }
+      if (! at_rest) active_hops[ic] = 1;
+   }
+
+   vector<int> frontier, next_frontier;
+   for (ic=0; ic<(int)ncells; ic++){
+      if (active_hops[ic] != 0) frontier.push_back(ic);
+   }
+
+   // Grow out a neighbor step at a time. Across a refinement jump both of the
+   // finer neighbors are one step away.
+   for (int hop = 1; hop <= track_depth; hop++){
+      next_frontier.clear();
+      for (uint ilist = 0; ilist < frontier.size(); ilist++){
+         int ic = frontier[ilist];
+         int nbr[4] = {nlft[ic], nrht[ic], nbot[ic], ntop[ic]};
+         for (int side = 0; side < 4; side++){
+            int nn = nbr[side];
+            if (nn >= (int)ncells) continue;
+            int nn2 = (side < 2) ? ntop[nn] : nrht[nn];
+            if (active_hops[nn] == 0) {
+               active_hops[nn] = hop+1;
+               next_frontier.push_back(nn);
+            }
+            if (level[nn] > level[ic] && nn2 < (int)ncells && active_hops[nn2] == 0) {
+               active_hops[nn2] = hop+1;
+               next_frontier.push_back(nn2);
+            }
+         }
+      }
+      frontier.swap(next_frontier);
+   }
+
+   long long nstepped = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:nstepped)
+#endif
+   for (ic=0; ic<(int)ncells; ic++){
+      Active[ic] = (active_hops[ic] != 0) ? 1.0 : 0.0;
+      if (active_hops[ic] != 0 && active_hops[ic] <= ACTIVE_STENCIL_DEPTH+1) nstepped++;
+   }
+   active_cell_count += nstepped;
+   active_cell_total += ncells;
+}
+
+// Splits the cells of cell_list, or the first ncell_list cells when cell_list
+// is NULL, into the mesh's regular cells and the cells at refinement jumps,
+// keeping their order. A sweep of all the cells takes the mesh's own lists;
+// otherwise the lists are filled in and the pointers lead to them.
+static void bucket_cells_by_level(Mesh *mesh, const int *cell_list, int ncell_list,
+                                  vector<int> &regular_list, vector<int> &jump_list,
+                                  const int *&regular_cells, int &nregular,
+                                  const int *&jump_cells, int &njump)
+{
+   if (cell_list == NULL && ncell_list == (int)mesh->ncells) {
+      nregular = mesh->regular_cells.size();
+      njump    = mesh->jump_cells.size();
+      regular_cells = (nregular > 0) ? &mesh->regular_cells[0] : NULL;
+      jump_cells    = (njump    > 0) ? &mesh->jump_cells[0]    : NULL;
+      return;
+   }
+
+   const char *regular = &mesh->cell_regular[0];
+   regular_list.clear();
+   jump_list.clear();
+   for (int ilist = 0; ilist < ncell_list; ilist++){
+      int ic = (cell_list != NULL) ? cell_list[ilist] : ilist;
+      if (regular[ic]) {
+         regular_list.push_back(ic);
+      } else {
+         jump_list.push_back(ic);
+      }
+   }
+   nregular = regular_list.size();
+   njump    = jump_list.size();
+   regular_cells = (nregular > 0) ? &regular_list[0] : NULL;
+   jump_cells    = (njump    > 0) ? &jump_list[0]    : NULL;
+}
+
+// Runs the cell loop over cell_list with the neighbor layout of this run. With
+// level buckets the regular cells go through the loop without the refinement
+// jump cases and the rest through the general one.
+double State::calc_finite_difference_list(double deltaT, const int *cell_list, int ncell_list,
+                                          state_t *HUV, state_t *H_new, state_t *U_new, state_t *V_new)
+{
+   if (level_buckets) {
+      vector<int> regular_list, jump_list;
+      const int *regular_cells, *jump_cells;
+      int nregular, njump;
+      bucket_cells_by_level(mesh, cell_list, ncell_list, regular_list, jump_list,
+                            regular_cells, nregular, jump_cells, njump);
+      double mindeltaT = 1000.0;
+      if (nregular > 0) mindeltaT = calc_finite_difference_neighbors(deltaT, regular_cells, nregular, 1, HUV, H_new, U_new, V_new);
+      if (njump    > 0) mindeltaT = min(mindeltaT, calc_finite_difference_neighbors(deltaT, jump_cells, njump, 0, HUV, H_new, U_new, V_new));
+      return(mindeltaT);
+   }
+
+   return(calc_finite_difference_neighbors(deltaT, cell_list, ncell_list, 0, HUV, H_new, U_new, V_new));
+}
+
+// Picks the neighbor layout for the cell loop.
+double State::calc_finite_difference_neighbors(double deltaT, const int *cell_list, int ncell_list, int regular,
+                                               state_t *HUV, state_t *H_new, state_t *U_new, state_t *V_new)
+{
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+   fd_cell_updates += ncell_list;
+   if (regular) {
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+      fd_regular_updates += ncell_list;
+   }
+
+   if (packed_neighbors) {
+      const int *nbrs = &mesh->nbrs[0];
+      neighbor_packed nlft = {nbrs  }, nrht = {nbrs+1}, nbot = {nbrs+2}, ntop = {nbrs+3};
+      return(calc_finite_difference_layout(deltaT, cell_list, ncell_list, regular, nlft, nrht, nbot, ntop, HUV, H_new, U_new, V_new));
+   }
+
+   neighbor_array nlft = {mesh->nlft}, nrht = {mesh->nrht}, nbot = {mesh->nbot}, ntop = {mesh->ntop};
+   return(calc_finite_difference_layout(deltaT, cell_list, ncell_list, regular, nlft, nrht, nbot, ntop, HUV, H_new, U_new, V_new));
+}
+
+// Runs the finite difference, the boundary conditions and the refinement
+// potential back to back on tiles of TILE_CELLS cells in a row, handing the
+// tiles out to the threads as they free up. The cells are in space-filling
+// curve order, so most stencils stay in their tile and the later passes find
+// its data still in cache. A boundary cell filled from outside its tile and a
+// real cell whose refinement stencil leaves its tile or reaches such a
+// boundary cell are left for calc_refine_potential. The refinement potential
+// is kept in tile_mpot until then, reading the new state before the swap.
+double State::calc_finite_difference_tiled(double deltaT, state_t *HUV, state_t *H_new, state_t *U_new, state_t *V_new)
+{
+   int ncells = mesh->ncells;
+   int *nlft  = mesh->nlft;
+   int *nrht  = mesh->nrht;
+   int *nbot  = mesh->nbot;
+   int *ntop  = mesh->ntop;
+   int *level = mesh->level;
+   int *celltype = mesh->celltype;
+
+   if ((int)tile_cell_index.size() < ncells) {
+      int nold = tile_cell_index.size();
+      tile_cell_index.resize(ncells);
+      for (int ic = nold; ic < ncells; ic++){
+         tile_cell_index[ic] = ic;
+      }
+   }
+   tile_mpot.resize(ncells);
+   tile_deferred.resize(ncells);
+
+   int ntiles = (ncells + TILE_CELLS - 1)/TILE_CELLS;
+   double mindeltaT = 1000.0;
+   long long nready_sum = 0, nreal_sum = 0;
+
+   // The loops called for each tile run on the thread of the tile
+   int itile;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(min:mindeltaT) reduction(+:nready_sum, nreal_sum)
+#endif
+   for (itile = 0; itile < ntiles; itile++){
+      int tile_start = itile*TILE_CELLS;
+      int tile_end   = min(tile_start + TILE_CELLS, ncells);
+
+      double tile_deltaT = calc_finite_difference_list(deltaT, &tile_cell_index[tile_start], tile_end - tile_start,
+                                                       HUV, H_new, U_new, V_new);
+      if (tile_deltaT < mindeltaT) mindeltaT = tile_deltaT;
+
+      for (int ic = tile_start; ic < tile_end; ic++){
+         tile_deferred[ic] = 0;
+
+         int nn[4] = {-1, -1, -1, -1};
+         if (mesh->is_left_boundary(ic))   nn[0] = nrht[ic];
+         if (mesh->is_right_boundary(ic))  nn[1] = nlft[ic];
+         if (mesh->is_bottom_boundary(ic)) nn[2] = ntop[ic];
+         if (mesh->is_top_boundary(ic))    nn[3] = nbot[ic];
+         if (nn[0] < 0 && nn[1] < 0 && nn[2] < 0 && nn[3] < 0) continue;
+
+         int in_tile = 1;
+         for (int side = 0; side < 4; side++){
+            if (nn[side] >= 0 && (nn[side] < tile_start || nn[side] >= tile_end)) in_tile = 0;
+         }
+         if (! in_tile) {
+            tile_deferred[ic] = 1;
+            continue;
+         }
+
+         for (int side = 0; side < 4; side++){
+            if (nn[side] < 0) continue;
+            H_new[ic] = H_new[nn[side]];
+            U_new[ic] = (side < 2) ? -U_new[nn[side]] : U_new[nn[side]];
+            V_new[ic] = (side < 2) ? V_new[nn[side]] : -V_new[nn[side]];
+         }
+      }
+
+      vector<int> ready;
+      ready.reserve(tile_end - tile_start);
+      for (int ic = tile_start; ic < tile_end; ic++){
+         if (celltype[ic] != REAL_CELL) {
+            tile_mpot[ic] = 0;
+            continue;
+         }
+         nreal_sum++;
+
+         int nbr[8] = {nlft[ic], nrht[ic], nbot[ic], ntop[ic], -1, -1, -1, -1};
+         int in_tile = 1;
+         for (int side = 0; side < 4; side++){
+            int nn = nbr[side];
+            if (nn < tile_start || nn >= tile_end) {
+               in_tile = 0;
+               break;
+            }
+            if (level[nn] > level[ic]) nbr[side+4] = (side < 2) ? ntop[nn] : nrht[nn];
+         }
+         for (int inbr = 0; inbr < 8 && in_tile; inbr++){
+            int nn = nbr[inbr];
+            if (nn < 0) continue;
+            if (nn < tile_start || nn >= tile_end || tile_deferred[nn] == 1) in_tile = 0;
+         }
+
+         if (in_tile) {
+            ready.push_back(ic);
+         } else {
+            tile_deferred[ic] = 2;
+         }
+      }
+      if (ready.size() > 0) calc_refine_potential_cells(tile_mpot, H_new, &ready[0], ready.size());
+      nready_sum += ready.size();
+   }
+
+   tile_cell_count += nready_sum;
+   tile_cell_total += nreal_sum;
+   tile_refine_ready = 1;
+
+   return(mindeltaT);
+}
+
+// Finishes the refinement potential of a tiled sweep with the cells its tiles
+// left over, once the new state of the neighboring tiles and processors is in.
+void State::calc_refine_potential_tile_edges(vector<int> &mpot)
+{
+   size_t &ncells = mesh->ncells;
+
+   // The caller sizes mpot, to take in the ghost cells across processors
+   size_t nmpot = mpot.size();
+   mpot.swap(tile_mpot);
+   mpot.resize(nmpot, 0);
+   tile_refine_ready = 0;
+
+#ifdef HAVE_MPI
+   if (mesh->numpe > 1) {
+      void *state_arrays[3] = {H, U, V};
+      enum L7_Datatype state_types[3] = {L7_STATE, L7_STATE, L7_STATE};
+      L7_Update_Post(state_arrays, 3, state_types, mesh->cell_handle);
+      L7_Update_Wait(mesh->cell_handle);
+   }
+#endif
+
+   vector<int> boundary_cells, edge_cells;
+   for (uint ic = 0; ic < ncells; ic++){
+      if (tile_deferred[ic] == 1) boundary_cells.push_back(ic);
+      if (tile_deferred[ic] == 2) edge_cells.push_back(ic);
+   }
+
+   if (boundary_cells.size() > 0) apply_boundary_conditions_cells(&boundary_cells[0], boundary_cells.size());
+   if (edge_cells.size() > 0) calc_refine_potential_cells(mpot, H, &edge_cells[0], edge_cells.size());
+}
+
+void State::calc_finite_difference(double deltaT){
+   struct timeval tstart_cpu;
+
+   cpu_timer_start(&tstart_cpu);
+
+   size_t &ncells     = mesh->ncells;
+   size_t &ncells_ghost = mesh->ncells_ghost;
+   if (ncells_ghost < ncells) ncells_ghost = ncells;
+
+   if (tiled_execution && (subcycling || activity_tracking)) {
+      printf("Tiled execution is not supported with subcycling or activity tracking\n");
+      exit(EXIT_FAILURE);
+   }
+
+   if (subcycling) {
+      calc_finite_difference_subcycled(deltaT);
+      cpu_time_finite_difference += cpu_timer_stop(tstart_cpu);
+      return;
+   }
+
+   //printf("\nDEBUG finite diff\n"); 
+
+   // We need to populate the ghost regions since the calc neighbors has just been
+   // established for the mesh shortly before. Unless the face pass needs them
+   // up front, the ghost values stay in flight while the interior cells, whose
+   // stencil reaches no ghost cell, are computed.
+   int overlap_halo = 0;
+#ifdef HAVE_MPI
+   if (mesh->numpe > 1) {
+      apply_boundary_conditions_local();
+
+      H=(state_t *)state_memory.memory_realloc(ncells_ghost, sizeof(state_t), H);
+      U=(state_t *)state_memory.memory_realloc(ncells_ghost, sizeof(state_t), U);
+      V=(state_t *)state_memory.memory_realloc(ncells_ghost, sizeof(state_t), V);
+
+      // The ghost cells count as tracked should rezone reach them
+      if (Active != NULL) {
+         Active=(state_t *)state_memory.memory_realloc(ncells_ghost, sizeof(state_t), Active);
+         for (uint ic=ncells; ic<ncells_ghost; ic++){
+            Active[ic] = 1.0;
+         }
+      }
+
+      if (face_fluxes || tiled_execution) {
+         L7_Update(&H[0], L7_STATE, mesh->cell_handle);
+         L7_Update(&U[0], L7_STATE, mesh->cell_handle);
+         L7_Update(&V[0], L7_STATE, mesh->cell_handle);
+
+         apply_boundary_conditions_ghost();
+      } else {
+         void *state_arrays[3] = {H, U, V};
+         enum L7_Datatype state_types[3] = {L7_STATE, L7_STATE, L7_STATE};
+         L7_Update_Post(state_arrays, 3, state_types, mesh->cell_handle);
+         overlap_halo = 1;
+      }
+   } else {
+      apply_boundary_conditions();
+   }
+#else
+   apply_boundary_conditions();
+#endif
+
+   // With activity tracking only the cells near one not at rest are stepped
+   vector<int> active_interior, active_border;
+   if (activity_tracking) {
+      calc_active_cells();
+      if (overlap_halo) {
+         select_active_cells(active_interior, active_hops, ACTIVE_STENCIL_DEPTH,
+                             (mesh->interior_cells.size() > 0) ? &mesh->interior_cells[0] : NULL, mesh->interior_cells.size());
+         select_active_cells(active_border,   active_hops, ACTIVE_STENCIL_DEPTH,
+                             (mesh->border_cells.size() > 0) ? &mesh->border_cells[0] : NULL, mesh->border_cells.size());
+      } else {
+         select_active_cells(active_interior, active_hops, ACTIVE_STENCIL_DEPTH, NULL, ncells);
+      }
+   }
+
+   // The new values go into spare buffers that trade places with the state
+   // arrays at the end, so steady-state cycles do not touch the heap here
+   int flags = HOST_MANAGED_MEMORY | SCRATCH_MEMORY;
+#if defined (HAVE_J7)
+   if (mesh->parallel) flags = LOAD_BALANCE_MEMORY | SCRATCH_MEMORY;
+#endif
+   state_t *H_new = state_scratch_buffer(state_memory, "H_new", ncells_ghost, sizeof(state_t), flags);
+   state_t *U_new = state_scratch_buffer(state_memory, "U_new", ncells_ghost, sizeof(state_t), flags);
+   state_t *V_new = state_scratch_buffer(state_memory, "V_new", ncells_ghost, sizeof(state_t), flags);
+
+   // Gather H, U and V of each cell, ghost cells included, into one record for
+   // the stencil. The records are rebuilt from the state arrays every cycle, so
+   // rezone, load balancing and the halo update only ever move the arrays.
+   state_t *HUV = NULL;
+   if (interleaved_state) {
+      HUV = state_scratch_buffer(state_memory, "HUV", ncells_ghost, 3*sizeof(state_t), flags);
+      interleave_state(HUV, H, U, V, NULL, 0, overlap_halo ? ncells : ncells_ghost);
+   }
+
+   if (face_fluxes) {
+      mesh->calc_face_list();
+      if (float_kernels)
+         calc_face_fluxes<float>(deltaT);
+      else
+         calc_face_fluxes<double>(deltaT);
+   }
+
+   if (packed_neighbors) mesh->calc_packed_neighbors(ncells_ghost);
+   if (level_buckets) mesh->calc_regular_cells();
+
+   vector<int> &interior_cells = activity_tracking ? active_interior : mesh->interior_cells;
+   vector<int> &border_cells   = activity_tracking ? active_border   : mesh->border_cells;
+
+   double mindeltaT;
+   if (overlap_halo) {
+      int ninterior = interior_cells.size();
+      int nborder   = border_cells.size();
+      const int *interior = (ninterior > 0) ? &interior_cells[0] : NULL;
+      const int *border   = (nborder   > 0) ? &border_cells[0]   : NULL;
+
+      mindeltaT = calc_finite_difference_list(deltaT, interior, ninterior, HUV, H_new, U_new, V_new);
+
+#ifdef HAVE_MPI
+      L7_Update_Wait(mesh->cell_handle);
+#endif
+      apply_boundary_conditions_ghost();
+
+      // The boundary cells filled from ghost cells are all border cells
+      if (HUV != NULL) {
+         interleave_state(HUV, H, U, V, NULL, ncells, ncells_ghost);
+         interleave_state(HUV, H, U, V, border, 0, nborder);
+      }
+
+      mindeltaT = min(mindeltaT, calc_finite_difference_list(deltaT, border, nborder, HUV, H_new, U_new, V_new));
+   } else if (tiled_execution && mesh->have_boundary) {
+      mindeltaT = calc_finite_difference_tiled(deltaT, HUV, H_new, U_new, V_new);
+   } else if (activity_tracking) {
+      int nactive = active_interior.size();
+      mindeltaT = calc_finite_difference_list(deltaT, (nactive > 0) ? &active_interior[0] : NULL, nactive, HUV, H_new, U_new, V_new);
+   } else {
+      mindeltaT = calc_finite_difference_list(deltaT, NULL, ncells, HUV, H_new, U_new, V_new);
+   }
+
+   // The next timestep holds until the mesh is rezoned. Across processors the
+   // minimum is reduced in the background and collected in calc_refine_potential.
+   if (fused_timestep && timestep_sigma > 0.0) {
+      next_deltaT = mindeltaT;
+      next_deltaT_rezone = mesh->cpu_rezone_counter;
+#ifdef HAVE_MPI
+      if (mesh->parallel) {
+         next_deltaT_local = mindeltaT;
+#if MPI_VERSION >= 3
+         MPI_Iallreduce(&next_deltaT_local, &next_deltaT, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD, &next_deltaT_request);
+#else
+         MPI_Allreduce(&next_deltaT_local, &next_deltaT, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+#endif
+      }
+#endif
+   }
+
+   // Swap H and H_new. The memory moves with its characteristics and the names
+   // stay, so the old H becomes the spare buffer for the next cycle. With
+   // activity tracking the stepped cells are copied back instead, so the cells
+   // at rest keep their values.
+   if (activity_tracking) {
+      if (active_interior.size() > 0) copy_state_cells(H, U, V, H_new, U_new, V_new, &active_interior[0], active_interior.size());
+      if (active_border.size()   > 0) copy_state_cells(H, U, V, H_new, U_new, V_new, &active_border[0],   active_border.size());
+   } else {
+      state_memory.memory_swap((void **)&H, (void **)&H_new);
+      state_memory.memory_swap((void **)&U, (void **)&U_new);
+      state_memory.memory_swap((void **)&V, (void **)&V_new);
+   }
+
+   //state_memory.memory_report();
+   //printf("DEBUG end finite diff\n\n"); 
+
+   cpu_time_finite_difference += cpu_timer_stop(tstart_cpu);
+}
+
+// Coarsest level whose step starts on substep isub of a subcycled step.
+static int subcycle_first_level(int isub, int levmx)
+{
+   int lev = levmx;
+   while (lev > 0 && isub % (1 << (levmx-lev+1)) == 0) lev--;
+   return(lev);
+}
+
+// Advances the state by deltaT with each level stepping by its own timestep,
+// deltaT halved for each level of refinement. The step is taken in 2^levmx
+// substeps of the finest timestep and a level steps on the substeps its
+// timestep starts on, from the values its neighbors have at that point.
+// Across a coarse/fine face the coarse cell takes one step to the two of the
+// finer cells, so what it sent through the face is not what they received.
+// Both sides go into the flux register and the coarse cell is refluxed when
+// the two levels are back in step, which keeps mass and momentum conserved.
+void State::calc_finite_difference_subcycled(double deltaT)
+{
+   size_t &ncells = mesh->ncells;
+   int levmx      = mesh->levmx;
+   int *level     = mesh->level;
+   int *nlft      = mesh->nlft;
+   int *nrht      = mesh->nrht;
+   int *nbot      = mesh->nbot;
+   int *ntop      = mesh->ntop;
+
+   vector<real_t> &lev_deltax = mesh->lev_deltax;
+   vector<real_t> &lev_deltay = mesh->lev_deltay;
+
+   if (mesh->numpe > 1) {
+      printf("Subcycling is only supported on one processor\n");
+      exit(EXIT_FAILURE);
+   }
+   if (face_fluxes) {
+      printf("Subcycling is not supported with the face-based finite difference\n");
+      exit(EXIT_FAILURE);
+   }
+   if (activity_tracking) {
+      printf("Subcycling is not supported with activity tracking\n");
+      exit(EXIT_FAILURE);
+   }
+
+   // Bucket the cells by level, finest first, so the cells at level lev and
+   // finer are the first lev_ncells[lev] of the list
+   vector<int> lev_ncells(levmx+2, 0);
+   for (uint ic=0; ic<ncells; ic++){
+      lev_ncells[level[ic]]++;
+   }
+   for (int lev=levmx; lev>=0; lev--){
+      lev_ncells[lev] += lev_ncells[lev+1];
+   }
+   vector<int> lev_next(lev_ncells.begin()+1, lev_ncells.end());
+   vector<int> cells(ncells);
+   for (uint ic=0; ic<ncells; ic++){
+      cells[lev_next[level[ic]]++] = ic;
+   }
+
+   lev_deltaT.resize(levmx+1);
+   for (int lev=0; lev<=levmx; lev++){
+      lev_deltaT[lev] = deltaT/(double)(1 << lev);
+   }
+   flux_register.assign(12*ncells, 0.0);
+
+   int flags = HOST_MANAGED_MEMORY | SCRATCH_MEMORY;
+   state_t *H_new = state_scratch_buffer(state_memory, "H_new", ncells, sizeof(state_t), flags);
+   state_t *U_new = state_scratch_buffer(state_memory, "U_new", ncells, sizeof(state_t), flags);
+   state_t *V_new = state_scratch_buffer(state_memory, "V_new", ncells, sizeof(state_t), flags);
+
+   state_t *HUV = NULL;
+   if (interleaved_state) {
+      HUV = state_scratch_buffer(state_memory, "HUV", ncells, 3*sizeof(state_t), flags);
+      interleave_state(HUV, H, U, V, NULL, 0, ncells);
+   }
+
+   if (packed_neighbors) mesh->calc_packed_neighbors(ncells);
+   if (level_buckets) mesh->calc_regular_cells();
+
+#ifdef HAVE_MIXED_PRECISION
+   int *celltype = mesh->celltype;
+   double storage_drift = 0.0;
+#endif
+
+   int nsub = 1 << levmx;
+   for (int isub = 0; isub < nsub; isub++){
+      // The cells stepping on this substep are written into the new arrays
+      // and copied back, so the other cells keep their values
+      int nactive = lev_ncells[subcycle_first_level(isub, levmx)];
+
+      apply_boundary_conditions_cells(&cells[0], nactive);
+      if (HUV != NULL) interleave_state(HUV, H, U, V, &cells[0], 0, nactive);
+
+      calc_finite_difference_list(deltaT, &cells[0], nactive, HUV, H_new, U_new, V_new);
+
+      copy_state_cells(H, U, V, H_new, U_new, V_new, &cells[0], nactive);
+      if (HUV != NULL) interleave_state(HUV, H, U, V, &cells[0], 0, nactive);
+
+      subcycle_cell_updates += nactive;
+      subcycle_global_updates += ncells;
+
+      // Reflux the coarse cells of the levels whose step ends here against
+      // the finer cells next to them. A finer cell faces a single coarse cell
+      // on a side, so each register entry is only touched once.
+      int ifirst = lev_ncells[levmx];
+      int ilast  = lev_ncells[subcycle_first_level(isub+1, levmx)];
+#if defined(_OPENMP) && defined(HAVE_MIXED_PRECISION)
+#pragma omp parallel for reduction(+:storage_drift)
+#elif defined(_OPENMP)
+#pragma omp parallel for
+#endif
+      for (int ilist = ifirst; ilist < ilast; ilist++){
+         int ic  = cells[ilist];
+         int lev = level[ic];
+         double area = lev_deltax[lev]*lev_deltay[lev];
+         int nbr[4] = {nlft[ic], nrht[ic], nbot[ic], ntop[ic]};
+
+         for (int side = 0; side < 4; side++){
+            int nf = nbr[side];
+            if (level[nf] <= lev) continue;
+
+            // The second finer cell is above or to the right of the first and
+            // both face this cell with the opposite side
+            int nf2 = (side < 2) ? ntop[nf] : nrht[nf];
+            double *reg  = &flux_register[12*ic  + 3*side];
+            double *reg1 = &flux_register[12*nf  + 3*(side^1)];
+            double *reg2 = &flux_register[12*nf2 + 3*(side^1)];
+
+            double Hfix = H[ic] - (reg[0] + reg1[0] + reg2[0])/area;
+            H[ic] = Hfix;
+            U[ic] -= (reg[1] + reg1[1] + reg2[1])/area;
+            V[ic] -= (reg[2] + reg1[2] + reg2[2])/area;
+#ifdef HAVE_MIXED_PRECISION
+            if (celltype[ic] == REAL_CELL) storage_drift += ((double)H[ic] - Hfix)*area;
+#endif
+
+            for (int ivar = 0; ivar < 3; ivar++){
+               reg[ivar]  = 0.0;
+               reg1[ivar] = 0.0;
+               reg2[ivar] = 0.0;
+            }
+         }
+      }
+   }
+
+#ifdef HAVE_MIXED_PRECISION
+   storage_mass_drift += storage_drift;
+#endif
+}
+
+#ifdef HAVE_OPENCL
+void State::gpu_calc_finite_difference(double deltaT)
+{
+   struct timeval tstart_cpu;
+   cpu_timer_start(&tstart_cpu);
+
+   cl_command_queue command_queue = ezcl_get_command_queue();
+
+   //cl_mem dev_ptr = NULL;
+
+   size_t &ncells    = mesh->ncells;
+   size_t &ncells_ghost = mesh->ncells_ghost;
+   if (ncells_ghost < ncells) ncells_ghost = ncells;
+   int &levmx           = mesh->levmx;
+   cl_mem &dev_celltype = mesh->dev_celltype;
+   cl_mem &dev_nlft     = mesh->dev_nlft;
+   cl_mem &dev_nrht     = mesh->dev_nrht;
+   cl_mem &dev_nbot     = mesh->dev_nbot;
+   cl_mem &dev_ntop     = mesh->dev_ntop;
+   cl_mem &dev_level    = mesh->dev_level;
+   cl_mem &dev_levdx    = mesh->dev_levdx;
+   cl_mem &dev_levdy    = mesh->dev_levdy;
+
+   assert(dev_H);
+   assert(dev_U);
+   assert(dev_V);
+   assert(dev_nlft);
+   assert(dev_nrht);
+   assert(dev_nbot);
+   assert(dev_ntop);
+   assert(dev_level);
+   assert(dev_levdx);
+   assert(dev_levdy);
+
+   cl_mem dev_H_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_H_new"));
+   cl_mem dev_U_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_U_new"));
+   cl_mem dev_V_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_V_new"));
+ 
+   size_t local_work_size = 128;
+   size_t global_work_size = ((ncells+local_work_size - 1) /local_work_size) * local_work_size;
+
+#ifdef HAVE_MPI
+   if (mesh->numpe > 1) {
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 0, sizeof(cl_int), &ncells);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 1, sizeof(cl_mem), &dev_celltype);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 2, sizeof(cl_mem), &dev_nlft);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 3, sizeof(cl_mem), &dev_nrht);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 4, sizeof(cl_mem), &dev_ntop);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 5, sizeof(cl_mem), &dev_nbot);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 6, sizeof(cl_mem), &dev_H);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 7, sizeof(cl_mem), &dev_U);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_local, 8, sizeof(cl_mem), &dev_V);
+      ezcl_enqueue_ndrange_kernel(command_queue, kernel_apply_boundary_conditions_local,   1, NULL, &global_work_size, &local_work_size, NULL);
+    
+        /*
+        __kernel void copy_state_data_cl(
+                         const int    isize,         // 0
+                __global      real_t  *H,            // 1
+                __global      real_t  *U,            // 2
+                __global      real_t  *V,            // 3
+                __global      real_t  *H_new,        // 4
+                __global      real_t  *U_new,        // 5
+                __global      real_t  *V_new)        // 6
+        */
+
+      ezcl_set_kernel_arg(kernel_copy_state_data, 0, sizeof(cl_int), (void *)&ncells);
+      ezcl_set_kernel_arg(kernel_copy_state_data, 1, sizeof(cl_mem), (void *)&dev_H);
+      ezcl_set_kernel_arg(kernel_copy_state_data, 2, sizeof(cl_mem), (void *)&dev_U);
+      ezcl_set_kernel_arg(kernel_copy_state_data, 3, sizeof(cl_mem), (void *)&dev_V);
+      ezcl_set_kernel_arg(kernel_copy_state_data, 4, sizeof(cl_mem), (void *)&dev_H_new);
+      ezcl_set_kernel_arg(kernel_copy_state_data, 5, sizeof(cl_mem), (void *)&dev_U_new);
+      ezcl_set_kernel_arg(kernel_copy_state_data, 6, sizeof(cl_mem), (void *)&dev_V_new);
+
+      //ezcl_enqueue_ndrange_kernel(command_queue, kernel_copy_state_data,   1, NULL, &global_work_size, &local_work_size, &copy_state_data_event);
+      ezcl_enqueue_ndrange_kernel(command_queue, kernel_copy_state_data,   1, NULL, &global_work_size, &local_work_size, NULL);
+
+      dev_H = (cl_mem)gpu_state_memory.memory_replace(dev_H, dev_H_new);
+      dev_U = (cl_mem)gpu_state_memory.memory_replace(dev_U, dev_U_new);
+      dev_V = (cl_mem)gpu_state_memory.memory_replace(dev_V, dev_V_new);
+
+      L7_Dev_Update(dev_H, L7_REAL, mesh->cell_handle);
+      L7_Dev_Update(dev_U, L7_REAL, mesh->cell_handle);
+      L7_Dev_Update(dev_V, L7_REAL, mesh->cell_handle);
+
+      dev_H_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_H_new"));
+      dev_U_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_U_new"));
+      dev_V_new = (cl_mem)gpu_state_memory.memory_malloc(ncells_ghost, sizeof(cl_real), DEVICE_REGULAR_MEMORY, const_cast<char *>("dev_V_new"));
+
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 0, sizeof(cl_int), &ncells);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 1, sizeof(cl_mem), &dev_celltype);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 2, sizeof(cl_mem), &dev_nlft);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 3, sizeof(cl_mem), &dev_nrht);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 4, sizeof(cl_mem), &dev_ntop);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 5, sizeof(cl_mem), &dev_nbot);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 6, sizeof(cl_mem), &dev_H);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 7, sizeof(cl_mem), &dev_U);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions_ghost, 8, sizeof(cl_mem), &dev_V);
+      ezcl_enqueue_ndrange_kernel(command_queue, kernel_apply_boundary_conditions_ghost,   1, NULL, &global_work_size, &local_work_size, NULL);
+   } else {
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 0, sizeof(cl_int), &ncells);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 1, sizeof(cl_mem), &dev_celltype);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 2, sizeof(cl_mem), &dev_nlft);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 3, sizeof(cl_mem), &dev_nrht);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 4, sizeof(cl_mem), &dev_ntop);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 5, sizeof(cl_mem), &dev_nbot);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 6, sizeof(cl_mem), &dev_H);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 7, sizeof(cl_mem), &dev_U);
+      ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 8, sizeof(cl_mem), &dev_V);
+      ezcl_enqueue_ndrange_kernel(command_queue, kernel_apply_boundary_conditions,   1, NULL, &global_work_size, &local_work_size, NULL);
+   }
+#else
+   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 0, sizeof(cl_int), &ncells);
+   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 1, sizeof(cl_mem), &dev_celltype);
+   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 2, sizeof(cl_mem), &dev_nlft);
+   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 3, sizeof(cl_mem), &dev_nrht);
+   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 4, sizeof(cl_mem), &dev_ntop);
+   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 5, sizeof(cl_mem), &dev_nbot);
+   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 6, sizeof(cl_mem), &dev_H);
+   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 7, sizeof(cl_mem), &dev_U);
+   ezcl_set_kernel_arg(kernel_apply_boundary_conditions, 8, sizeof(cl_mem), &dev_V);
+   ezcl_enqueue_ndrange_kernel(command_queue, kernel_apply_boundary_conditions,   1, NULL, &global_work_size, &local_work_size, NULL);
+#endif
+
+     /*
+     __kernel void calc_finite_difference_cl(
+                      const int    ncells,   // 0  Total number of cells.
+                      const int    lvmax,    // 1  Maximum level
              __global       real_t  *H,        // 2
              __global       real_t  *U,        // 3
              __global       real_t  *V,        // 4
@@ -1882,55 +3158,42 @@ void State::symmetry_check(const char *string, vector<int> sym_index, double eps
 
 }
 
-size_t State::calc_refine_potential(vector<int> &mpot,int &icount, int &jcount)
+// Refinement potential of the cells in cell_list, or of the first ncell_list
+// cells when cell_list is NULL.
+void State::calc_refine_potential_cells(vector<int> &mpot, const state_t *H, const int *cell_list, int ncell_list)
 {
-   struct timeval tstart_cpu;
-   cpu_timer_start(&tstart_cpu);
+   if (level_buckets) {
+      vector<int> regular_list, jump_list;
+      const int *regular_cells, *jump_cells;
+      int nregular, njump;
+      bucket_cells_by_level(mesh, cell_list, ncell_list, regular_list, jump_list,
+                            regular_cells, nregular, jump_cells, njump);
+      if (nregular > 0) calc_refine_potential_stencil<1>(mpot, H, regular_cells, nregular);
+      if (njump    > 0) calc_refine_potential_stencil<0>(mpot, H, jump_cells, njump);
+      return;
+   }
 
-   struct timeval tstart_lev2;
-   if (TIMING_LEVEL >= 2) cpu_timer_start(&tstart_lev2);
+   calc_refine_potential_stencil<0>(mpot, H, cell_list, ncell_list);
+}
 
-   size_t &ncells     = mesh->ncells;
+// Refinement potential of the cells in cell_list, or of the first ncell_list
+// cells when cell_list is NULL, from the gradients of H. With REGULAR set all
+// of them are regular cells and the averaging over finer neighbors drops out.
+template <int REGULAR>
+void State::calc_refine_potential_stencil(vector<int> &mpot, const state_t *H, const int *cell_list, int ncell_list)
+{
    int *nlft  = mesh->nlft;
    int *nrht  = mesh->nrht;
    int *nbot  = mesh->nbot;
    int *ntop  = mesh->ntop;
    int *level = mesh->level;
 
-   icount=0;
-   jcount=0;
-
-#ifdef HAVE_MPI
-   // We need to update the ghost regions and boundary regions for the state
-   // variables since they were changed in the finite difference routine. We
-   // want to use the updated values for refinement decisions
-   if (mesh->numpe > 1) {
-      apply_boundary_conditions_local();
-
-      L7_Update(&H[0], L7_REAL, mesh->cell_handle);
-      L7_Update(&U[0], L7_REAL, mesh->cell_handle);
-      L7_Update(&V[0], L7_REAL, mesh->cell_handle);
-
-      apply_boundary_conditions_ghost();
-   } else {
-      apply_boundary_conditions();
-   }
-#else
-   apply_boundary_conditions();
-#endif
-
-   int ic;
-#ifdef HAVE_OPENMP
+   int ilist;
 #ifdef _OPENMP
-#ifdef __INTEL_COMPILER
-#pragma omp parallel for \
-      private(ic) \
-      shared(ncells, nlft, nrht, nbot, ntop, level, mpot) \
-      default(none)
-#endif
-#endif
+#pragma omp parallel for private(ilist)
 #endif
-   for (ic=0; ic<(int)ncells; ic++) {
+   for (ilist=0; ilist<ncell_list; ilist++) {
+      int ic = (cell_list != NULL) ? cell_list[ilist] : ilist;
 
       if (mesh->celltype[ic] != REAL_CELL) continue;
 
@@ -1943,7 +3206,7 @@ size_t State::calc_refine_potential(vector<int> &mpot,int &icount, int &jcount)
       //double Ul = U[nl];
       //double Vl = V[nl];
 
-      if (level[nl] > level[ic]){
+      if (! REGULAR && level[nl] > level[ic]){
          int nlt = ntop[nl];
          Hl = 0.5 * (Hl + H[nlt]);
       }
@@ -1953,7 +3216,7 @@ size_t State::calc_refine_potential(vector<int> &mpot,int &icount, int &jcount)
       //double Ur = U[nr];
       //double Vr = V[nr];
 
-      if (level[nr] > level[ic]){
+      if (! REGULAR && level[nr] > level[ic]){
          int nrt = ntop[nr];
          Hr = 0.5 * (Hr + H[nrt]);
       }
@@ -1963,7 +3226,7 @@ size_t State::calc_refine_potential(vector<int> &mpot,int &icount, int &jcount)
       //double Ub = U[nb];
       //double Vb = V[nb];
 
-      if (level[nb] > level[ic]){
+      if (! REGULAR && level[nb] > level[ic]){
          int nbr = nrht[nb];
          Hb = 0.5 * (Hb + H[nbr]);
       }
@@ -1973,7 +3236,7 @@ size_t State::calc_refine_potential(vector<int> &mpot,int &icount, int &jcount)
       //double Ut = U[nt];
       //double Vt = V[nt];
 
-      if (level[nt] > level[ic]){
+      if (! REGULAR && level[nt] > level[ic]){
          int ntr = nrht[nt];
          Ht = 0.5 * (Ht + H[ntr]);
       }
@@ -2024,11 +3287,97 @@ size_t State::calc_refine_potential(vector<int> &mpot,int &icount, int &jcount)
       }
       //if (mpot[ic]) printf("DEBUG cpu cell is %d mpot %d\n",ic,mpot[ic]);
    }
+}
+
+size_t State::calc_refine_potential(vector<int> &mpot,int &icount, int &jcount)
+{
+   struct timeval tstart_cpu;
+   cpu_timer_start(&tstart_cpu);
+
+   struct timeval tstart_lev2;
+   if (TIMING_LEVEL >= 2) cpu_timer_start(&tstart_lev2);
+
+   size_t &ncells     = mesh->ncells;
+
+   icount=0;
+   jcount=0;
+
+   // The boundary cells are gone from the mesh without them
+   if (level_buckets && ! mesh->have_boundary) mesh->calc_regular_cells();
+
+   if (tile_refine_ready) {
+      calc_refine_potential_tile_edges(mpot);
+   } else {
+      // With activity tracking the cells that are not tracked are flat and at
+      // rest, so they coarsen where they can without working out the gradients
+      vector<int> tracked_interior, tracked_border;
+      if (activity_tracking) {
+         int *level = mesh->level;
+         int *celltype = mesh->celltype;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+         for (int ic=0; ic<(int)ncells; ic++){
+            if (celltype[ic] == REAL_CELL && active_hops[ic] == 0) mpot[ic] = (level[ic] > 0) ? -1 : 0;
+         }
+
+         int track_depth = 2*ACTIVE_STENCIL_DEPTH + 1;
+         if (mesh->numpe > 1) {
+            select_active_cells(tracked_interior, active_hops, track_depth,
+                                (mesh->interior_cells.size() > 0) ? &mesh->interior_cells[0] : NULL, mesh->interior_cells.size());
+            select_active_cells(tracked_border,   active_hops, track_depth,
+                                (mesh->border_cells.size() > 0) ? &mesh->border_cells[0] : NULL, mesh->border_cells.size());
+         } else {
+            select_active_cells(tracked_interior, active_hops, track_depth, NULL, ncells);
+         }
+      }
+      vector<int> &interior_cells = activity_tracking ? tracked_interior : mesh->interior_cells;
+
+#ifdef HAVE_MPI
+      vector<int> &border_cells   = activity_tracking ? tracked_border   : mesh->border_cells;
+      // We need to update the ghost regions and boundary regions for the state
+      // variables since they were changed in the finite difference routine. We
+      // want to use the updated values for refinement decisions. The interior
+      // cells do not need them and are done while the messages are in flight.
+      if (mesh->numpe > 1) {
+         apply_boundary_conditions_local();
+
+         void *state_arrays[3] = {H, U, V};
+         enum L7_Datatype state_types[3] = {L7_STATE, L7_STATE, L7_STATE};
+         L7_Update_Post(state_arrays, 3, state_types, mesh->cell_handle);
+
+         int ninterior = interior_cells.size();
+         int nborder   = border_cells.size();
+         calc_refine_potential_cells(mpot, H, (ninterior > 0) ? &interior_cells[0] : NULL, ninterior);
+
+         L7_Update_Wait(mesh->cell_handle);
+
+         apply_boundary_conditions_ghost();
+
+         calc_refine_potential_cells(mpot, H, (nborder > 0) ? &border_cells[0] : NULL, nborder);
+      } else {
+         apply_boundary_conditions();
+         if (activity_tracking)
+            calc_refine_potential_cells(mpot, H, (interior_cells.size() > 0) ? &interior_cells[0] : NULL, interior_cells.size());
+         else
+            calc_refine_potential_cells(mpot, H, NULL, ncells);
+      }
+#else
+      apply_boundary_conditions();
+      if (activity_tracking)
+         calc_refine_potential_cells(mpot, H, (interior_cells.size() > 0) ? &interior_cells[0] : NULL, interior_cells.size());
+      else
+         calc_refine_potential_cells(mpot, H, NULL, ncells);
+#endif
+   }
 
    if (TIMING_LEVEL >= 2) {
       cpu_time_calc_mpot += cpu_timer_stop(tstart_lev2);
    }
 
+   // The reduction of the next timestep has been overlapped with the above
+   wait_next_deltaT();
+
    int newcount = mesh->refine_smooth(mpot, icount, jcount);
    //printf("DEBUG -- after refine smooth in file %s line %d icount %d jcount %d newcount %d\n",__FILE__,__LINE__,icount,jcount,newcount);
 
@@ -2292,17 +3641,47 @@ double State::mass_sum(int enhanced_precision_sum)
       struct esum_type global;
 #endif
 
-      local.sum = 0.0;
-      local.correction = 0.0;
-      int ic;
-      for (ic = 0; ic < (int)ncells; ic++) {
-         if (celltype[ic] == REAL_CELL) {
-            //  Exclude boundary cells.
-            corrected_next_term= H[ic]*mesh->lev_deltax[level[ic]]*mesh->lev_deltay[level[ic]] + local.correction;
-            new_sum            = local.sum + local.correction;
-            local.correction   = corrected_next_term - (new_sum - local.sum);
-            local.sum          = new_sum;
+      // Each thread sums a fixed block of cells and the partial sums are added
+      // in thread order, so the result only depends on the number of threads.
+      int nthreads = 1;
+#ifdef _OPENMP
+      nthreads = omp_get_max_threads();
+#endif
+      vector<struct esum_type> thread_sum(nthreads);
+
+#ifdef _OPENMP
+#pragma omp parallel private(corrected_next_term, new_sum)
+#endif
+      {
+         int tid = 0;
+#ifdef _OPENMP
+         tid = omp_get_thread_num();
+#endif
+         struct esum_type partial;
+         partial.sum = 0.0;
+         partial.correction = 0.0;
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+         for (int ic = 0; ic < (int)ncells; ic++) {
+            if (celltype[ic] == REAL_CELL) {
+               //  Exclude boundary cells.
+               corrected_next_term= H[ic]*mesh->lev_deltax[level[ic]]*mesh->lev_deltay[level[ic]] + partial.correction;
+               new_sum            = partial.sum + partial.correction;
+               partial.correction = corrected_next_term - (new_sum - partial.sum);
+               partial.sum        = new_sum;
+            }
          }
+         thread_sum[tid] = partial;
+      }
+
+      local = thread_sum[0];
+      for (int it = 1; it < nthreads; it++) {
+         corrected_next_term= thread_sum[it].sum + thread_sum[it].correction + local.correction;
+         new_sum            = local.sum + local.correction;
+         local.correction   = corrected_next_term - (new_sum - local.sum);
+         local.sum          = new_sum;
       }
 
 #ifdef HAVE_MPI
@@ -2364,6 +3743,9 @@ double State::mass_sum(int enhanced_precision_sum)
 #endif
    } else if (enhanced_precision_sum == SUM_REGULAR) {
       //printf("DEBUG -- regular_sum\n");
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:summer)
+#endif
       for (uint ic=0; ic < ncells; ic++){
          if (celltype[ic] == REAL_CELL) {
             summer += H[ic]*mesh->lev_deltax[level[ic]]*mesh->lev_deltay[level[ic]];
@@ -2587,6 +3969,21 @@ void State::gpu_do_load_balance_local(size_t &numcells){
 
 static double total_time = 0.0;
 
+#ifdef HAVE_MIXED_PRECISION
+// Reports the mass gained or lost so far by storing the finite difference
+// results in float instead of double, against the total mass H_sum.
+void State::output_storage_drift(double H_sum)
+{
+   double drift = storage_mass_drift;
+#ifdef HAVE_MPI
+   if (mesh->parallel) MPI_Allreduce(&storage_mass_drift, &drift, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+   if (mesh->mype == 0) {
+      printf("   Mass drift from float state storage %12.6lg relative %12.6lg\n", drift, drift/H_sum);
+   }
+}
+#endif
+
 void State::output_timing_info(int do_cpu_calc, int do_gpu_calc, double elapsed_time)
 {
    int &mype  = mesh->mype;
@@ -2629,6 +4026,17 @@ void State::output_timing_info(int do_cpu_calc, int do_gpu_calc, double elapsed_
             printf("CPU: Device compute           time was\t%8.4f \ts\n",     cpu_time_compute);
             printf("CPU:  state->set_timestep      time was\t %8.4f\ts\n",     get_cpu_time_set_timestep() );
             printf("CPU:  state->finite_difference time was\t %8.4f\ts\n",     get_cpu_time_finite_difference() );
+            if (subcycling)
+               printf("CPU:    subcycled cell updates       \t %8.4f\tpercent of a global timestep\n", (double)subcycle_cell_updates/(double)subcycle_global_updates*100.0 );
+            if (tiled_execution)
+               printf("CPU:    cells finished in their tile \t %8.4f\tpercent\n", (double)tile_cell_count/(double)tile_cell_total*100.0 );
+            if (activity_tracking)
+               printf("CPU:    active cell fraction         \t %8.4f\tpercent\n", (double)active_cell_count/(double)active_cell_total*100.0 );
+            if (level_buckets) {
+               printf("CPU:    regular stencil cells        \t %8.4f\tpercent\n", (double)fd_regular_updates/(double)fd_cell_updates*100.0 );
+               printf("CPU:    cell updates per second      \t %8.4g\twith the %s kernels\n",
+                  (double)fd_cell_updates/get_cpu_time_finite_difference(), simd_kernels ? simd_isa_name(simd_isa_detect()) : "scalar" );
+            }
             printf("CPU:  mesh->refine_potential   time was\t %8.4f\ts\n",     get_cpu_time_refine_potential() );
             printf("CPU:    mesh->calc_mpot          time was\t %8.4f\ts\n",     get_cpu_time_calc_mpot() );
             printf("CPU:    mesh->refine_smooth      time was\t %8.4f\ts\n",     mesh->get_cpu_time_refine_smooth() );
@@ -2715,6 +4123,39 @@ void State::output_timing_info(int do_cpu_calc, int do_gpu_calc, double elapsed_
          parallel_timer_output(numpe,mype,"CPU: Device compute           time was" ,cpu_time_compute);
          parallel_timer_output(numpe,mype,"CPU:  state->set_timestep      time was",get_cpu_time_set_timestep() );
          parallel_timer_output(numpe,mype,"CPU:  state->finite_difference time was",get_cpu_time_finite_difference() );
+         if (tiled_execution) {
+            long long global_counts[2] = {tile_cell_count, tile_cell_total};
+#ifdef HAVE_MPI
+            long long tile_counts[2] = {tile_cell_count, tile_cell_total};
+            MPI_Reduce(tile_counts, global_counts, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
+            if (mype == 0) printf("CPU:    cells finished in their tile \t %8.4f\tpercent\n", (double)global_counts[0]/(double)global_counts[1]*100.0 );
+         }
+         if (activity_tracking) {
+            long long global_counts[2] = {active_cell_count, active_cell_total};
+#ifdef HAVE_MPI
+            long long active_counts[2] = {active_cell_count, active_cell_total};
+            MPI_Reduce(active_counts, global_counts, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
+            if (mype == 0) printf("CPU:    active cell fraction         \t %8.4f\tpercent\n", (double)global_counts[0]/(double)global_counts[1]*100.0 );
+         }
+         if (level_buckets) {
+            long long global_counts[2] = {fd_cell_updates, fd_regular_updates};
+#ifdef HAVE_MPI
+            long long update_counts[2] = {fd_cell_updates, fd_regular_updates};
+            MPI_Reduce(update_counts, global_counts, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
+            double max_time_finite_difference = get_cpu_time_finite_difference();
+#ifdef HAVE_MPI
+            double time_finite_difference = max_time_finite_difference;
+            MPI_Reduce(&time_finite_difference, &max_time_finite_difference, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+#endif
+            if (mype == 0) {
+               printf("CPU:    regular stencil cells        \t %8.4f\tpercent\n", (double)global_counts[1]/(double)global_counts[0]*100.0 );
+               printf("CPU:    cell updates per second      \t %8.4g\twith the %s kernels\n",
+                  (double)global_counts[0]/max_time_finite_difference, simd_kernels ? simd_isa_name(simd_isa_detect()) : "scalar" );
+            }
+         }
          parallel_timer_output(numpe,mype,"CPU:  state->refine_potential  time was",get_cpu_time_refine_potential() );
          parallel_timer_output(numpe,mype,"CPU:    state->calc_mpot         time was",get_cpu_time_calc_mpot() );
          parallel_timer_output(numpe,mype,"CPU:    state->refine_smooth     time was",mesh->get_cpu_time_refine_smooth() );
@@ -2905,17 +4346,17 @@ void State::compare_state_gpu_global_to_cpu_global(const char* string, int cycle
 
 void State::compare_state_cpu_local_to_cpu_global(State *state_global, const char* string, int cycle, uint ncells, uint ncells_global, int *nsizes, int *ndispl)
 {
-   real_t *H_global = state_global->H;
-   real_t *U_global = state_global->U;
-   real_t *V_global = state_global->V;
+   state_t *H_global = state_global->H;
+   state_t *U_global = state_global->U;
+   state_t *V_global = state_global->V;
 
-   vector<real_t>H_check(ncells_global);
-   vector<real_t>U_check(ncells_global);
-   vector<real_t>V_check(ncells_global);
+   vector<state_t>H_check(ncells_global);
+   vector<state_t>U_check(ncells_global);
+   vector<state_t>V_check(ncells_global);
 #ifdef HAVE_MPI
-   MPI_Allgatherv(&H[0], ncells, MPI_C_REAL, &H_check[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
-   MPI_Allgatherv(&U[0], ncells, MPI_C_REAL, &U_check[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
-   MPI_Allgatherv(&V[0], ncells, MPI_C_REAL, &V_check[0], &nsizes[0], &ndispl[0], MPI_C_REAL, MPI_COMM_WORLD);
+   MPI_Allgatherv(&H[0], ncells, MPI_C_STATE, &H_check[0], &nsizes[0], &ndispl[0], MPI_C_STATE, MPI_COMM_WORLD);
+   MPI_Allgatherv(&U[0], ncells, MPI_C_STATE, &U_check[0], &nsizes[0], &ndispl[0], MPI_C_STATE, MPI_COMM_WORLD);
+   MPI_Allgatherv(&V[0], ncells, MPI_C_STATE, &V_check[0], &nsizes[0], &ndispl[0], MPI_C_STATE, MPI_COMM_WORLD);
 #else
    // Just to block compiler warnings
    if (1 == 2) printf("DEBUG -- ncells %u nsizes %d ndispl %d\n",ncells, nsizes[0],ndispl[0]);
@@ -2934,9 +4375,9 @@ void State::compare_state_all_to_gpu_local(State *state_global, uint ncells, uin
 #ifdef HAVE_MPI
    cl_command_queue command_queue = ezcl_get_command_queue();
 
-   real_t *H_global = state_global->H;
-   real_t *U_global = state_global->U;
-   real_t *V_global = state_global->V;
+   state_t *H_global = state_global->H;
+   state_t *U_global = state_global->U;
+   state_t *V_global = state_global->V;
    cl_mem &dev_H_global = state_global->dev_H;
    cl_mem &dev_U_global = state_global->dev_U;
    cl_mem &dev_V_global = state_global->dev_V;
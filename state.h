@@ -63,6 +63,13 @@
 #include "ezcl/ezcl.h"
 #endif
 #include "l7/l7.h"
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+
+#if defined(HAVE_MIXED_PRECISION) && defined(HAVE_OPENCL)
+#error "Mixed precision state storage is not supported with OpenCL"
+#endif
 
 extern "C" void do_calc(void);
 
@@ -74,6 +81,17 @@ enum SUM_TYPE {
 };
 
 
+//  Read-only views of one state variable, indexed by cell like H. The
+//  interleaved view reads it out of per-cell records where H, U and V of a
+//  cell are adjacent, so a neighbor's state comes in with one cache line.
+struct state_array
+{  const state_t *v;
+   real_t operator[](int ic) const { return(v[ic]); } };
+
+struct state_interleaved
+{  const state_t *v;
+   real_t operator[](int ic) const { return(v[3*ic]); } };
+
 enum SIGN_RULE {
    DIAG_RULE,
    X_RULE,
@@ -88,13 +106,27 @@ public:
    MallocPlus state_memory;
    MallocPlus gpu_state_memory;
    Mesh *mesh;
-   real_t *H;
-   real_t *U;
-   real_t *V;
+   state_t *H;
+   state_t *U;
+   state_t *V;
+   state_t *Active;   //  Nonzero for the cells tracked by activity tracking; NULL without it.
    //vector<real_t> H;
    //vector<real_t> U;
    //vector<real_t> V;
 
+   vector<double> xface_flux;   //  Half-step H, U, V on each x-face of the mesh, then their fluxes.
+   vector<double> yface_flux;   //  Half-step H, U, V on each y-face of the mesh, then their fluxes.
+
+   vector<double> lev_deltaT;     //  Timestep of each level in a subcycled step.
+   vector<double> flux_register;  //  H, U, V that came into each cell across each side to another level, by side, when subcycling.
+
+   vector<char> active_hops;      //  One more than the neighbor steps to the nearest cell not at rest; 0 if not tracked.
+
+   vector<int>  tile_cell_index;  //  Cell indices in order, so a tile of cells can be passed as a cell list.
+   vector<int>  tile_mpot;        //  Refinement potential worked out by the tiled finite difference.
+   vector<char> tile_deferred;    //  1 for a boundary cell and 2 for a real cell left for calc_refine_potential by its tile.
+   int          tile_refine_ready;//  Nonzero when tile_mpot holds this cycle's refinement potential.
+
 #ifdef HAVE_OPENCL
    cl_mem dev_H;
    cl_mem dev_U;
@@ -128,6 +160,26 @@ public:
             gpu_time_read,
             gpu_time_write;
 
+   double   next_deltaT,        //  Timestep for the next cycle found by the finite difference (fused timestep).
+            next_deltaT_local,  //  This processor's part of next_deltaT.
+            timestep_g,         //  Gravity and CFL number of the last full set_timestep.
+            timestep_sigma;
+   int      next_deltaT_rezone; //  Mesh rezone count that next_deltaT was found at; -1 if none.
+   long long active_cell_count,        //  Cells stepped with activity tracking, summed over the cycles.
+             active_cell_total;        //  Cells in the mesh, summed over the same cycles.
+   long long tile_cell_count,          //  Real cells whose refinement potential was found in their tile.
+             tile_cell_total;          //  Real cells in the tiled sweeps.
+   long long subcycle_cell_updates,    //  Cells stepped in subcycled steps.
+             subcycle_global_updates;  //  Cells the same steps would have stepped at the finest timestep.
+   long long fd_cell_updates,          //  Cells through the finite difference cell loops.
+             fd_regular_updates;       //  Those of them through the regular stencil loop.
+#ifdef HAVE_MPI
+   MPI_Request next_deltaT_request;
+#endif
+#ifdef HAVE_MIXED_PRECISION
+   double   storage_mass_drift; //  Mass gained by storing the new H in state_t rather than double, summed over the run.
+#endif
+
    // constructor -- allocates state arrays to size ncells
    State(Mesh *mesh_in);
 
@@ -167,6 +219,7 @@ public:
    void apply_boundary_conditions(void);
    void apply_boundary_conditions_local(void);
    void apply_boundary_conditions_ghost(void);
+   void apply_boundary_conditions_cells(const int *cell_list, int ncell_list);
    void remove_boundary_cells(void);
 
    /*******************************************************************
@@ -259,6 +312,9 @@ public:
                        SIGN_RULE sign_rule, int &flag);
 
    void output_timing_info(int do_cpu_calc, int do_gpu_calc, double elapsed_time);
+#ifdef HAVE_MIXED_PRECISION
+   void output_storage_drift(double H_sum);
+#endif
 
    /* state comparison routines */
 #ifdef HAVE_OPENCL
@@ -279,6 +335,40 @@ private:
    State(const State&); // To block copy constructor so copies are not made inadvertently
 
    void print_object_info(void);
+
+   template <class REAL>
+   void calc_face_fluxes(double deltaT);
+   double calc_finite_difference_list(double deltaT, const int *cell_list, int ncell_list,
+                                      state_t *HUV, state_t *H_new, state_t *U_new, state_t *V_new);
+   double calc_finite_difference_neighbors(double deltaT, const int *cell_list, int ncell_list, int regular,
+                                           state_t *HUV, state_t *H_new, state_t *U_new, state_t *V_new);
+   template <class NEIGH>
+   double calc_finite_difference_layout(double deltaT, const int *cell_list, int ncell_list, int regular,
+                                        NEIGH nlft, NEIGH nrht, NEIGH nbot, NEIGH ntop,
+                                        state_t *HUV, state_t *H_new, state_t *U_new, state_t *V_new);
+   template <class NEIGH, class STATEV>
+   double calc_finite_difference_precision(double deltaT, const int *cell_list, int ncell_list, int regular,
+                                           NEIGH nlft, NEIGH nrht, NEIGH nbot, NEIGH ntop,
+                                           STATEV H, STATEV U, STATEV V,
+                                           state_t *H_new, state_t *U_new, state_t *V_new);
+   template <class REAL, class NEIGH, class STATEV, int FACES, int REGULAR>
+   double calc_finite_difference_cells(double deltaT_cycle, const int *cell_list, int ncell_list,
+                                       NEIGH nlft, NEIGH nrht, NEIGH nbot, NEIGH ntop,
+                                       STATEV H, STATEV U, STATEV V,
+                                       state_t *H_new, state_t *U_new, state_t *V_new);
+   template <class REAL, class NEIGH, class STATEV>
+   int calc_finite_difference_simd(double deltaT, const int *cell_list, int ncell_list,
+                                   NEIGH nlft, NEIGH nrht, NEIGH nbot, NEIGH ntop,
+                                   STATEV H, STATEV U, STATEV V,
+                                   state_t *H_new, state_t *U_new, state_t *V_new, double &mindeltaT);
+   void calc_finite_difference_subcycled(double deltaT);
+   void calc_active_cells(void);
+   double calc_finite_difference_tiled(double deltaT, state_t *HUV, state_t *H_new, state_t *U_new, state_t *V_new);
+   void calc_refine_potential_cells(vector<int> &mpot, const state_t *H, const int *cell_list, int ncell_list);
+   template <int REGULAR>
+   void calc_refine_potential_stencil(vector<int> &mpot, const state_t *H, const int *cell_list, int ncell_list);
+   void calc_refine_potential_tile_edges(vector<int> &mpot);
+   void wait_next_deltaT(void);
 };
 
 #endif // ifndef STATE_H_